@@ -1,2 +1,9 @@
 #!/bin/sh
 gcc -std=c11 -g -O0 -o sap src/*.c
+
+# The runtime which programs compiled with -emit-c link against.
+mkdir -p obj
+for f in runtime context simd jit gc output map; do
+    gcc -std=c11 -g -O2 -c -o obj/$f.o src/$f.c || exit 1
+done
+ar rcs libsap.a obj/runtime.o obj/context.o obj/simd.o obj/jit.o obj/gc.o obj/output.o obj/map.o
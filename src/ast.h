@@ -26,6 +26,7 @@ typedef enum NodeTag {
     NODE_SUBSCRIPT,
     NODE_EXPRESSION_LIST,
     NODE_ARRAY_LITERAL,
+    NODE_MAP_LITERAL,
     NODE_CALL,
     NODE_BINARY,
     NODE_UNARY,
@@ -92,6 +93,11 @@ typedef struct AstExpressionList {
     Ast expressions;
 } AstExpressionList;
 
+typedef struct AstMapLiteral {
+    Ast keys;
+    Ast values; // one for each key
+} AstMapLiteral;
+
 typedef struct AstCall {
     struct AstNode *name;
     struct AstNode *args;
@@ -108,11 +114,17 @@ typedef struct AstBlock {
     Ast statements;
 } AstBlock;
 
+enum {
+    LAMBDA_PURE      = 1 << 0,
+    LAMBDA_REACHABLE = 1 << 1, // called (directly or not) from the top-level statements
+};
 typedef struct AstLambda {
     char *name;
     struct AstNode *args;
     struct AstNode *block;
     u64 constant_pool_index;
+    s32 memo_table; // index into Interp.memo_tables, or -1
+    int flags;
 } AstLambda;
 
 typedef struct AstReturn {
@@ -133,6 +145,7 @@ typedef struct AstNode {
         AstSubscript  subscript;
         AstCall       call;
         AstExpressionList expression_list;
+        AstMapLiteral map_literal;
         AstUnary      unary;
         AstLambda     lambda;
         AstReturn     ret;
@@ -2,6 +2,8 @@
 #include "common.h"
 #include "ast.h"
 #include "array.h"
+#include "ir.h"
+#include "gc.h"
 
 #include <stdio.h>
 #include <assert.h>
@@ -10,14 +12,34 @@
 
 static BlockStack block_stack;
 
+typedef Array(char *) Names;
+
+// Expressions which have been compiled ahead of the loop containing them, see `hoist_loop_invariants`.
+typedef struct Hoisted {
+    AstNode *expr;
+    u64 index;
+} Hoisted;
+typedef Array(Hoisted) HoistedExprs;
+static HoistedExprs hoisted;
+
+// Stores which are never read, see `find_dead_stores`.
+static Ast dead_stores;
+
 void compile_statement(Interp *interp, AstNode *stmt);
+u64 compile_expr(Interp *interp, AstNode *expr);
 void compile_if(Interp *interp, AstNode *cf);
 void compile_block(Interp *interp, AstNode *block);
-void compile_call(Interp *interp, AstNode *call);
+void compile_call(Interp *interp, AstNode *call, bool tail_position);
+bool compile_inline_call(Interp *interp, AstNode *call, u64 *result);
+AstNode *find_lambda(Interp *interp, char *name);
+Op array_builtin(Interp *interp, char *name, u32 *num_args);
+Op map_builtin(Interp *interp, char *name, u32 *num_args);
 void compile_break_or_continue(Interp *interp, AstNode *bc);
 void instr(Interp *interp, Op op, s32 arg, u64 line_number);
 u64 compile_loads_for_expression_list(Interp *interp, AstNode *list, bool args);
 u64 add_scope_object(Interp *interp, StackFrame *scope);
+static bool is_dead_store(AstNode *stmt);
+static u64 reachable_length(Ast statements);
 
 void add_primitive_objects(StackFrame *scope) {
     Object undefined = (Object){.tag=OBJECT_UNDEFINED, .pointer=NULL};
@@ -41,15 +63,16 @@ void add_primitive_objects(StackFrame *scope) {
     assert(scope->constant_pool.length-1 == ARRAY_SUBSCRIPT_RESULT_INDEX);
 }
 
-u64 push_frame(Interp *interp, Ast ast) {
-    StackFrame *new_scope = malloc(sizeof(StackFrame));
+u64 push_frame(Interp *interp) {
+    StackFrame *new_scope = region_alloc(interp->region, sizeof(StackFrame));
 
-    new_scope->ast = ast;
     new_scope->parent = interp->scope;
 
     array_init(new_scope->constant_pool, Object);
     add_primitive_objects(new_scope);
     new_scope->stack.top = 0;
+    new_scope->original = NULL;
+    new_scope->active = false;
 
     u64 index = add_scope_object(interp, new_scope);
     interp->scope = new_scope;
@@ -58,7 +81,6 @@ u64 push_frame(Interp *interp, Ast ast) {
 }
 
 void pop_frame(Interp *interp) {
-    // TODO: memory leak! create a linear scope allocator which can free them all at the end
     interp->scope = interp->scope->parent;
 }
 
@@ -99,11 +121,18 @@ u64 add_constant_int(Interp *interp, s64 i) {
     return interp->scope->constant_pool.length-1;
 }
 
+// A string constant, which has its own copy of the text so that it outlives the tokens.
+Object constant_string(Interp *interp, char *text) {
+    u64 length = strlen(text);
+    if (length <= STRING_INLINE_LENGTH) return object_string(text, length);
+
+    char *copy = region_alloc_bytes(interp->region, length + 1);
+    memcpy(copy, text, length + 1);
+    return object_string(copy, length);
+}
+
 u64 add_constant_string(Interp *interp, char *s) {
-    Object o = (Object){
-        .pointer = s,
-        .tag = OBJECT_STRING,
-    };
+    Object o = constant_string(interp, s);
     array_add(interp->scope->constant_pool, o);
     return interp->scope->constant_pool.length-1;
 }
@@ -117,6 +146,11 @@ u64 add_constant_float(Interp *interp, f64 f) {
     return interp->scope->constant_pool.length-1;
 }
 
+u64 add_constant(Interp *interp, Object o) {
+    array_add(interp->scope->constant_pool, o);
+    return interp->scope->constant_pool.length-1;
+}
+
 u64 add_scope_object(Interp *interp, StackFrame *scope) {
     Object o = (Object){
         .scope = scope,
@@ -126,13 +160,6 @@ u64 add_scope_object(Interp *interp, StackFrame *scope) {
     return interp->scope->constant_pool.length-1;
 }
 
-u64 add_array_object(Interp *interp) {
-    Object o = (Object){0};
-    o.tag = OBJECT_ARRAY;
-    array_init(o.array, Object);
-    array_add(interp->scope->constant_pool, o);
-    return interp->scope->constant_pool.length-1;
-}
 
 u64 reserve_constant(Interp *interp) {
     Object o = (Object){0};
@@ -147,7 +174,72 @@ u64 reserve_non_mutable(Interp *interp) {
     return interp->scope->constant_pool.length-1;
 }
 
+static bool has_name(Names names, char *name) {
+    for (u64 i = names.length; i > 0; i--) {
+        if (strcmp(names.data[i-1], name) == 0) return true;
+    }
+    return false;
+}
+
+// Builds the array an array literal evaluates to, at compile time.
+static Object compile_array_literal(Interp *interp, AstNode *expr) {
+    Object array = (Object){0};
+    array.tag = OBJECT_ARRAY;
+    array.array = object_array_new(interp->heap);
+
+    if (!expr->array_literal) {
+        return array;
+    }
+
+    Ast elements;
+    if (expr->array_literal->tag == NODE_EXPRESSION_LIST) {
+        elements = expr->array_literal->expression_list.expressions;
+    } else {
+        elements.data = &expr->array_literal;
+        elements.length = 1;
+    }
+
+    for (u64 i = 0; i < elements.length; i++) {
+        AstNode *node = elements.data[i];
+        if (node->tag == NODE_ARRAY_LITERAL) {
+            object_array_add(array.array, compile_array_literal(interp, node));
+            continue;
+        }
+        u64 index = compile_expr(interp, node);
+        object_array_add(array.array, interp->scope->constant_pool.data[index]);
+    }
+    return array;
+}
+
+// Map literals are built when they're evaluated. The first MAP_LITERAL_MAX_PAIRS keys and values go on the stack for
+// NEW_MAP, and any more are added to the new map one at a time.
+static u64 compile_map_literal(Interp *interp, AstNode *expr) {
+    Ast keys = expr->map_literal.keys;
+    Ast values = expr->map_literal.values;
+    u64 count = (keys.length < MAP_LITERAL_MAX_PAIRS ? keys.length : MAP_LITERAL_MAX_PAIRS);
+
+    u64 map_index = reserve_constant(interp);
+    for (u64 i = 0; i < count; i++) {
+        instr(interp, LOAD, compile_expr(interp, keys.data[i]), expr->line);
+        instr(interp, LOAD, compile_expr(interp, values.data[i]), expr->line);
+    }
+    instr(interp, NEW_MAP, count, expr->line);
+    instr(interp, STORE, map_index, expr->line);
+
+    for (u64 i = count; i < keys.length; i++) {
+        instr(interp, LOAD_ARG, compile_expr(interp, values.data[i]), expr->line);
+        instr(interp, LOAD_ARG, compile_expr(interp, keys.data[i]), expr->line);
+        instr(interp, MAP_SET, map_index, expr->line);
+        instr(interp, STORE_ARG_OR_RETVAL, reserve_constant(interp), expr->line);
+    }
+    return map_index;
+}
+
 u64 compile_expr(Interp *interp, AstNode *expr) {
+    for (u64 i = hoisted.length; i > 0; i--) {
+        if (hoisted.data[i-1].expr == expr) return hoisted.data[i-1].index;
+    }
+
     switch (expr->tag) {
     case NODE_ENCLOSED_EXPRESSION: {
         return compile_expr(interp, expr->enclosed_expr.inner);
@@ -174,31 +266,18 @@ u64 compile_expr(Interp *interp, AstNode *expr) {
     } break;
 
     case NODE_ARRAY_LITERAL: {
-        u64 array_index = add_array_object(interp);
-
-        if (!expr->array_literal) {
-            return array_index;
-        }
-        
-        Object *array = &interp->scope->constant_pool.data[array_index];
-
-        if (expr->array_literal->tag != NODE_EXPRESSION_LIST) {
-            u64 index = compile_expr(interp, expr->array_literal);
-            array_add(array->array, interp->scope->constant_pool.data[index]);
-            return array_index;
-        }
-
-        int length = expr->array_literal->expression_list.expressions.length;
-
-        for (int i = 0; i < length; i++) {
-            AstNode *node = expr->array_literal->expression_list.expressions.data[i];
-            u64 index = compile_expr(interp, node);
-            array_add(array->array, interp->scope->constant_pool.data[index]);
-        }
-        
+        // Each evaluation of the literal gets its own copy of the array, since arrays are shared by reference.
+        u64 literal_index = add_constant(interp, compile_array_literal(interp, expr));
+        u64 array_index = reserve_constant(interp);
+        instr(interp, NEW_ARRAY, literal_index, expr->line);
+        instr(interp, STORE, array_index, expr->line);
         return array_index;
     } break;
 
+    case NODE_MAP_LITERAL: {
+        return compile_map_literal(interp, expr);
+    } break;
+
     case NODE_SUBSCRIPT: {
         u64 target_index = compile_expr(interp, expr->subscript.array);
         u64 index_index = compile_expr(interp, expr->subscript.inner_expr);
@@ -208,7 +287,7 @@ u64 compile_expr(Interp *interp, AstNode *expr) {
     } break;
 
     case NODE_IDENTIFIER: {
-        AstNode *maybe_decl = find_decl(current_block(block_stack), interp->root_scope, expr->identifier);
+        AstNode *maybe_decl = find_decl(current_block(block_stack), interp->program, expr->identifier);
         if (!maybe_decl) {
             compile_error(interp, expr, "undeclared identifier '%s'", expr->identifier);
             return 0;
@@ -271,8 +350,12 @@ u64 compile_expr(Interp *interp, AstNode *expr) {
     } break;
 
     case NODE_CALL: {
+        u64 inlined_index;
+        if (compile_inline_call(interp, expr, &inlined_index)) {
+            return inlined_index;
+        }
         u64 index = reserve_constant(interp);
-        compile_call(interp, expr);
+        compile_call(interp, expr, false);
         instr(interp, STORE_ARG_OR_RETVAL, index, expr->line);
         return index;
     } break;
@@ -296,6 +379,7 @@ void compile_let(Interp *interp, AstNode *node) {
     }
     
     node->let.constant_pool_index = variable_index; // for name lookup
+    if (is_dead_store(node)) return;
 
     // Store null by default, then compile the expression if there is one.
     // Basically, this code implements null-initialization-by-default.
@@ -308,8 +392,24 @@ void compile_let(Interp *interp, AstNode *node) {
     instr(interp, STORE, variable_index, node->line);
 }
 
+// Compiles `x = append(x, v)` as an append to x, which then doesn't need storing back.
+static bool compile_append_in_place(Interp *interp, AstNode *value, u64 target_index) {
+    if (value->tag != NODE_CALL || value->call.name->tag != NODE_IDENTIFIER) return false;
+    if (strcmp(value->call.name->identifier, "append") != 0) return false;
+
+    Ast args = value->call.args->expression_list.expressions;
+    if (args.length != 2 || args.data[0]->tag != NODE_IDENTIFIER) return false;
+    if (compile_expr(interp, args.data[0]) != target_index) return false;
+
+    u64 value_index = compile_expr(interp, args.data[1]);
+    instr(interp, LOAD_ARG, value_index, value->line);
+    instr(interp, APPEND_IN_PLACE, target_index, value->line);
+    return true;
+}
+
 void compile_assignment(Interp *interp, AstNode *node) {
     AstBinary ass = node->binary;
+    if (is_dead_store(node)) return;
 
     u64 target_index = compile_expr(interp, ass.left);
     if (interp->scope->constant_pool.data[target_index].non_mutable) {
@@ -317,6 +417,8 @@ void compile_assignment(Interp *interp, AstNode *node) {
         return;
     }
 
+    if (ass.op == Token_EQUAL && compile_append_in_place(interp, ass.right, target_index)) return;
+
     u64 value_index  = compile_expr(interp, ass.right);
 
     switch (ass.op) {
@@ -369,7 +471,9 @@ u64 compile_loads_for_expression_list(Interp *interp, AstNode *list, bool args)
     return i;
 }
 
-void compile_call(Interp *interp, AstNode *call) {
+// `tail_position` is true when the call is the value of a `return` inside a function.
+// Calls to user functions in that position reuse the caller's activation, see TAIL_CALL.
+void compile_call(Interp *interp, AstNode *call, bool tail_position) {
     AstNode *name = call->call.name;
     if (name->tag == NODE_IDENTIFIER) {
         char *name_ident = name->identifier;
@@ -405,40 +509,244 @@ void compile_call(Interp *interp, AstNode *call) {
             return;
         }
 
-        s32 num_args = compile_loads_for_expression_list(interp, call->call.args, true);
+        u32 num_builtin_args;
+        Op builtin = array_builtin(interp, name_ident, &num_builtin_args);
+        if (builtin != NOP) {
+            Ast args = call->call.args->expression_list.expressions;
+            if (args.length != num_builtin_args) {
+                compile_error(interp, call, "'%s' takes %u argument%s", name_ident, num_builtin_args, (num_builtin_args == 1 ? "" : "s"));
+                return;
+            }
+            u64 value_loc = (args.length == 2 ? compile_expr(interp, args.data[1]) : 0);
+            u64 array_loc = compile_expr(interp, args.data[0]);
+            if (args.length == 2) instr(interp, LOAD_ARG, value_loc, call->line);
+            instr(interp, builtin, array_loc, call->line);
+            return;
+        }
 
-        for (int i = 0; i < interp->root_scope->ast.length; i++) {
-            AstNode *n = interp->root_scope->ast.data[i];
-            if (n->tag != NODE_LAMBDA) continue;
+        builtin = map_builtin(interp, name_ident, &num_builtin_args);
+        if (builtin != NOP) {
+            Ast args = call->call.args->expression_list.expressions;
+            if (args.length != num_builtin_args) {
+                compile_error(interp, call, "'%s' takes %u arguments", name_ident, num_builtin_args);
+                return;
+            }
+            // The value of `set`, then the key, are passed on call_storage and the map by its slot.
+            for (u64 i = args.length-1; i > 0; i--) {
+                instr(interp, LOAD_ARG, compile_expr(interp, args.data[i]), call->line);
+            }
+            instr(interp, builtin, compile_expr(interp, args.data[0]), call->line);
+            return;
+        }
+
+        s32 num_args = compile_loads_for_expression_list(interp, call->call.args, true);
 
+        AstNode *n = find_lambda(interp, name_ident);
+        if (n) {
             AstLambda f = n->lambda;
+            int expected_num_args = f.args->expression_list.expressions.length;
+        
+            if (expected_num_args < num_args) {
+                compile_error(interp, call, "too many arguments provided at call to '%s'", name_ident);
+                return;
+            }
 
-            if (strcmp(name_ident, f.name) == 0) {
-                int expected_num_args = f.args->expression_list.expressions.length;
-            
-                if (expected_num_args < num_args) {
-                    compile_error(interp, call, "too many arguments provided at call to '%s'", name_ident);
-                    return;
-                }
+            if (expected_num_args > num_args) {
+                compile_error(interp, call, "too few arguments provided at call to '%s'", name_ident);
+                return;
+            }
 
-                if (expected_num_args > num_args) {
-                    compile_error(interp, call, "too few arguments provided at call to '%s'", name_ident);
-                    return;
-                }
+            if (tail_position) {
+                instr(interp, TAIL_CALL, f.constant_pool_index, call->line);
+                return;
+            }
 
+            // MEMO_LOOKUP skips the next three instructions when the result is already in the table.
+            if (f.memo_table >= 0) {
+                instr(interp, MEMO_LOOKUP, f.memo_table, call->line);
                 instr(interp, LOAD_PC, 0, call->line);
                 instr(interp, CALL_FUNC, f.constant_pool_index, call->line);
+                instr(interp, MEMO_STORE, f.memo_table, call->line);
                 return;
             }
+
+            instr(interp, LOAD_PC, 0, call->line);
+            instr(interp, CALL_FUNC, f.constant_pool_index, call->line);
+            return;
         }
 
         compile_error(interp, call, "undeclared identifier '%s'", name_ident);
     }
 }
 
+AstNode *find_lambda(Interp *interp, char *name) {
+    for (int i = 0; i < interp->program.length; i++) {
+        AstNode *n = interp->program.data[i];
+        if (n->tag != NODE_LAMBDA) continue;
+        if (strcmp(name, n->lambda.name) == 0) {
+            return n;
+        }
+    }
+    return NULL;
+}
+
+// Returns the instruction for a call to one of the numeric array builtins, or NOP if `name` isn't one.
+// A function with the same name hides the builtin.
+Op array_builtin(Interp *interp, char *name, u32 *num_args) {
+    static const struct { const char *name; Op op; u32 num_args; } builtins[] = {
+        {"sum", SUM, 1}, {"min", MIN, 1}, {"max", MAX, 1}, {"dot", DOT, 2}, {"scale", SCALE, 2}, {"fill", FILL, 2},
+    };
+    for (u64 i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strcmp(name, builtins[i].name) != 0) continue;
+        if (find_lambda(interp, name)) return NOP;
+        if (num_args) *num_args = builtins[i].num_args;
+        return builtins[i].op;
+    }
+    return NOP;
+}
+
+// Likewise for the map builtins.
+Op map_builtin(Interp *interp, char *name, u32 *num_args) {
+    static const struct { const char *name; Op op; u32 num_args; } builtins[] = {
+        {"get", MAP_GET, 2}, {"set", MAP_SET, 3}, {"has", MAP_HAS, 2}, {"delete", MAP_DELETE, 2},
+    };
+    for (u64 i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strcmp(name, builtins[i].name) != 0) continue;
+        if (find_lambda(interp, name)) return NOP;
+        if (num_args) *num_args = builtins[i].num_args;
+        return builtins[i].op;
+    }
+    return NOP;
+}
+
+static bool is_param(Ast params, char *name) {
+    for (u64 i = 0; i < params.length; i++) {
+        if (strcmp(params.data[i]->let.name, name) == 0) return true;
+    }
+    return false;
+}
+
+// Counts the nodes in an expression which can be spliced into a caller.
+// Returns -1 if the expression refers to anything other than the function's parameters and literals.
+static int inlinable_size(AstNode *expr, Ast params) {
+    switch (expr->tag) {
+    case NODE_INT_LITERAL:
+    case NODE_FLOAT_LITERAL:
+    case NODE_STRING_LITERAL:
+    case NODE_NULL_LITERAL:
+    case NODE_BOOLEAN_LITERAL: {
+        return 1;
+    } break;
+
+    case NODE_IDENTIFIER: {
+        return (is_param(params, expr->identifier) ? 1 : -1);
+    } break;
+
+    case NODE_ENCLOSED_EXPRESSION: {
+        int inner = inlinable_size(expr->enclosed_expr.inner, params);
+        return (inner < 0 ? -1 : inner+1);
+    } break;
+
+    case NODE_UNARY: {
+        if (expr->unary.op != Token_MINUS) return -1;
+        int operand = inlinable_size(expr->unary.operand, params);
+        return (operand < 0 ? -1 : operand+1);
+    } break;
+
+    case NODE_BINARY: {
+        switch (expr->binary.op) {
+        case Token_EQUAL_EQUAL: case Token_GREATER: case Token_LESS:
+        case Token_GREATER_EQUAL: case Token_LESS_EQUAL:
+        case Token_PLUS: case Token_MINUS: case Token_STAR: case Token_SLASH: break;
+        default: return -1;
+        }
+        int left  = inlinable_size(expr->binary.left, params);
+        int right = inlinable_size(expr->binary.right, params);
+        return ((left < 0 || right < 0) ? -1 : left+right+1);
+    } break;
+    }
+
+    return -1;
+}
+
+// Returns the expression a function returns if the function is small enough to be inlined, otherwise NULL.
+// Parameters are appended to the function's block by the parser, so a body of `return <expr>` has exactly one
+// statement more than there are parameters.
+AstNode *inlinable_body(AstNode *lambda) {
+    Ast params = lambda->lambda.args->expression_list.expressions;
+    Ast statements = lambda->lambda.block->block.statements;
+
+    if (statements.length != params.length+1) return NULL;
+
+    AstNode *ret = statements.data[0];
+    if (ret->tag != NODE_RETURN || !ret->ret.value) return NULL;
+
+    int size = inlinable_size(ret->ret.value, params);
+    if (size < 0 || size > INLINE_NODE_THRESHOLD) return NULL;
+
+    return ret->ret.value;
+}
+
+// Splices the body of a small function into the caller instead of emitting a call.
+// Each argument is compiled in the caller, and the function's parameters are temporarily bound to the
+// caller's slots for those arguments while the body is compiled. The slot holding the body's value
+// takes the place of the return value.
+bool compile_inline_call(Interp *interp, AstNode *call, u64 *result) {
+    AstNode *name = call->call.name;
+    if (name->tag != NODE_IDENTIFIER) return false;
+
+    AstNode *lambda = find_lambda(interp, name->identifier);
+    if (!lambda) return false;
+
+    AstNode *body = inlinable_body(lambda);
+    if (!body) return false;
+
+    Ast params = lambda->lambda.args->expression_list.expressions;
+    Ast args   = call->call.args->expression_list.expressions;
+    if (params.length != args.length) return false; // compile_call reports the error
+    if (params.length > INLINE_NODE_THRESHOLD) return false;
+
+    u64 saved[INLINE_NODE_THRESHOLD];
+    u64 arg_slots[INLINE_NODE_THRESHOLD];
+
+    // Same evaluation order as compile_loads_for_expression_list.
+    for (u64 j = args.length; j > 0; j--) {
+        AstNode *arg = args.data[j-1];
+        u64 slot = compile_expr(interp, arg);
+
+        // Every subscript writes to the same slot, so it has to be copied before the next argument is compiled.
+        if (slot == ARRAY_SUBSCRIPT_RESULT_INDEX) {
+            u64 copy = reserve_constant(interp);
+            instr(interp, LOAD, slot, arg->line);
+            instr(interp, STORE, copy, arg->line);
+            slot = copy;
+        }
+        arg_slots[j-1] = slot;
+    }
+
+    for (u64 i = 0; i < params.length; i++) {
+        saved[i] = params.data[i]->let.constant_pool_index;
+        params.data[i]->let.constant_pool_index = arg_slots[i];
+    }
+
+    push_block(&block_stack, lambda->lambda.block);
+    *result = compile_expr(interp, body);
+    pop_block(&block_stack);
+
+    for (u64 i = 0; i < params.length; i++) {
+        params.data[i]->let.constant_pool_index = saved[i];
+    }
+
+    return true;
+}
+
 void compile_func(Interp *interp, AstNode *node) {
-    u64 lambda_index = reserve_constant(interp);
-    node->lambda.constant_pool_index = lambda_index;
+    // Top-level functions have their slot reserved up front by `compile` so they can be called before they're defined.
+    u64 lambda_index = node->lambda.constant_pool_index;
+    if (lambda_index == 0) {
+        lambda_index = reserve_constant(interp);
+        node->lambda.constant_pool_index = lambda_index;
+    }
     instr(interp, BEGIN_BLOCK, lambda_index, node->line);
 
     AstLambda f = node->lambda;
@@ -446,7 +754,7 @@ void compile_func(Interp *interp, AstNode *node) {
 
     Ast args = f.args->expression_list.expressions;
 
-    u64 scope_index = push_frame(interp, b.statements);
+    u64 scope_index = push_frame(interp);
 
     // compile each as lets
     for (int i = 0; i < args.length; i++) {
@@ -468,8 +776,22 @@ void compile_func(Interp *interp, AstNode *node) {
     instr(interp, END_BLOCK, lambda_index, 0); // TODO: line numbers
 }
 
+// Whether `return <call>` can be compiled as a TAIL_CALL.
+// Built-ins and inlinable functions don't go through a call frame in the first place.
+static bool is_tail_call(Interp *interp, AstNode *value) {
+    if (interp->scope == interp->root_scope) return false;
+    if (value->tag != NODE_CALL || value->call.name->tag != NODE_IDENTIFIER) return false;
+
+    AstNode *lambda = find_lambda(interp, value->call.name->identifier);
+    return (lambda && !inlinable_body(lambda));
+}
+
 void compile_return(Interp *interp, AstNode *node) {
     AstReturn r = node->ret;
+    if (r.value && is_tail_call(interp, r.value)) {
+        compile_call(interp, r.value, true);
+        return;
+    }
     if (r.value) {
         u64 value_index = compile_expr(interp, node->ret.value);
         instr(interp, POP_SCOPE_RETURN, value_index, node->line);
@@ -499,7 +821,326 @@ typedef Array(u64) PatchLocations;
 static PatchLocations breaks_to_patch;
 static u64 continue_loc = 0;
 
+//
+// Loop-invariant code motion.
+// Expressions in a loop which only depend on variables the loop never assigns are compiled once before the loop.
+//
+
+// Added to the names a loop assigns when it might append to any array, it can't clash with a variable's name.
+#define APPENDS_TO_ARRAYS "append()"
+
+// Collects the names of every variable a loop assigns, declares or appends to.
+// Returns false if the loop contains something the analysis doesn't understand.
+static bool collect_assigned_names(AstNode *node, Names *assigned) {
+    if (!node) return true;
+
+    switch (node->tag) {
+    case NODE_LAMBDA: {
+        return false;
+    } break;
+
+    case NODE_LET: {
+        array_add(*assigned, node->let.name);
+        return collect_assigned_names(node->let.expr, assigned);
+    } break;
+
+    case NODE_BLOCK: {
+        Ast statements = node->block.statements;
+        for (u64 i = 0; i < statements.length; i++) {
+            if (!collect_assigned_names(statements.data[i], assigned)) return false;
+        }
+        return true;
+    } break;
+
+    case NODE_EXPRESSION_LIST: {
+        Ast expressions = node->expression_list.expressions;
+        for (u64 i = 0; i < expressions.length; i++) {
+            if (!collect_assigned_names(expressions.data[i], assigned)) return false;
+        }
+        return true;
+    } break;
+
+    case NODE_BINARY: {
+        if (node->binary.op > Token_ASSIGNMENTS_START && node->binary.op < Token_ASSIGNMENTS_END) {
+            if (node->binary.left->tag != NODE_IDENTIFIER) return false;
+            array_add(*assigned, node->binary.left->identifier);
+        }
+        return collect_assigned_names(node->binary.left, assigned) && collect_assigned_names(node->binary.right, assigned);
+    } break;
+
+    case NODE_CALL: {
+        Ast args = node->call.args->expression_list.expressions;
+        AstNode *name = node->call.name;
+        if (name->tag == NODE_IDENTIFIER && strcmp(name->identifier, "append") == 0 && args.length > 0) {
+            if (args.data[0]->tag != NODE_IDENTIFIER) return false;
+            array_add(*assigned, args.data[0]->identifier);
+        }
+        // Arrays are shared by reference, so an append to one name (or inside a function) can change another's length.
+        bool builtin = (name->tag == NODE_IDENTIFIER && (strcmp(name->identifier, "print") == 0 || strcmp(name->identifier, "len") == 0));
+        if (!builtin) array_add(*assigned, APPENDS_TO_ARRAYS);
+        return collect_assigned_names(node->call.args, assigned);
+    } break;
+
+    case NODE_RETURN:              return collect_assigned_names(node->ret.value, assigned);
+    case NODE_ENCLOSED_EXPRESSION: return collect_assigned_names(node->enclosed_expr.inner, assigned);
+    case NODE_UNARY:               return collect_assigned_names(node->unary.operand, assigned);
+    case NODE_ARRAY_LITERAL:       return collect_assigned_names(node->array_literal, assigned);
+
+    case NODE_MAP_LITERAL: {
+        for (u64 i = 0; i < node->map_literal.keys.length; i++) {
+            if (!collect_assigned_names(node->map_literal.keys.data[i], assigned)) return false;
+            if (!collect_assigned_names(node->map_literal.values.data[i], assigned)) return false;
+        }
+        return true;
+    } break;
+
+    case NODE_SUBSCRIPT: {
+        return collect_assigned_names(node->subscript.array, assigned) && collect_assigned_names(node->subscript.inner_expr, assigned);
+    } break;
+
+    case NODE_CONTROL_FLOW_IF:
+    case NODE_CONTROL_FLOW_LOOP: {
+        return collect_assigned_names(node->cf.condition, assigned) && collect_assigned_names(node->cf.block, assigned);
+    } break;
+    }
+
+    return true;
+}
+
+static bool is_hoisted(AstNode *expr) {
+    for (u64 i = 0; i < hoisted.length; i++) {
+        if (hoisted.data[i].expr == expr) return true;
+    }
+    return false;
+}
+
+// Whether an expression has no side effects and gives the same value on every iteration of the loop.
+// Division is left alone so that hoisting can't introduce a division by zero.
+static bool is_loop_invariant(AstNode *expr, Names assigned) {
+    switch (expr->tag) {
+    case NODE_INT_LITERAL:
+    case NODE_FLOAT_LITERAL:
+    case NODE_STRING_LITERAL:
+    case NODE_NULL_LITERAL:
+    case NODE_BOOLEAN_LITERAL: {
+        return true;
+    } break;
+
+    case NODE_IDENTIFIER:          return !has_name(assigned, expr->identifier);
+    case NODE_ENCLOSED_EXPRESSION: return is_loop_invariant(expr->enclosed_expr.inner, assigned);
+
+    case NODE_UNARY: {
+        return (expr->unary.op == Token_MINUS && is_loop_invariant(expr->unary.operand, assigned));
+    } break;
+
+    case NODE_BINARY: {
+        switch (expr->binary.op) {
+        case Token_EQUAL_EQUAL: case Token_GREATER: case Token_LESS:
+        case Token_GREATER_EQUAL: case Token_LESS_EQUAL:
+        case Token_PLUS: case Token_MINUS: case Token_STAR: break;
+        default: return false;
+        }
+        return is_loop_invariant(expr->binary.left, assigned) && is_loop_invariant(expr->binary.right, assigned);
+    } break;
+
+    case NODE_CALL: {
+        AstNode *name = expr->call.name;
+        Ast args = expr->call.args->expression_list.expressions;
+        if (name->tag != NODE_IDENTIFIER || strcmp(name->identifier, "len") != 0 || args.length != 1) return false;
+        if (has_name(assigned, APPENDS_TO_ARRAYS)) return false;
+        return is_loop_invariant(args.data[0], assigned);
+    } break;
+    }
+
+    return false;
+}
+
+// Whether hoisting an expression would save any work.
+static bool is_worth_hoisting(AstNode *expr) {
+    switch (expr->tag) {
+    case NODE_ENCLOSED_EXPRESSION: return is_worth_hoisting(expr->enclosed_expr.inner);
+    case NODE_UNARY:
+    case NODE_BINARY:
+    case NODE_CALL: return !is_hoisted(expr);
+    }
+    return false;
+}
+
+// Finds the largest invariant subexpressions of `expr`.
+static void find_loop_invariants(AstNode *expr, Names assigned, Ast *out) {
+    if (!expr) return;
+
+    if (is_worth_hoisting(expr) && is_loop_invariant(expr, assigned)) {
+        array_add(*out, expr);
+        return;
+    }
+
+    switch (expr->tag) {
+    case NODE_ENCLOSED_EXPRESSION: {
+        find_loop_invariants(expr->enclosed_expr.inner, assigned, out);
+    } break;
+
+    case NODE_UNARY: {
+        find_loop_invariants(expr->unary.operand, assigned, out);
+    } break;
+
+    case NODE_BINARY: {
+        // The target of an assignment is a variable, not a value.
+        if (!(expr->binary.op > Token_ASSIGNMENTS_START && expr->binary.op < Token_ASSIGNMENTS_END)) {
+            find_loop_invariants(expr->binary.left, assigned, out);
+        }
+        find_loop_invariants(expr->binary.right, assigned, out);
+    } break;
+
+    case NODE_SUBSCRIPT: {
+        find_loop_invariants(expr->subscript.inner_expr, assigned, out);
+    } break;
+
+    case NODE_CALL: {
+        Ast args = expr->call.args->expression_list.expressions;
+        for (u64 i = 0; i < args.length; i++) {
+            find_loop_invariants(args.data[i], assigned, out);
+        }
+    } break;
+    }
+}
+
+static void compile_hoisted(Interp *interp, Ast exprs) {
+    for (u64 i = 0; i < exprs.length; i++) {
+        Hoisted h;
+        h.expr = exprs.data[i];
+        h.index = compile_expr(interp, h.expr);
+        array_add(hoisted, h);
+    }
+}
+
+// Whether evaluating `expr` could change anything, judging calls the way the purity analysis does.
+// Evaluating it could still raise a runtime error.
+static bool has_side_effects(Interp *interp, AstNode *expr) {
+    if (!expr) return false;
+
+    switch (expr->tag) {
+    case NODE_INT_LITERAL:
+    case NODE_FLOAT_LITERAL:
+    case NODE_STRING_LITERAL:
+    case NODE_NULL_LITERAL:
+    case NODE_BOOLEAN_LITERAL:
+    case NODE_IDENTIFIER: {
+        return false;
+    } break;
+
+    case NODE_ENCLOSED_EXPRESSION: return has_side_effects(interp, expr->enclosed_expr.inner);
+    case NODE_UNARY:               return has_side_effects(interp, expr->unary.operand);
+    case NODE_ARRAY_LITERAL:       return has_side_effects(interp, expr->array_literal);
+
+    case NODE_EXPRESSION_LIST: {
+        Ast list = expr->expression_list.expressions;
+        for (u64 i = 0; i < list.length; i++) {
+            if (has_side_effects(interp, list.data[i])) return true;
+        }
+        return false;
+    } break;
+
+    case NODE_MAP_LITERAL: {
+        for (u64 i = 0; i < expr->map_literal.keys.length; i++) {
+            if (has_side_effects(interp, expr->map_literal.keys.data[i])) return true;
+            if (has_side_effects(interp, expr->map_literal.values.data[i])) return true;
+        }
+        return false;
+    } break;
+
+    case NODE_SUBSCRIPT: {
+        return has_side_effects(interp, expr->subscript.array) || has_side_effects(interp, expr->subscript.inner_expr);
+    } break;
+
+    case NODE_BINARY: {
+        if (expr->binary.op > Token_ASSIGNMENTS_START && expr->binary.op < Token_ASSIGNMENTS_END) return true;
+        return has_side_effects(interp, expr->binary.left) || has_side_effects(interp, expr->binary.right);
+    } break;
+
+    case NODE_CALL: {
+        AstNode *name = expr->call.name;
+        if (name->tag != NODE_IDENTIFIER || has_side_effects(interp, expr->call.args)) return true;
+
+        if (strcmp(name->identifier, "len") == 0) return false;
+        if (array_builtin(interp, name->identifier, NULL) != NOP) return false;
+        Op map_op = map_builtin(interp, name->identifier, NULL);
+        if (map_op != NOP) return (map_op != MAP_GET && map_op != MAP_HAS);
+
+        AstNode *callee = find_lambda(interp, name->identifier);
+        return !(callee && (callee->lambda.flags & LAMBDA_PURE));
+    } break;
+    }
+
+    return true;
+}
+
+// Compiles the loop-invariant parts of a loop ahead of it and records them in `hoisted`.
+// Everything in the condition runs at least once, so its invariants go straight into the preheader.
+// Invariants from the body are taken from the statements which run on every iteration (the ones before
+// any control flow), and only hoisted behind a copy of the loop condition, so they never run for a loop
+// which doesn't. That evaluates the condition one more time, so it's only done when the condition has
+// no side effects.
+// Returns the location of the guard's JUMP_FALSE to be patched to the end of the loop, or 0 if there's no guard.
+static u64 hoist_loop_invariants(Interp *interp, AstNode *cf, u64 *guard_block_id) {
+    Names assigned;
+    array_init(assigned, char *);
+
+    u64 guard = 0;
+
+    if (!collect_assigned_names(cf->cf.condition, &assigned) || !collect_assigned_names(cf->cf.block, &assigned)) {
+        array_free(assigned);
+        return guard;
+    }
+
+    Ast exprs;
+    array_init(exprs, AstNode *);
+
+    find_loop_invariants(cf->cf.condition, assigned, &exprs);
+    compile_hoisted(interp, exprs);
+
+    if (has_side_effects(interp, cf->cf.condition)) {
+        array_free(exprs);
+        array_free(assigned);
+        return guard;
+    }
+
+    exprs.length = 0;
+    Ast body = cf->cf.block->block.statements;
+    for (u64 i = 0; i < body.length; i++) {
+        AstNode *stmt = body.data[i];
+        if (stmt->tag == NODE_LET) {
+            find_loop_invariants(stmt->let.expr, assigned, &exprs);
+        } else if (stmt->tag == NODE_BINARY || stmt->tag == NODE_CALL) {
+            find_loop_invariants(stmt, assigned, &exprs);
+        } else {
+            break;
+        }
+    }
+
+    if (exprs.length > 0) {
+        // Same shape as an `if`: the instruction after JUMP_FALSE is skipped when it isn't taken.
+        u64 condition_index = compile_expr(interp, cf->cf.condition);
+        instr(interp, LOAD, condition_index, cf->line);
+        instr(interp, JUMP_FALSE, 0, cf->line);
+        guard = interp->instructions.length-1;
+
+        *guard_block_id = reserve_constant(interp);
+        instr(interp, BEGIN_BLOCK, *guard_block_id, cf->line);
+
+        compile_hoisted(interp, exprs);
+    }
+
+    array_free(exprs);
+    array_free(assigned);
+    return guard;
+}
+
 void compile_loop(Interp *interp, AstNode *cf) {
+    u64 hoisted_before = hoisted.length;
+    u64 guard_block_id = 0;
+    u64 guard = hoist_loop_invariants(interp, cf, &guard_block_id);
+
     u64 condition_jump = interp->instructions.length-1;
 
     u64 condition_index = compile_expr(interp, cf->cf.condition);
@@ -534,6 +1175,13 @@ void compile_loop(Interp *interp, AstNode *cf) {
     }
 
     // TODO maybe clear patches array here
+
+    if (guard) {
+        instr(interp, END_BLOCK, guard_block_id, 0);
+        interp->instructions.data[guard].arg = interp->instructions.length-1;
+    }
+
+    hoisted.length = hoisted_before;
 }
 
 void compile_break_continue(Interp *interp, AstNode *stmt) {
@@ -557,7 +1205,9 @@ void compile_statement(Interp *interp, AstNode *stmt) {
     } break;
 
     case NODE_CALL: {
-        compile_call(interp, stmt);
+        compile_call(interp, stmt, false);
+        // Everything but `print` leaves a result on call_storage, which nothing is going to use.
+        if (interp->last_op != PRINT) instr(interp, STORE_ARG_OR_RETVAL, reserve_constant(interp), stmt->line);
     } break;
 
     case NODE_BINARY: {
@@ -593,7 +1243,8 @@ void compile_block(Interp *interp, AstNode *block) {
 
     push_block(&block_stack, block);
 
-    for (u64 i = 0; i < block->block.statements.length; i++) {
+    u64 length = reachable_length(block->block.statements);
+    for (u64 i = 0; i < length; i++) {
         AstNode *stmt = block->block.statements.data[i];
         compile_statement(interp, stmt);
     }
@@ -601,46 +1252,594 @@ void compile_block(Interp *interp, AstNode *block) {
     pop_block(&block_stack);
 }
 
-Interp compile(Ast ast, char *file_name) {
+//
+// Purity analysis.
+// A function is pure if it doesn't print, doesn't append, doesn't assign to anything it didn't declare itself,
+// doesn't read variables from outside of itself, and only calls other pure functions.
+//
+static bool is_pure(Interp *interp, AstNode *node, Names *locals);
+
+static bool is_pure_list(Interp *interp, Ast list, Names *locals) {
+    for (u64 i = 0; i < list.length; i++) {
+        if (!is_pure(interp, list.data[i], locals)) return false;
+    }
+    return true;
+}
+
+static bool is_pure_block(Interp *interp, AstNode *block, Names *locals) {
+    u64 declared_before = locals->length;
+    bool pure = is_pure_list(interp, block->block.statements, locals);
+    locals->length = declared_before;
+    return pure;
+}
+
+static bool is_pure_call(Interp *interp, AstNode *call, Names *locals) {
+    AstNode *name = call->call.name;
+    if (name->tag != NODE_IDENTIFIER) return false;
+
+    Ast args = call->call.args->expression_list.expressions;
+    if (!is_pure_list(interp, args, locals)) return false;
+
+    if (strcmp(name->identifier, "print") == 0) return false;
+    if (strcmp(name->identifier, "len") == 0) return true;
+    if (array_builtin(interp, name->identifier, NULL) != NOP) return true;
+
+    // Arrays and maps are shared by reference, so even appending to a local one might change one the caller can see.
+    if (strcmp(name->identifier, "append") == 0) return false;
+    Op map_op = map_builtin(interp, name->identifier, NULL);
+    if (map_op != NOP) return (map_op == MAP_GET || map_op == MAP_HAS);
+
+    AstNode *callee = find_lambda(interp, name->identifier);
+    return (callee && (callee->lambda.flags & LAMBDA_PURE));
+}
+
+static bool is_pure(Interp *interp, AstNode *node, Names *locals) {
+    if (!node) return true;
+
+    switch (node->tag) {
+    case NODE_INT_LITERAL:
+    case NODE_FLOAT_LITERAL:
+    case NODE_STRING_LITERAL:
+    case NODE_NULL_LITERAL:
+    case NODE_BOOLEAN_LITERAL:
+    case NODE_BREAK_OR_CONTINUE: {
+        return true;
+    } break;
+
+    case NODE_LET: {
+        if (!is_pure(interp, node->let.expr, locals)) return false;
+        array_add(*locals, node->let.name);
+        return true;
+    } break;
+
+    case NODE_IDENTIFIER:           return has_name(*locals, node->identifier);
+    case NODE_BLOCK:                return is_pure_block(interp, node, locals);
+    case NODE_RETURN:               return is_pure(interp, node->ret.value, locals);
+    case NODE_ENCLOSED_EXPRESSION:  return is_pure(interp, node->enclosed_expr.inner, locals);
+    case NODE_UNARY:                return is_pure(interp, node->unary.operand, locals);
+    case NODE_ARRAY_LITERAL:        return is_pure(interp, node->array_literal, locals);
+    case NODE_EXPRESSION_LIST:      return is_pure_list(interp, node->expression_list.expressions, locals);
+
+    case NODE_MAP_LITERAL: {
+        return is_pure_list(interp, node->map_literal.keys, locals) && is_pure_list(interp, node->map_literal.values, locals);
+    } break;
+    case NODE_CALL:                 return is_pure_call(interp, node, locals);
+
+    case NODE_SUBSCRIPT: {
+        return is_pure(interp, node->subscript.array, locals) && is_pure(interp, node->subscript.inner_expr, locals);
+    } break;
+
+    case NODE_CONTROL_FLOW_IF:
+    case NODE_CONTROL_FLOW_LOOP: {
+        return is_pure(interp, node->cf.condition, locals) && is_pure(interp, node->cf.block, locals);
+    } break;
+
+    case NODE_BINARY: {
+        if (node->binary.op > Token_ASSIGNMENTS_START && node->binary.op < Token_ASSIGNMENTS_END) {
+            AstNode *target = node->binary.left;
+            if (target->tag != NODE_IDENTIFIER || !has_name(*locals, target->identifier)) return false;
+            return is_pure(interp, node->binary.right, locals);
+        }
+        return is_pure(interp, node->binary.left, locals) && is_pure(interp, node->binary.right, locals);
+    } break;
+    }
+
+    return false;
+}
+
+// Sets LAMBDA_PURE on every top-level function which is pure.
+// Every function starts off assumed pure, and ones which aren't are knocked out until nothing changes,
+// so (mutually) recursive functions can still be pure.
+static void analyse_purity(Interp *interp, Ast ast) {
+    for (u64 i = 0; i < ast.length; i++) {
+        AstNode *node = ast.data[i];
+        if (!node) break;
+        if (node->tag != NODE_LAMBDA) continue;
+        node->lambda.flags |= LAMBDA_PURE;
+    }
+
+    Names locals;
+    array_init(locals, char *);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (u64 i = 0; i < ast.length; i++) {
+            AstNode *node = ast.data[i];
+            if (!node) break;
+            if (node->tag != NODE_LAMBDA || !(node->lambda.flags & LAMBDA_PURE)) continue;
+
+            Ast params = node->lambda.args->expression_list.expressions;
+            locals.length = 0;
+            for (u64 j = 0; j < params.length; j++) {
+                array_add(locals, params.data[j]->let.name);
+            }
+
+            if (!is_pure_block(interp, node->lambda.block, &locals)) {
+                node->lambda.flags &= ~LAMBDA_PURE;
+                changed = true;
+            }
+        }
+    }
+
+    array_free(locals);
+}
+
+// Gives every pure function which takes few enough arguments a memo table.
+static void add_memo_tables(Interp *interp, Ast ast) {
+    for (u64 i = 0; i < ast.length; i++) {
+        AstNode *node = ast.data[i];
+        if (!node) break;
+        if (node->tag != NODE_LAMBDA || !(node->lambda.flags & LAMBDA_PURE)) continue;
+
+        u64 num_args = node->lambda.args->expression_list.expressions.length;
+        if (num_args > MEMO_MAX_ARGS) continue;
+
+        MemoTable table = (MemoTable){0};
+        table.num_args = num_args;
+        node->lambda.memo_table = interp->memo_tables.length;
+        array_add(interp->memo_tables, table);
+    }
+}
+
+//
+// Dead code.
+// Functions which can't be reached from the top-level statements aren't compiled, and stores to variables which
+// are never read afterwards are dropped (see `find_dead_stores`). compile_block skips anything after a return,
+// break or continue.
+//
+
+// Collects every identifier `node` refers to, including the names of called functions.
+static void collect_names(AstNode *node, Names *names) {
+    if (!node) return;
+
+    switch (node->tag) {
+    case NODE_IDENTIFIER: {
+        array_add(*names, node->identifier);
+    } break;
+
+    case NODE_BLOCK: {
+        Ast statements = node->block.statements;
+        for (u64 i = 0; i < statements.length; i++) collect_names(statements.data[i], names);
+    } break;
+
+    case NODE_EXPRESSION_LIST: {
+        Ast expressions = node->expression_list.expressions;
+        for (u64 i = 0; i < expressions.length; i++) collect_names(expressions.data[i], names);
+    } break;
+
+    case NODE_LET:                 collect_names(node->let.expr, names); break;
+    case NODE_RETURN:              collect_names(node->ret.value, names); break;
+    case NODE_ENCLOSED_EXPRESSION: collect_names(node->enclosed_expr.inner, names); break;
+    case NODE_UNARY:               collect_names(node->unary.operand, names); break;
+    case NODE_ARRAY_LITERAL:       collect_names(node->array_literal, names); break;
+    case NODE_LAMBDA:              collect_names(node->lambda.block, names); break;
+
+    case NODE_MAP_LITERAL: {
+        for (u64 i = 0; i < node->map_literal.keys.length; i++) {
+            collect_names(node->map_literal.keys.data[i], names);
+            collect_names(node->map_literal.values.data[i], names);
+        }
+    } break;
+
+    case NODE_CALL: {
+        collect_names(node->call.name, names);
+        collect_names(node->call.args, names);
+    } break;
+
+    case NODE_BINARY: {
+        collect_names(node->binary.left, names);
+        collect_names(node->binary.right, names);
+    } break;
+
+    case NODE_SUBSCRIPT: {
+        collect_names(node->subscript.array, names);
+        collect_names(node->subscript.inner_expr, names);
+    } break;
+
+    case NODE_CONTROL_FLOW_IF:
+    case NODE_CONTROL_FLOW_LOOP: {
+        collect_names(node->cf.condition, names);
+        collect_names(node->cf.block, names);
+    } break;
+    }
+}
+
+// Sets LAMBDA_REACHABLE on every top-level function which the top-level statements can end up calling.
+static void mark_reachable_functions(Ast ast) {
+    Names names;
+    array_init(names, char *);
+
+    for (u64 i = 0; i < ast.length; i++) {
+        AstNode *node = ast.data[i];
+        if (!node) break;
+        if (node->tag != NODE_LAMBDA) collect_names(node, &names);
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (u64 i = 0; i < ast.length; i++) {
+            AstNode *node = ast.data[i];
+            if (!node) break;
+            if (node->tag != NODE_LAMBDA || (node->lambda.flags & LAMBDA_REACHABLE)) continue;
+            if (!has_name(names, node->lambda.name)) continue;
+
+            node->lambda.flags |= LAMBDA_REACHABLE;
+            collect_names(node->lambda.block, &names);
+            changed = true;
+        }
+    }
+
+    array_free(names);
+}
+
+// Backwards liveness of variables, per declaration.
+typedef struct Liveness {
+    Interp    *interp;
+    BlockStack blocks;
+    Ast        live;      // declarations whose current value may still be read
+    Ast        at_exit;   // live at the exit of the innermost loop, for `break`
+    Ast        at_head;   // live at the condition of the innermost loop, for `continue`
+    Names      escaping;  // names used inside functions, top-level variables with these names are never dead
+    bool       mark;      // record dead stores, only set once loops have settled
+} Liveness;
+
+static bool decl_in(Ast set, AstNode *decl) {
+    for (u64 i = 0; i < set.length; i++) {
+        if (set.data[i] == decl) return true;
+    }
+    return false;
+}
+
+static void decl_add(Ast *set, AstNode *decl) {
+    if (decl && !decl_in(*set, decl)) array_add(*set, decl);
+}
+
+static void decl_remove(Ast *set, AstNode *decl) {
+    for (u64 i = 0; i < set->length; i++) {
+        if (set->data[i] == decl) {
+            set->data[i] = set->data[--set->length];
+            return;
+        }
+    }
+}
+
+static void decl_copy(Ast *to, Ast from) {
+    to->length = 0;
+    for (u64 i = 0; i < from.length; i++) array_add(*to, from.data[i]);
+}
+
+static bool decl_same(Ast a, Ast b) {
+    if (a.length != b.length) return false;
+    for (u64 i = 0; i < a.length; i++) {
+        if (!decl_in(b, a.data[i])) return false;
+    }
+    return true;
+}
+
+static void add_reads(Liveness *lv, AstNode *expr) {
+    Names names;
+    array_init(names, char *);
+    collect_names(expr, &names);
+    for (u64 i = 0; i < names.length; i++) {
+        decl_add(&lv->live, find_decl(current_block(lv->blocks), lv->interp->program, names.data[i]));
+    }
+    array_free(names);
+}
+
+// Whether evaluating `expr` can be skipped without changing what the program does. Only expressions which can't
+// fail qualify: arithmetic, subscripts and calls (even to pure functions) can all raise a runtime error.
+static bool is_removable(AstNode *expr) {
+    if (!expr) return true;
+
+    switch (expr->tag) {
+    case NODE_INT_LITERAL:
+    case NODE_FLOAT_LITERAL:
+    case NODE_STRING_LITERAL:
+    case NODE_NULL_LITERAL:
+    case NODE_BOOLEAN_LITERAL:
+    case NODE_IDENTIFIER: {
+        return true;
+    } break;
+
+    case NODE_ENCLOSED_EXPRESSION: return is_removable(expr->enclosed_expr.inner);
+    case NODE_ARRAY_LITERAL:       return is_removable(expr->array_literal);
+
+    // Negative numbers.
+    case NODE_UNARY: {
+        NodeTag operand = expr->unary.operand->tag;
+        return (operand == NODE_INT_LITERAL || operand == NODE_FLOAT_LITERAL);
+    } break;
+
+    case NODE_EXPRESSION_LIST: {
+        Ast expressions = expr->expression_list.expressions;
+        for (u64 i = 0; i < expressions.length; i++) {
+            if (!is_removable(expressions.data[i])) return false;
+        }
+        return true;
+    } break;
+
+    // Keys of any other type are a runtime error.
+    case NODE_MAP_LITERAL: {
+        for (u64 i = 0; i < expr->map_literal.keys.length; i++) {
+            NodeTag key = expr->map_literal.keys.data[i]->tag;
+            if (key != NODE_INT_LITERAL && key != NODE_STRING_LITERAL) return false;
+            if (!is_removable(expr->map_literal.values.data[i])) return false;
+        }
+        return true;
+    } break;
+    }
+
+    return false;
+}
+
+static bool is_dead_store(AstNode *stmt) {
+    for (u64 i = dead_stores.length; i > 0; i--) {
+        if (dead_stores.data[i-1] == stmt) return true;
+    }
+    return false;
+}
+
+// Handles a store of `value` to `decl`. Returns false if the store is dead.
+static bool live_store(Liveness *lv, AstNode *stmt, AstNode *decl, AstNode *value) {
+    bool global = (current_block(lv->blocks) == NULL || find_decl_in_program(lv->interp->program, decl->let.name) == decl);
+    bool escapes = (global && has_name(lv->escaping, decl->let.name));
+
+    if (!decl_in(lv->live, decl) && !escapes && is_removable(value)) {
+        if (lv->mark && !is_dead_store(stmt)) array_add(dead_stores, stmt);
+        return false;
+    }
+    return true;
+}
+
+static void live_block(Liveness *lv, AstNode *block);
+
+// Updates lv->live from what's live after `stmt` to what's live before it.
+static void live_statement(Liveness *lv, AstNode *stmt) {
+    switch (stmt->tag) {
+    case NODE_LET: {
+        bool live = live_store(lv, stmt, stmt, stmt->let.expr);
+        decl_remove(&lv->live, stmt);
+        if (live) add_reads(lv, stmt->let.expr);
+    } break;
+
+    case NODE_BINARY: {
+        if (!(stmt->binary.op > Token_ASSIGNMENTS_START && stmt->binary.op < Token_ASSIGNMENTS_END)) break;
+
+        AstNode *target = stmt->binary.left;
+        AstNode *decl = NULL;
+        if (target->tag == NODE_IDENTIFIER) {
+            decl = find_decl(current_block(lv->blocks), lv->interp->program, target->identifier);
+        }
+        if (!decl) {
+            add_reads(lv, stmt);
+            break;
+        }
+
+        if (!live_store(lv, stmt, decl, stmt->binary.right)) break;
+        if (stmt->binary.op == Token_EQUAL) decl_remove(&lv->live, decl);
+        add_reads(lv, stmt);
+    } break;
+
+    case NODE_CALL: {
+        add_reads(lv, stmt);
+    } break;
+
+    case NODE_RETURN: {
+        lv->live.length = 0;
+        add_reads(lv, stmt->ret.value);
+    } break;
+
+    case NODE_BREAK_OR_CONTINUE: {
+        decl_copy(&lv->live, (stmt->break_cont.which == Token_CONTINUE ? lv->at_head : lv->at_exit));
+    } break;
+
+    case NODE_BLOCK: {
+        live_block(lv, stmt);
+    } break;
+
+    case NODE_CONTROL_FLOW_IF: {
+        Ast after;
+        array_init(after, AstNode *);
+        decl_copy(&after, lv->live);
+
+        live_block(lv, stmt->cf.block);
+        for (u64 i = 0; i < after.length; i++) decl_add(&lv->live, after.data[i]);
+        add_reads(lv, stmt->cf.condition);
+
+        array_free(after);
+    } break;
+
+    case NODE_CONTROL_FLOW_LOOP: {
+        Ast saved_exit = lv->at_exit, saved_head = lv->at_head;
+        bool saved_mark = lv->mark;
+
+        Ast exit, head;
+        array_init(exit, AstNode *);
+        array_init(head, AstNode *);
+        decl_copy(&exit, lv->live);
+        decl_copy(&head, exit);
+        lv->at_exit = exit;
+        lv->at_head = head;
+
+        // Go round until what's live at the condition stops changing, then once more to record the dead stores.
+        lv->mark = false;
+        while (true) {
+            decl_copy(&lv->live, head);
+            live_block(lv, stmt->cf.block);
+            for (u64 i = 0; i < exit.length; i++) decl_add(&lv->live, exit.data[i]);
+            add_reads(lv, stmt->cf.condition);
+
+            if (decl_same(lv->live, head)) break;
+            decl_copy(&head, lv->live);
+            lv->at_head = head;
+        }
+
+        lv->mark = saved_mark;
+        if (lv->mark) {
+            decl_copy(&lv->live, head);
+            live_block(lv, stmt->cf.block);
+            decl_copy(&lv->live, head);
+        }
+
+        lv->at_exit = saved_exit;
+        lv->at_head = saved_head;
+        array_free(exit);
+        array_free(head);
+    } break;
+    }
+}
+
+// Statements after a return, break or continue are never compiled.
+static u64 reachable_length(Ast statements) {
+    for (u64 i = 0; i < statements.length; i++) {
+        NodeTag tag = statements.data[i]->tag;
+        if (tag == NODE_RETURN || tag == NODE_BREAK_OR_CONTINUE) return i+1;
+    }
+    return statements.length;
+}
+
+static void live_block(Liveness *lv, AstNode *block) {
+    if (!block->block.statements.data) return;
+    push_block(&lv->blocks, block);
+
+    Ast statements = block->block.statements;
+    for (u64 i = reachable_length(statements); i > 0; i--) {
+        live_statement(lv, statements.data[i-1]);
+    }
+
+    pop_block(&lv->blocks);
+}
+
+// Finds the stores, in reachable functions and the top-level statements, to variables which are never read
+// before being written again, and whose value can be skipped. They're collected in `dead_stores`.
+static void find_dead_stores(Interp *interp, Ast ast) {
+    Liveness lv = (Liveness){0};
+    lv.interp = interp;
+    lv.mark = true;
+    init_blocks(&lv.blocks);
+    array_init(lv.live, AstNode *);
+    array_init(lv.escaping, char *);
+
+    for (u64 i = 0; i < ast.length; i++) {
+        AstNode *node = ast.data[i];
+        if (!node) break;
+        if (node->tag == NODE_LAMBDA) collect_names(node, &lv.escaping);
+    }
+
+    for (u64 i = 0; i < ast.length; i++) {
+        AstNode *node = ast.data[i];
+        if (!node) break;
+        if (node->tag != NODE_LAMBDA || !(node->lambda.flags & LAMBDA_REACHABLE)) continue;
+        lv.live.length = 0;
+        live_block(&lv, node->lambda.block);
+    }
+
+    u64 length = 0;
+    while (length < ast.length && ast.data[length]) length++;
+
+    lv.live.length = 0;
+    for (u64 i = length; i > 0; i--) {
+        AstNode *node = ast.data[i-1];
+        if (node->tag != NODE_LAMBDA) live_statement(&lv, node);
+    }
+
+    array_free(lv.live);
+    array_free(lv.escaping);
+}
+
+Interp compile(Ast ast, char *file_name, u32 flags, Region *region) {
     Interp interp = {0};
 
     interp.pc = 0;
     interp.file_name = file_name;
-    string_allocator_init(&interp.strings);
+    interp.flags = flags;
+    interp.region = region;
+    gc_init(&interp);
     array_init(interp.instructions, Instruction);
     interp.call_storage.top = 0;
     interp.call_stack.top = 0;
     interp.jump_stack.top = 0;
+    interp.memo_stack.top = 0;
+    array_init(interp.memo_tables, MemoTable);
 
-    StackFrame *root_scope = malloc(sizeof(StackFrame));
+    StackFrame *root_scope = region_alloc(region, sizeof(StackFrame));
 
-    root_scope->ast = ast;
+    interp.program = ast;
     root_scope->parent = NULL;
     array_init(root_scope->constant_pool, Object);
     add_primitive_objects(root_scope);
     root_scope->stack.top = 0;
+    root_scope->original = NULL;
+    root_scope->active = false;
 
     interp.scope = root_scope;
     interp.root_scope = root_scope;
 
     init_blocks(&block_stack);
     array_init(breaks_to_patch, u64);
+    array_init(hoisted, Hoisted);
+    array_init(dead_stores, AstNode *);
 
     for (u64 i = 0; i < ast.length; i++) {
         AstNode *node = ast.data[i];
         if (!node) break;
         if (node->tag != NODE_LAMBDA) continue;
-        compile_func(&interp, node);
+        node->lambda.constant_pool_index = reserve_constant(&interp);
     }
 
+    analyse_purity(&interp, ast);
+    if (flags & COMPILE_MEMOIZE_PURE) {
+        add_memo_tables(&interp, ast);
+    }
+
+    mark_reachable_functions(ast);
+    find_dead_stores(&interp, ast);
+
     for (u64 i = 0; i < ast.length; i++) {
         AstNode *node = ast.data[i];
         if (!node) break;
-        if (node->tag == NODE_LAMBDA) continue;
-        compile_statement(&interp, node);
+        if (node->tag != NODE_LAMBDA || !(node->lambda.flags & LAMBDA_REACHABLE)) continue;
+        // Anything the IR can't represent yet goes through the plain compiler.
+        if ((flags & COMPILE_OPTIMIZE) && compile_func_optimized(&interp, node)) continue;
+        compile_func(&interp, node);
+    }
+
+    if (!(flags & COMPILE_OPTIMIZE) || !compile_program_optimized(&interp, ast)) {
+        for (u64 i = 0; i < ast.length; i++) {
+            AstNode *node = ast.data[i];
+            if (!node) break;
+            if (node->tag == NODE_LAMBDA) continue;
+            compile_statement(&interp, node);
+        }
     }
 
     array_free(breaks_to_patch);
+    array_free(hoisted);
+    array_free(dead_stores);
 
     instr(&interp, HALT, 0, 0);
 
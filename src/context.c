@@ -1,5 +1,8 @@
 // Mostly utility functions for find declarations in scopes, error logging, and initialising the Context struct.
 #include "context.h"
+#include "jit.h"
+#include "gc.h"
+#include "output.h"
 
 #include <stdarg.h>
 #include <assert.h>
@@ -7,9 +10,9 @@
 #include <stdio.h>
 #include <string.h>
 
-AstNode *find_decl_in_frame(StackFrame *in, char *name) {
-    for (u64 i = 0; i < in->ast.length; i++) {
-        AstNode *node = in->ast.data[i];
+AstNode *find_decl_in_program(Ast program, char *name) {
+    for (u64 i = 0; i < program.length; i++) {
+        AstNode *node = program.data[i];
         if (node->tag != NODE_LET) continue;
         if (strcmp(name, node->let.name) == 0) {
             return node;
@@ -18,9 +21,9 @@ AstNode *find_decl_in_frame(StackFrame *in, char *name) {
     return NULL;
 }
 
-AstNode *find_decl(AstNode *block, StackFrame *root_scope, char *name) {
+AstNode *find_decl(AstNode *block, Ast program, char *name) {
     if (!block) {
-        return find_decl_in_frame(root_scope, name);
+        return find_decl_in_program(program, name);
     }
 
     assert(block->tag == NODE_BLOCK);
@@ -38,18 +41,209 @@ AstNode *find_decl(AstNode *block, StackFrame *root_scope, char *name) {
     }
 
     if (!scope.parent) {
-        return find_decl_in_frame(root_scope, name);
+        return find_decl_in_program(program, name);
     }
     
-    return find_decl(scope.parent, root_scope, name);
+    return find_decl(scope.parent, program, name);
+}
+
+// Frees the constant pools of a frame and the frames declared in it. The frames themselves are in the compiler's region.
+static void free_constant_pools(StackFrame *frame) {
+    for (u64 i = 0; i < frame->constant_pool.length; i++) {
+        Object o = frame->constant_pool.data[i];
+        if (o.tag == OBJECT_SCOPE && o.scope) free_constant_pools(o.scope);
+    }
+    array_free(frame->constant_pool);
 }
 
 void free_interpreter(Interp *interp) {
-    string_allocator_free(&interp->strings);
+    gc_free(interp);
+
+    for (u64 i = 0; i < interp->memo_tables.length; i++) {
+        free(interp->memo_tables.data[i].entries);
+    }
+    array_free(interp->memo_tables);
+
+    jit_free(interp);
+    output_free(interp->out);
+
+    // Copies of frames for recursive calls which were still running, if the program stopped with an error.
+    while (interp->call_stack.top > 0) frame_pop(interp);
+    if (interp->root_scope) free_constant_pools(interp->root_scope);
+    array_free(interp->instructions);
+}
+
+//
+// Arrays.
+// An array is stored unboxed while its elements are all integers or all floats, which is about a sixth of the
+// size. The first element of any other type widens it to an array of objects, and it stays that way.
+// Short arrays of numbers keep their elements inline, so `[]` and `[x, y]` are a single allocation.
+//
+ObjectArray *object_array_new(Heap *heap) {
+    ObjectArray *array = calloc(1, sizeof(ObjectArray));
+    array->kind = ARRAY_INTEGERS; // until the first element decides
+    array->elem_size = sizeof(s64);
+    array->integers = array->small.integers;
+    array->capacity = ARRAY_SMALL_LENGTH;
+    if (heap) gc_own(heap, &array->gc, GC_ARRAY, object_array_bytes(array));
+    return array;
+}
+
+static bool array_is_small(ObjectArray *array) {
+    return (array->integers == array->small.integers);
+}
+
+static ArrayKind array_kind_for(ObjectTag tag) {
+    switch (tag) {
+    case OBJECT_INTEGER:  return ARRAY_INTEGERS;
+    case OBJECT_FLOATING: return ARRAY_FLOATS;
+    default:              return ARRAY_OBJECTS;
+    }
+}
+
+// Grows the array to hold at least `needed` elements, doubling from ARRAY_MIN_CAPACITY.
+static void array_reserve(ObjectArray *array, u64 needed) {
+    if (needed <= array->capacity) return;
+    u64 capacity = (array->capacity ? array->capacity : ARRAY_MIN_CAPACITY);
+    while (capacity < needed) capacity *= 2;
+
+    if (array_is_small(array)) {
+        void *data = malloc(capacity * array->elem_size);
+        memcpy(data, array->small.integers, array->length * array->elem_size);
+        array->data = data;
+    } else {
+        array->data = realloc(array->data, capacity * array->elem_size);
+    }
+    array->capacity = capacity;
+}
+
+// Points an array which has just been made (or copied) at storage for `length` elements.
+static void array_init_storage(ObjectArray *array, u64 length) {
+    if (array->kind != ARRAY_OBJECTS && length <= ARRAY_SMALL_LENGTH) {
+        array->integers = array->small.integers;
+        array->capacity = ARRAY_SMALL_LENGTH;
+    } else {
+        array->data = NULL;
+        array->capacity = 0;
+        array_reserve(array, length);
+    }
+}
+
+// An array of `length` elements of the given kind, left for the caller to fill in.
+ObjectArray *object_array_of(Heap *heap, ArrayKind kind, u64 length) {
+    ObjectArray *array = calloc(1, sizeof(ObjectArray));
+    array->kind = kind;
+    array->elem_size = (kind == ARRAY_OBJECTS ? sizeof(Object) : sizeof(s64));
+    array_init_storage(array, length);
+    array->length = length;
+    if (heap) gc_own(heap, &array->gc, GC_ARRAY, object_array_bytes(array));
+    return array;
+}
+
+u64 object_array_bytes(ObjectArray *array) {
+    return sizeof(ObjectArray) + (array_is_small(array) ? 0 : array->capacity * array->elem_size);
+}
+
+// Frees the array, but not any arrays nested in it, which other objects may still refer to.
+void object_array_free(ObjectArray *array) {
+    if (!array_is_small(array)) free(array->data);
+    free(array);
+}
+
+// Changes the kind of an array, boxing its elements if it's becoming an array of objects.
+// The only other change is between integers and floats, made while the array is still empty.
+static void array_set_kind(ObjectArray *array, ArrayKind kind) {
+    if (kind != ARRAY_OBJECTS) {
+        array->kind = kind;
+        return;
+    }
+
+    u64 capacity = (array->length > ARRAY_MIN_CAPACITY ? array->length : ARRAY_MIN_CAPACITY);
+    Object *data = malloc(capacity * sizeof(Object));
+    for (u64 i = 0; i < array->length; i++) data[i] = object_array_get(array, i);
+    if (!array_is_small(array)) free(array->data);
+    array->data = data;
+    array->capacity = capacity;
+    array->elem_size = sizeof(Object);
+    array->kind = kind;
+}
+
+void object_array_add(ObjectArray *array, Object value) {
+    ArrayKind kind = array_kind_for(value.tag);
+    if (kind != array->kind && array->kind != ARRAY_OBJECTS) {
+        // An empty array takes the kind of its first element.
+        array_set_kind(array, (array->length == 0 ? kind : ARRAY_OBJECTS));
+    }
 
-    // MEMORY LEAK
-    // array_free(interp->constant_pool);
-    // array_free(interp->instructions);
+    array_reserve(array, array->length + 1);
+    switch (array->kind) {
+    case ARRAY_INTEGERS: array->integers[array->length++] = value.integer;  break;
+    case ARRAY_FLOATS:   array->floats[array->length++]   = value.floating; break;
+    case ARRAY_OBJECTS:  array->data[array->length++]     = value;          break;
+    }
+}
+
+Object object_array_get(ObjectArray *array, u64 index) {
+    switch (array->kind) {
+    case ARRAY_INTEGERS: return (Object){.integer = array->integers[index], .tag = OBJECT_INTEGER};
+    case ARRAY_FLOATS:   return (Object){.floating = array->floats[index], .tag = OBJECT_FLOATING};
+    default:             return array->data[index];
+    }
+}
+
+// Copies the elements, and any arrays nested in them.
+ObjectArray *object_array_copy(Heap *heap, ObjectArray *array) {
+    ObjectArray *copy = calloc(1, sizeof(ObjectArray));
+    *copy = *array;
+    copy->gc = (GcHeader){0};
+    array_init_storage(copy, array->length);
+    if (array->length) memcpy(copy->data, array->data, array->length * array->elem_size);
+
+    if (copy->kind == ARRAY_OBJECTS) {
+        for (u64 i = 0; i < copy->length; i++) {
+            if (copy->data[i].tag == OBJECT_ARRAY) copy->data[i].array = object_array_copy(heap, copy->data[i].array);
+        }
+    }
+    if (heap) gc_own(heap, &copy->gc, GC_ARRAY, object_array_bytes(copy));
+    return copy;
+}
+
+//
+// Strings.
+//
+// Short strings are copied into the object, longer ones point at `data`.
+Object object_string(char *data, u64 length) {
+    Object o = (Object){.string = {.length = length}, .tag = OBJECT_STRING};
+    if (length <= STRING_INLINE_LENGTH) {
+        if (length) memcpy(o.string.chars, data, length);
+    } else {
+        o.string.data = data;
+    }
+    return o;
+}
+
+char *object_string_data(Object *string) {
+    return (string->string.length <= STRING_INLINE_LENGTH ? string->string.chars : string->string.data);
+}
+
+// FNV-1a, cached in the object so that copies made after the first call don't hash again.
+u32 object_string_hash(Object *string) {
+    if (string->string.hash) return string->string.hash;
+    u64 h = 14695981039346656037u;
+    char *data = object_string_data(string);
+    for (u64 i = 0; i < string->string.length; i++) {
+        h ^= (u8)data[i];
+        h *= 1099511628211u;
+    }
+    u32 folded = (u32)(h ^ (h >> 32));
+    string->string.hash = (folded ? folded : 1);
+    return string->string.hash;
+}
+
+bool object_string_equals(Object a, Object b) {
+    if (a.string.length != b.string.length) return false;
+    if (a.string.hash && b.string.hash && a.string.hash != b.string.hash) return false;
+    return (memcmp(object_string_data(&a), object_string_data(&b), a.string.length) == 0);
 }
 
 //
@@ -75,9 +269,43 @@ void frame_push(Interp *s, StackFrame *frame) {
     assert(s->call_stack.top <= CONTEXT_STACK_SIZE);
 }
 
+// Pushes the frame of a function which is being called.
+// If the function is already running, the call gets its own copy of the frame so it doesn't clobber the caller's slots.
+void frame_enter(Interp *s, StackFrame *frame) {
+    if (!frame->active) {
+        frame->active = true;
+        frame_push(s, frame);
+        return;
+    }
+
+    StackFrame *copy = malloc(sizeof(StackFrame));
+    copy->parent = frame->parent;
+    copy->original = frame;
+    copy->active = true;
+    copy->stack.top = 0;
+
+    copy->constant_pool = frame->constant_pool;
+    copy->constant_pool.data = malloc(frame->constant_pool.capacity*frame->constant_pool.elem_size);
+    memcpy(copy->constant_pool.data, frame->constant_pool.data, frame->constant_pool.length*frame->constant_pool.elem_size);
+
+    frame_push(s, copy);
+}
+
+// Pops the current frame, freeing it if it was a copy made by `frame_enter`.
+// Returns the function's frame.
 StackFrame *frame_pop(Interp *s) {
     StackFrame *f = s->call_stack.data[s->call_stack.top];
     s->call_stack.data[s->call_stack.top--] = s->root_scope;
+
+    if (f->original) {
+        StackFrame *original = f->original;
+        array_free(f->constant_pool);
+        free(f);
+        return original;
+    }
+
+    f->active = false;
+    return f;
 }
 
 StackFrame *frame_top(Interp *s) {
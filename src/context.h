@@ -17,6 +17,34 @@
 
 #define PRINT_INSTRUCTIONS_DURING_COMPILE 0
 
+// How many times a quickened instruction may fall back to its generic form before
+// the interpreter stops specialising it.
+#define QUICKEN_MAX_DEOPTS 4
+
+// Functions whose body is a single `return` of at most this many AST nodes are inlined at their call sites.
+#define INLINE_NODE_THRESHOLD 16
+
+// Results of pure functions are cached per function in a direct-mapped table of this many entries (a power of two).
+// Only functions taking at most MEMO_MAX_ARGS arguments are memoised.
+#define MEMO_TABLE_SIZE 256
+#define MEMO_MAX_ARGS   4
+
+// With -jit, functions called and loops jumped back to this many times are compiled to native code.
+#define JIT_HOT_THRESHOLD 64
+// Loops whose iteration runs more instructions than this aren't traced, see jit_record().
+#define JIT_MAX_TRACE_LENGTH 512
+
+// With -tier, functions called (or looping) this many times are recompiled through the IR, see tier.c.
+#define TIER_UP_THRESHOLD 256
+
+// The collector runs once the heap has grown to GC_GROWTH_FACTOR times what was reachable after the last collection,
+// but not before it reaches GC_MIN_HEAP bytes.
+#define GC_MIN_HEAP      (1 << 20)
+#define GC_GROWTH_FACTOR 2
+
+// Map literals with more keys than this are built in parts, so their keys and values don't overflow the stack.
+#define MAP_LITERAL_MAX_PAIRS 32
+
 char *read_file(const char *path);
 
 typedef struct StackFrame StackFrame;
@@ -32,20 +60,87 @@ typedef enum ObjectTag {
     OBJECT_SCOPE,
     OBJECT_LAMBDA,
     OBJECT_ARRAY,
+    OBJECT_MAP,
 } ObjectTag;
 
+// Strings carry their length so nothing needs to call strlen, and strings made by concatenation
+// aren't necessarily nul-terminated. Strings of up to STRING_INLINE_LENGTH bytes (and only those) are kept
+// in the object itself, use object_string_data to find the characters of any string.
+#define STRING_INLINE_LENGTH 15
+
+// Arrays, maps and long strings made while the program runs belong to the collector, and start with one of these.
+// See gc.c.
+typedef enum GcType {
+    GC_ARRAY,
+    GC_STRING,
+    GC_MAP,
+} GcType;
+
+typedef struct GcHeader {
+    struct GcHeader *next;  // the next thing the collector owns
+    u32    mark;            // the last collection which found it reachable
+    GcType type;
+} GcHeader;
+
 typedef struct ObjectString {
-    char *data;
-    u64 length;
+    union {
+        char chars[STRING_INLINE_LENGTH + 1];
+        struct {
+            char *data;
+            bool built;   // `data` is the contents of a StringBuilder, otherwise it's a constant
+        };
+    };
+    u32 length;   // which limits strings to 4GB, but keeps an object at 32 bytes
+    u32 hash;     // 0 until object_string_hash is first asked for it
 } ObjectString;
 
+// Long strings made by concatenation are kept in a StringBuilder. Those of at least STRING_BUILDER_MIN_LENGTH
+// get room to grow, see runtime_string_concat.
+#define STRING_BUILDER_MIN_LENGTH 256
+
+typedef struct StringBuilder {
+    GcHeader gc;
+    u64 used;     // the length of the longest string built so far
+    u64 capacity;
+    char data[];
+} StringBuilder;
+
+// Arrays live on the heap and objects point to them, so every copy of an object refers to the same array.
+// Arrays of only integers or only floats store the values unboxed, see object_array_add.
+typedef enum ArrayKind {
+    ARRAY_INTEGERS,
+    ARRAY_FLOATS,
+    ARRAY_OBJECTS,
+} ArrayKind;
+
+// Up to this many integers or floats are kept inside the array itself rather than in a separate allocation.
+#define ARRAY_SMALL_LENGTH 4
+
+typedef struct ObjectArray {
+    GcHeader gc;              // zero for arrays made by the compiler, which the collector doesn't own
+    union {
+        struct Object *data;  // ARRAY_OBJECTS
+        s64 *integers;        // ARRAY_INTEGERS
+        f64 *floats;          // ARRAY_FLOATS
+    };
+    u64 elem_size;
+    u64 length;
+    u64 capacity;
+    ArrayKind kind;
+    union {
+        s64 integers[ARRAY_SMALL_LENGTH];
+        f64 floats[ARRAY_SMALL_LENGTH];
+    } small;                  // `data` points here while the array fits
+} ObjectArray;
+
 typedef struct Object {
     union {
         s64 integer;
         f64 floating;
         u8  boolean;
         ObjectString string;
-        Array(struct Object) array;
+        ObjectArray *array;
+        struct ObjectMap *map;  // see map.h
         StackFrame *scope;
         void *pointer;
     };
@@ -70,6 +165,7 @@ typedef struct BlockStack {
 
 typedef enum Op {
     CONST,
+    NOP,
 
     LOAD,
     LOAD_PC,
@@ -80,6 +176,9 @@ typedef enum Op {
     STORE_ARG_OR_RETVAL,
 
     CALL_FUNC,
+    TAIL_CALL,
+    MEMO_LOOKUP,
+    MEMO_STORE,
     POP_SCOPE_RETURN,
     
     POP_SCOPE,
@@ -93,7 +192,18 @@ typedef enum Op {
 
     PRINT,
     APPEND,
+    APPEND_IN_PLACE, // x = append(x, v), without pushing the result
     LEN,
+    SUM,             // the numeric array builtins, see runtime_array_builtin
+    MIN,
+    MAX,
+    DOT,
+    SCALE,
+    FILL,
+    MAP_GET,         // the map builtins, see runtime_map_builtin
+    MAP_SET,
+    MAP_HAS,
+    MAP_DELETE,
 
     EQUALS,
     LESS_THAN_EQUALS,
@@ -108,11 +218,24 @@ typedef enum Op {
     NEG,
 
     ARRAY_SUBSCRIPT,
+    NEW_ARRAY,       // pushes a copy of the array literal in the constant
+    NEW_MAP,         // pushes a map of the `arg` keys and values on the argument stack, see runtime_new_map
+
+    // Quickened forms of the generic instructions above.
+    // The interpreter rewrites the generic forms into these in place. The IR lowering also emits them directly
+    // when it knows the operand types, they fall back to the generic form if it turns out to be wrong.
+    ADD_INT,
+    ADD_FLOAT,
+    LESS_THAN_INT,
+    LESS_THAN_FLOAT,
+    EQUALS_INT,
+    EQUALS_FLOAT,
     
     HALT,
 } Op;
-static const char *instruction_strings[30] = {
+static const char *instruction_strings[53] = {
     "CONST",
+    "NOP",
     "LOAD",
     "LOAD_PC",
     "LOAD_ARG",
@@ -120,6 +243,9 @@ static const char *instruction_strings[30] = {
     "STORE",
     "STORE_ARG_OR_RETVAL",
     "CALL_FUNC",
+    "TAIL_CALL",
+    "MEMO_LOOKUP",
+    "MEMO_STORE",
     "POP_SCOPE_RETURN",
     "POP_SCOPE",
     "JUMP",
@@ -129,7 +255,18 @@ static const char *instruction_strings[30] = {
     "END_BLOCK",
     "PRINT",
     "APPEND",
+    "APPEND_IN_PLACE",
     "LEN",
+    "SUM",
+    "MIN",
+    "MAX",
+    "DOT",
+    "SCALE",
+    "FILL",
+    "MAP_GET",
+    "MAP_SET",
+    "MAP_HAS",
+    "MAP_DELETE",
     "EQUALS",
     "LESS_THAN_EQUALS",
     "GREATER_THAN_EQUALS",
@@ -141,6 +278,14 @@ static const char *instruction_strings[30] = {
     "DIV",
     "NEG",
     "ARRAY_SUBSCRIPT",
+    "NEW_ARRAY",
+    "NEW_MAP",
+    "ADD_INT",
+    "ADD_FLOAT",
+    "LESS_THAN_INT",
+    "LESS_THAN_FLOAT",
+    "EQUALS_INT",
+    "EQUALS_FLOAT",
     "HALT",
 };
 
@@ -153,6 +298,42 @@ typedef struct Instruction {
 typedef Array(Object) Constants;
 typedef Array(Instruction) Instructions;
 
+typedef struct MemoEntry {
+    u64    hash;
+    Object args[MEMO_MAX_ARGS];
+    Object result;
+    bool   used;
+} MemoEntry;
+
+typedef struct MemoTable {
+    MemoEntry *entries; // MEMO_TABLE_SIZE of them, allocated on first lookup
+    u32 num_args;
+    u64 hits;
+    u64 misses;
+} MemoTable;
+
+typedef Array(MemoTable) MemoTables;
+
+// The key of a memoised call which is in progress, stored by MEMO_STORE once the call returns.
+typedef struct MemoKey {
+    u64    hash;
+    Object args[MEMO_MAX_ARGS];
+    bool   cacheable;
+} MemoKey;
+
+typedef struct MemoStack {
+    MemoKey data[CONTEXT_STACK_SIZE];
+    u64 top;
+} MemoStack;
+
+enum {
+    COMPILE_MEMOIZE_PURE = 1 << 0,
+    COMPILE_OPTIMIZE     = 1 << 1, // compile through the SSA IR in ir.c
+    COMPILE_DUMP_IR      = 1 << 2,
+    COMPILE_JIT          = 1 << 3, // run hot code natively, see jit.c
+    COMPILE_TIERED       = 1 << 4, // recompile hot functions through the IR while running, see tier.c
+};
+
 typedef struct Interp {
     Instructions instructions;
     u64 pc;
@@ -164,33 +345,65 @@ typedef struct Interp {
     StackFrame *root_scope;
     StackFrame *scope;
 
-    StringAllocator strings;
+    MemoTables memo_tables;
+    MemoStack  memo_stack;
+
+    struct Output *out; // where `print` writes, see output.c
+    struct Heap *heap; // arrays and strings, both constants and those made while running, see gc.c
+    Region *region;    // the compiler's frames and string constants, NULL in programs compiled with -emit-c
+
+    // The top-level statements, for the compiler and for tiering up. Nothing else refers to the AST, so once it's
+    // compiled (and unless it's tiering) the front end's memory can go, see main.c.
+    Ast program;
+    struct Jit *jit;   // NULL unless running with -jit
+    struct Tier *tier; // NULL unless running with -tier
 
     Op    last_op;
     u64   error_count;
     char *file_name;
+    u32   flags;
 } Interp;
 
 struct StackFrame {
     Constants    constant_pool;
-    Ast          ast;
     Stack        stack;
 
     struct StackFrame *parent;
+
+    // A function's frame is shared by every call to it. When it's entered again while already
+    // on the call stack (recursion), the new activation gets a copy which points back at the original.
+    struct StackFrame *original;
+    bool active;
 };
 
-AstNode *find_decl_in_frame(StackFrame *in, char *name);
-AstNode *find_decl(AstNode *block, StackFrame *root_scope, char *name);
+AstNode *find_decl_in_program(Ast program, char *name);
+AstNode *find_decl(AstNode *block, Ast program, char *name);
 
-Interp compile(Ast ast, char *file_name);
+Interp compile(Ast ast, char *file_name, u32 flags, Region *region);
 void run_interpreter(Interp *interp);
+bool emit_c(Interp *interp, const char *path); // writes the compiled program out as C, see emit_c.c
 void free_interpreter(Interp *interp);
 
 void   stack_push(Stack *, Object);
 Object stack_pop(Stack *);
 Object stack_top(Stack);
 
+// Arrays made with a heap belong to its collector, those made with NULL are never freed.
+ObjectArray *object_array_new(struct Heap *heap);
+ObjectArray *object_array_copy(struct Heap *heap, ObjectArray *array);
+ObjectArray *object_array_of(struct Heap *heap, ArrayKind kind, u64 length);
+u64    object_array_bytes(ObjectArray *array);
+void   object_array_free(ObjectArray *array);
+
+Object object_string(char *data, u64 length);
+char  *object_string_data(Object *string);
+u32    object_string_hash(Object *string);
+bool   object_string_equals(Object a, Object b);
+void   object_array_add(ObjectArray *array, Object value);
+Object object_array_get(ObjectArray *array, u64 index);
+
 void frame_push(Interp *s, StackFrame *frame);
+void frame_enter(Interp *s, StackFrame *frame);
 StackFrame *frame_pop(Interp *s);
 StackFrame *frame_top(Interp *s);
 
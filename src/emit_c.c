@@ -0,0 +1,387 @@
+// Ahead-of-time compilation: writes compiled bytecode out as a C program which runs it without the interpreter.
+// Every instruction becomes a statement under its own label, jumps and calls become gotos, and the
+// operations themselves call into runtime.c, so the result behaves exactly like the interpreter.
+#include "context.h"
+#include "common.h"
+#include "array.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+
+typedef Array(StackFrame *) Frames;
+
+static u64 frame_index(Frames *frames, StackFrame *frame) {
+    for (u64 i = 0; i < frames->length; i++) {
+        if (frames->data[i] == frame) return i;
+    }
+    return frames->length;
+}
+
+// Frames are reachable from the root through the scope objects in their parents' pools.
+static void collect_frames(Frames *frames, StackFrame *frame) {
+    if (frame_index(frames, frame) < frames->length) return;
+    array_add(*frames, frame);
+    for (u64 i = 0; i < frame->constant_pool.length; i++) {
+        Object o = frame->constant_pool.data[i];
+        if (o.tag == OBJECT_SCOPE && o.scope) collect_frames(frames, o.scope);
+    }
+}
+
+static void emit_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (const u8 *c = (const u8 *)s; *c; c++) {
+        if (*c == '"' || *c == '\\') fprintf(out, "\\%c", *c);
+        else if (*c < 32 || *c >= 127) fprintf(out, "\\%03o", *c);
+        else fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+static void emit_object(FILE *out, Object o, const char *name);
+
+// Arrays are written as a static array of their elements, which `runtime_frame` copies to the heap.
+static void emit_array(FILE *out, Object o, const char *name) {
+    static const char *item_types[] = {"s64", "f64", "Object"};
+    static const char *fields[]     = {"integers", "floats", "data"};
+
+    char inner[128];
+    ObjectArray *array = o.array;
+    if (array->kind == ARRAY_OBJECTS) {
+        for (u64 i = 0; i < array->length; i++) {
+            if (array->data[i].tag != OBJECT_ARRAY) continue;
+            snprintf(inner, sizeof(inner), "%s_%ld", name, i);
+            emit_array(out, array->data[i], inner);
+        }
+    }
+
+    if (array->length == 0) {
+        fprintf(out, "static ObjectArray %s = {.elem_size = %ld, .kind = %d};\n", name, array->elem_size, array->kind);
+        return;
+    }
+
+    fprintf(out, "static %s %s_items[] = {\n", item_types[array->kind], name);
+    for (u64 i = 0; i < array->length; i++) {
+        fprintf(out, "    ");
+        switch (array->kind) {
+        case ARRAY_INTEGERS: {
+            if (array->integers[i] == INT64_MIN) fprintf(out, "INT64_MIN");
+            else fprintf(out, "%ldll", array->integers[i]);
+        } break;
+        case ARRAY_FLOATS: {
+            fprintf(out, "%a", array->floats[i]);
+        } break;
+        case ARRAY_OBJECTS: {
+            snprintf(inner, sizeof(inner), "%s_%ld", name, i);
+            emit_object(out, array->data[i], inner);
+        } break;
+        }
+        fprintf(out, ",\n");
+    }
+    fprintf(out, "};\n");
+    fprintf(out, "static ObjectArray %s = {.%s = %s_items, .elem_size = %ld, .length = %ld, .capacity = %ld, .kind = %d};\n",
+            name, fields[array->kind], name, array->elem_size, array->length, array->length, array->kind);
+}
+
+static void emit_object(FILE *out, Object o, const char *name) {
+    fprintf(out, "{.tag = %d, .non_mutable = %d", o.tag, o.non_mutable);
+    switch (o.tag) {
+    case OBJECT_FLOATING: fprintf(out, ", .floating = %a", o.floating); break;
+    case OBJECT_STRING: {
+        bool short_string = (o.string.length <= STRING_INLINE_LENGTH);
+        fprintf(out, ", .string = {%s", (short_string ? ".chars = " : ".data = "));
+        emit_string(out, object_string_data(&o));
+        fprintf(out, ", .length = %u}", o.string.length);
+    } break;
+    case OBJECT_ARRAY: {
+        fprintf(out, ", .array = &%s", name);
+    } break;
+    // Filled in once the frames exist.
+    case OBJECT_SCOPE: break;
+    default: {
+        if (o.integer == INT64_MIN) fprintf(out, ", .integer = INT64_MIN");
+        else fprintf(out, ", .integer = %ldll", o.integer);
+    } break;
+    }
+    fprintf(out, "}");
+}
+
+static void emit_frames(FILE *out, Frames *frames) {
+    char name[128];
+    for (u64 f = 0; f < frames->length; f++) {
+        Constants pool = frames->data[f]->constant_pool;
+        for (u64 i = 0; i < pool.length; i++) {
+            if (pool.data[i].tag != OBJECT_ARRAY) continue;
+            snprintf(name, sizeof(name), "array_%ld_%ld", f, i);
+            emit_array(out, pool.data[i], name);
+        }
+
+        fprintf(out, "static Object pool_%ld[] = {\n", f);
+        for (u64 i = 0; i < pool.length; i++) {
+            snprintf(name, sizeof(name), "array_%ld_%ld", f, i);
+            fprintf(out, "    ");
+            emit_object(out, pool.data[i], name);
+            fprintf(out, ",\n");
+        }
+        fprintf(out, "};\n\n");
+    }
+
+    fprintf(out, "static void load_frames(Interp *interp) {\n");
+    fprintf(out, "    static StackFrame *frames[%ld];\n", frames->length);
+    for (u64 f = 0; f < frames->length; f++) {
+        fprintf(out, "    frames[%ld] = runtime_frame(interp, pool_%ld, %ld);\n", f, f, frames->data[f]->constant_pool.length);
+    }
+    for (u64 f = 0; f < frames->length; f++) {
+        Constants pool = frames->data[f]->constant_pool;
+        for (u64 i = 0; i < pool.length; i++) {
+            if (pool.data[i].tag != OBJECT_SCOPE) continue;
+            u64 child = frame_index(frames, pool.data[i].scope);
+            fprintf(out, "    frames[%ld]->constant_pool.data[%ld].scope = frames[%ld];\n", f, i, child);
+            fprintf(out, "    frames[%ld]->parent = frames[%ld];\n", child, f);
+        }
+    }
+    fprintf(out, "    interp->root_scope = frames[0];\n");
+    fprintf(out, "    interp->scope = frames[0];\n");
+    fprintf(out, "}\n\n");
+}
+
+// Returns the index of the BEGIN_BLOCK for `block`, or the number of instructions if there isn't one.
+static u64 find_begin_block(Interp *interp, s32 block) {
+    for (u64 i = 0; i < interp->instructions.length; i++) {
+        Instruction instr = interp->instructions.data[i];
+        if (instr.op == BEGIN_BLOCK && instr.arg == block) return i;
+    }
+    return interp->instructions.length;
+}
+
+static u64 find_end_block(Interp *interp, u64 from, s32 block) {
+    for (u64 i = from; i < interp->instructions.length; i++) {
+        Instruction instr = interp->instructions.data[i];
+        if (instr.op == END_BLOCK && instr.arg == block) return i;
+    }
+    return interp->instructions.length;
+}
+
+// Quickened instructions run their generic form, the runtime handles every type.
+static Op generic_op(Op op) {
+    switch (op) {
+    case ADD_INT:
+    case ADD_FLOAT:       return ADD;
+    case LESS_THAN_INT:
+    case LESS_THAN_FLOAT: return LESS_THAN;
+    case EQUALS_INT:
+    case EQUALS_FLOAT:    return EQUALS;
+    default:              return op;
+    }
+}
+
+static void emit_instruction(FILE *out, Interp *interp, u64 pc) {
+    Instruction instr = interp->instructions.data[pc];
+    Op  op  = generic_op(instr.op);
+    s32 arg = instr.arg;
+    u64 line = instr.line_number;
+
+    fprintf(out, "L%ld: ", pc);
+    switch (op) {
+    case NOP:
+    case END_BLOCK: {
+        fprintf(out, ";\n");
+    } break;
+
+    // The interpreter always misses the cache of a memoised function here, which is only slower.
+    case MEMO_LOOKUP:
+    case MEMO_STORE: {
+        fprintf(out, ";\n");
+    } break;
+
+    case LOAD: {
+        fprintf(out, "stack_push(&SCOPE->stack, SCOPE->constant_pool.data[%d]);\n", arg);
+    } break;
+
+    case LOAD_ARG: {
+        fprintf(out, "stack_push(&interp->call_storage, SCOPE->constant_pool.data[%d]);\n", arg);
+    } break;
+
+    case STORE: {
+        fprintf(out, "SCOPE->constant_pool.data[%d] = stack_pop(&SCOPE->stack);\n", arg);
+    } break;
+
+    case STORE_ARG_OR_RETVAL: {
+        fprintf(out, "SCOPE->constant_pool.data[%d] = stack_pop(&interp->call_storage);\n", arg);
+    } break;
+
+    case EQUALS:
+    case LESS_THAN:
+    case LESS_THAN_EQUALS:
+    case GREATER_THAN:
+    case GREATER_THAN_EQUALS:
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV: {
+        fprintf(out, "if (!runtime_binary(interp, INSTR(%d, %d, %ld), &SCOPE->stack)) return;\n", op, arg, line);
+    } break;
+
+    case NEG: {
+        fprintf(out, "if (!runtime_negate(interp, INSTR(%d, %d, %ld), &SCOPE->stack)) return;\n", op, arg, line);
+    } break;
+
+    case PRINT: {
+        fprintf(out, "runtime_print_arguments(interp, INSTR(%d, %d, %ld));\n", op, arg, line);
+    } break;
+
+    case APPEND: {
+        fprintf(out, "if (!runtime_append(interp, INSTR(%d, %d, %ld), SCOPE)) return;\n", op, arg, line);
+    } break;
+
+    case APPEND_IN_PLACE: {
+        fprintf(out, "if (!runtime_append_in_place(interp, INSTR(%d, %d, %ld), SCOPE)) return;\n", op, arg, line);
+    } break;
+
+    case LEN: {
+        fprintf(out, "if (!runtime_builtin_len(interp, INSTR(%d, %d, %ld), SCOPE)) return;\n", op, arg, line);
+    } break;
+
+    case SUM:
+    case MIN:
+    case MAX:
+    case DOT:
+    case SCALE:
+    case FILL: {
+        fprintf(out, "if (!runtime_array_builtin(interp, INSTR(%d, %d, %ld), SCOPE)) return;\n", op, arg, line);
+    } break;
+
+    case MAP_GET:
+    case MAP_SET:
+    case MAP_HAS:
+    case MAP_DELETE: {
+        fprintf(out, "if (!runtime_map_builtin(interp, INSTR(%d, %d, %ld), SCOPE)) return;\n", op, arg, line);
+    } break;
+
+    case ARRAY_SUBSCRIPT: {
+        fprintf(out, "if (!runtime_subscript(interp, INSTR(%d, %d, %ld), SCOPE)) return;\n", op, arg, line);
+    } break;
+
+    case NEW_ARRAY: {
+        fprintf(out, "runtime_new_array(interp, INSTR(%d, %d, %ld), SCOPE);\n", op, arg, line);
+    } break;
+
+    case NEW_MAP: {
+        fprintf(out, "if (!runtime_new_map(interp, INSTR(%d, %d, %ld), SCOPE)) return;\n", op, arg, line);
+    } break;
+
+    case BEGIN_BLOCK: {
+        u64 end = find_end_block(interp, pc, arg);
+        fprintf(out, "interp->root_scope->constant_pool.data[%d].integer = %ld; goto L%ld;\n", arg, pc+1, end+1);
+    } break;
+
+    case LOAD_SCOPE: {
+        fprintf(out, "frame_enter(interp, interp->root_scope->constant_pool.data[%d].scope);\n", arg);
+    } break;
+
+    case POP_SCOPE: {
+        fprintf(out, "frame_pop(interp);\n");
+    } break;
+
+    case POP_SCOPE_RETURN: {
+        fprintf(out, "return_to = stack_pop(&interp->jump_stack).integer; ");
+        fprintf(out, "stack_push(&interp->call_storage, SCOPE->constant_pool.data[%d]); ", arg);
+        fprintf(out, "frame_pop(interp); goto dispatch_return;\n");
+    } break;
+
+    case LOAD_PC: {
+        fprintf(out, "stack_push(&interp->jump_stack, (Object){.integer = %ld, .tag = OBJECT_INTEGER});\n", pc+1);
+    } break;
+
+    case CALL_FUNC:
+    case TAIL_CALL: {
+        u64 begin = find_begin_block(interp, arg);
+        if (op == TAIL_CALL) fprintf(out, "frame_pop(interp); ");
+        if (begin < interp->instructions.length) fprintf(out, "goto L%ld;\n", begin+1);
+        else fprintf(out, "abort();\n");
+    } break;
+
+    case JUMP: {
+        fprintf(out, "goto L%d;\n", arg+1);
+    } break;
+
+    case JUMP_TRUE: {
+        fprintf(out, "if (stack_pop(&SCOPE->stack).boolean == 1) goto L%d; goto L%ld;\n", arg+1, pc+2);
+    } break;
+
+    case JUMP_FALSE: {
+        fprintf(out, "if (stack_pop(&SCOPE->stack).boolean == 0) goto L%d; goto L%ld;\n", arg+1, pc+2);
+    } break;
+
+    case HALT: {
+        fprintf(out, "return;\n");
+    } break;
+
+    default: {
+        fprintf(out, "abort();\n");
+    } break;
+    }
+}
+
+bool emit_c(Interp *interp, const char *path) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        printf("Could not open '%s' for writing.\n", path);
+        return false;
+    }
+
+    fprintf(out, "// Generated by sap -emit-c from %s.\n", interp->file_name);
+    fprintf(out, "// Build with: gcc -std=c11 -O2 -I<sap>/src %s <sap>/libsap.a\n", path);
+    fprintf(out, "#include \"context.h\"\n");
+    fprintf(out, "#include \"runtime.h\"\n\n");
+    fprintf(out, "#include <stdio.h>\n");
+    fprintf(out, "#include <stdlib.h>\n\n");
+    fprintf(out, "#define SCOPE (interp->call_stack.data[interp->call_stack.top])\n");
+    fprintf(out, "#define INSTR(op, arg, line) ((Instruction){(op), (arg), (line)})\n\n");
+
+    Frames frames;
+    array_init(frames, StackFrame *);
+    collect_frames(&frames, interp->root_scope);
+    emit_frames(out, &frames);
+    array_free(frames);
+
+    u64 length = interp->instructions.length;
+    fprintf(out, "static void run(Interp *interp) {\n");
+    fprintf(out, "    u64 return_to = 0;\n");
+    fprintf(out, "    frame_push(interp, interp->root_scope);\n\n");
+    for (u64 pc = 0; pc < length; pc++) {
+        emit_instruction(out, interp, pc);
+    }
+    fprintf(out, "L%ld: L%ld: return;\n\n", length, length+1);
+
+    // Functions return to the instruction after the CALL_FUNC following their LOAD_PC.
+    fprintf(out, "dispatch_return:\n");
+    fprintf(out, "    switch (return_to) {\n");
+    for (u64 pc = 0; pc < length; pc++) {
+        if (interp->instructions.data[pc].op != LOAD_PC) continue;
+        fprintf(out, "    case %ld: goto L%ld;\n", pc+1, pc+2);
+    }
+    fprintf(out, "    }\n");
+    fprintf(out, "    abort();\n");
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "int main(void) {\n");
+    fprintf(out, "    static Interp interp;\n");
+    fprintf(out, "    runtime_init(&interp, ");
+    emit_string(out, interp->file_name);
+    fprintf(out, ");\n");
+    fprintf(out, "    load_frames(&interp);\n");
+    fprintf(out, "    run(&interp);\n");
+    fprintf(out, "    output_flush(interp.out);\n");
+    fprintf(out, "    if (interp.error_count > 0) {\n");
+    fprintf(out, "        printf(\"\\nThere were errors, exiting.\\n\");\n");
+    fprintf(out, "        return -1;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    return 0;\n");
+    fprintf(out, "}\n");
+
+    fclose(out);
+    return true;
+}
@@ -0,0 +1,179 @@
+#include "gc.h"
+#include "map.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+
+void gc_init(Interp *interp) {
+    Heap *heap = calloc(1, sizeof(Heap));
+    heap->threshold = GC_MIN_HEAP;
+    array_init(heap->grey, GcHeader *);
+    interp->heap = heap;
+}
+
+void gc_own(Heap *heap, GcHeader *header, GcType type, u64 bytes) {
+    header->type = type;
+    header->mark = heap->epoch;
+    header->next = heap->objects;
+    heap->objects = header;
+    heap->bytes += bytes;
+}
+
+// Room for `capacity` bytes of string, which the caller fills in.
+StringBuilder *gc_string_builder(Interp *interp, u64 capacity) {
+    StringBuilder *builder = malloc(sizeof(StringBuilder) + capacity);
+    builder->capacity = capacity;
+    builder->used = 0;
+    gc_own(interp->heap, &builder->gc, GC_STRING, sizeof(StringBuilder) + capacity);
+    return builder;
+}
+
+static u64 owned_bytes(GcHeader *header) {
+    if (header->type == GC_ARRAY) return object_array_bytes((ObjectArray *)header);
+    if (header->type == GC_MAP) return object_map_bytes((ObjectMap *)header);
+    return sizeof(StringBuilder) + ((StringBuilder *)header)->capacity;
+}
+
+static void release(GcHeader *header) {
+    if (header->type == GC_ARRAY) object_array_free((ObjectArray *)header);
+    else if (header->type == GC_MAP) object_map_free((ObjectMap *)header);
+    else free(header);
+}
+
+//
+// Marking.
+// Arrays and maps are pushed on the grey list when they're first marked and looked through afterwards, so deeply
+// nested ones don't recurse.
+//
+static void mark_object(Heap *heap, Object *o) {
+    if (o->tag == OBJECT_STRING) {
+        if (o->string.length > STRING_INLINE_LENGTH && o->string.built) {
+            StringBuilder *builder = (StringBuilder *)(o->string.data - offsetof(StringBuilder, data));
+            builder->gc.mark = heap->epoch;
+        }
+    } else if (o->tag == OBJECT_ARRAY) {
+        ObjectArray *array = o->array;
+        if (array->gc.mark == heap->epoch) return;
+        array->gc.mark = heap->epoch;
+        if (array->kind == ARRAY_OBJECTS) array_add(heap->grey, &array->gc);
+    } else if (o->tag == OBJECT_MAP) {
+        ObjectMap *map = o->map;
+        if (map->gc.mark == heap->epoch) return;
+        map->gc.mark = heap->epoch;
+        array_add(heap->grey, &map->gc);
+    }
+}
+
+static void mark_objects(Heap *heap, Object *objects, u64 count) {
+    for (u64 i = 0; i < count; i++) mark_object(heap, objects + i);
+}
+
+// Stacks are pushed to from index 1.
+static void mark_stack(Heap *heap, Stack *stack) {
+    mark_objects(heap, stack->data + 1, stack->top);
+}
+
+// Frames hold the frames of the functions declared in them, so this reaches every frame from the root's.
+static void mark_frame(Heap *heap, StackFrame *frame) {
+    for (u64 i = 0; i < frame->constant_pool.length; i++) {
+        Object *o = (frame->constant_pool.data + i);
+        if (o->tag == OBJECT_SCOPE && o->scope) mark_frame(heap, o->scope);
+        else mark_object(heap, o);
+    }
+    mark_stack(heap, &frame->stack);
+}
+
+static void mark_roots(Interp *interp) {
+    Heap *heap = interp->heap;
+    if (interp->root_scope) mark_frame(heap, interp->root_scope);
+
+    // Recursive calls run in copies of their function's frame, which are only on the call stack.
+    for (u64 i = 1; i <= interp->call_stack.top; i++) {
+        StackFrame *frame = interp->call_stack.data[i];
+        if (frame->original) mark_frame(heap, frame);
+    }
+
+    mark_stack(heap, &interp->call_storage);
+    mark_stack(heap, &interp->jump_stack);
+
+    for (u64 i = 0; i < interp->memo_tables.length; i++) {
+        MemoTable table = interp->memo_tables.data[i];
+        if (!table.entries) continue;
+        for (u64 j = 0; j < MEMO_TABLE_SIZE; j++) {
+            MemoEntry *entry = (table.entries + j);
+            if (!entry->used) continue;
+            mark_objects(heap, entry->args, MEMO_MAX_ARGS);
+            mark_object(heap, &entry->result);
+        }
+    }
+    for (u64 i = 1; i <= interp->memo_stack.top; i++) {
+        mark_objects(heap, interp->memo_stack.data[i].args, MEMO_MAX_ARGS);
+    }
+}
+
+static void mark_grey(Heap *heap) {
+    while (heap->grey.length > 0) {
+        GcHeader *header = heap->grey.data[--heap->grey.length];
+        if (header->type == GC_MAP) {
+            ObjectMap *map = (ObjectMap *)header;
+            for (u64 i = 0; i < map->num_entries; i++) {
+                mark_object(heap, &map->entries[i].key);
+                mark_object(heap, &map->entries[i].value);
+            }
+            continue;
+        }
+        ObjectArray *array = (ObjectArray *)header;
+        mark_objects(heap, array->data, array->length);
+    }
+}
+
+//
+// Sweeping.
+//
+static void sweep(Heap *heap) {
+    u64 live = 0;
+    GcHeader **link = &heap->objects;
+    while (*link) {
+        GcHeader *header = *link;
+        u64 bytes = owned_bytes(header);
+        if (header->mark == heap->epoch) {
+            live += bytes;
+            link = &header->next;
+            continue;
+        }
+        *link = header->next;
+        release(header);
+        heap->freed++;
+        heap->freed_bytes += bytes;
+    }
+
+    heap->bytes = live;
+    heap->threshold = live * GC_GROWTH_FACTOR;
+    if (heap->threshold < GC_MIN_HEAP) heap->threshold = GC_MIN_HEAP;
+}
+
+void gc_collect(Interp *interp) {
+    Heap *heap = interp->heap;
+    // Marks are numbered by collection, so they never need clearing. Arrays the heap doesn't own are marked too.
+    heap->epoch++;
+    heap->collections++;
+
+    mark_roots(interp);
+    mark_grey(heap);
+    sweep(heap);
+}
+
+void gc_free(Interp *interp) {
+    Heap *heap = interp->heap;
+    if (!heap) return;
+
+    GcHeader *header = heap->objects;
+    while (header) {
+        GcHeader *next = header->next;
+        release(header);
+        header = next;
+    }
+    array_free(heap->grey);
+    free(heap);
+    interp->heap = NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef GC_h
+#define GC_h
+
+#include "context.h"
+#include "common.h"
+#include "array.h"
+
+// A mark-sweep collector for arrays, maps and long strings. Everything it owns is on one list, and a collection marks what
+// can be reached from the interpreter's frames, stacks and memo tables, then frees the rest. It also owns the array
+// constants the compiler makes, which stay reachable from their frames, so freeing the heap frees those too.
+//
+// Collections only happen at gc_safe_point, which the runtime reaches at the end of the operations which allocate.
+// Every live value is in a frame or on a stack by then, so nothing held in a C local can be freed from under it.
+
+typedef struct Heap {
+    GcHeader *objects;     // everything owned, most recent first
+    u64 bytes;             // owned by the heap, as of the last allocation
+    u64 threshold;         // collect once `bytes` passes this
+    u32 epoch;             // the number of the collection in progress, or the last one
+    Array(GcHeader *) grey; // arrays of objects and maps found but not yet looked through
+
+    u64 collections;
+    u64 freed;             // objects
+    u64 freed_bytes;
+} Heap;
+
+void gc_init(Interp *interp);
+void gc_free(Interp *interp); // frees everything the heap owns, reachable or not
+
+void gc_own(Heap *heap, GcHeader *header, GcType type, u64 bytes);
+StringBuilder *gc_string_builder(Interp *interp, u64 capacity);
+void gc_collect(Interp *interp);
+
+static inline void gc_safe_point(Interp *interp) {
+    Heap *heap = interp->heap;
+    if (heap && heap->bytes > heap->threshold) gc_collect(interp);
+}
+
+#endif
@@ -1,118 +1,143 @@
 #include "context.h"
 #include "array.h"
+#include "jit.h"
+#include "tier.h"
+#include "runtime.h"
+#include "gc.h"
 
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
 #include <stdarg.h>
 
-static void runtime_error(Interp *interp, Instruction instr, const char *fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
-
-    // The weird looking escape characters are to: set the text color to red, print "Error", and then reset the colour.
-    fprintf(stderr, "%s:%lu: \033[0;31mRuntime error\033[0m: ", interp->file_name, instr.line_number);
-    vfprintf(stderr, fmt, args);
-    fprintf(stderr, ".\n");
-    va_end(args);
+// Hashes one argument of a memoised call into `hash`.
+// Returns false for values which can't be used as a key.
+static bool memo_hash_object(Object *o, u64 *hash) {
+    u64 h = *hash ^ o->tag;
+    h *= 1099511628211u;
+
+    switch (o->tag) {
+    case OBJECT_INTEGER:  h ^= (u64)o->integer; break;
+    case OBJECT_FLOATING: h ^= *(u64 *)&o->floating; break;
+    case OBJECT_BOOLEAN:  h ^= o->boolean; break;
+    case OBJECT_NULL:     break;
+    case OBJECT_STRING:   h ^= object_string_hash(o); break;
+    default: return false;
+    }
 
-    interp->error_count++;
+    *hash = h * 1099511628211u;
+    return true;
 }
 
-static void runtime_print(Object value) {
-    switch (value.tag) {
-    case OBJECT_BOOLEAN:   printf("%s", (value.boolean ? "true" : "false")); break;
-    case OBJECT_INTEGER:   printf("%ld", value.integer); break;
-    case OBJECT_FLOATING:  printf("%f", value.floating); break;
-    case OBJECT_STRING:    printf("%s", value.pointer); break;
-    case OBJECT_NULL:      printf("null"); break;
-    case OBJECT_UNDEFINED: printf("undefined"); break;
-
-    case OBJECT_ARRAY: {
-        printf("[");
-        for (int i = 0; i < value.array.length; i++) {
-            runtime_print(value.array.data[i]);
-            if (i < value.array.length-1) {
-                printf(", ");
-            }
-        }
-        printf("]");
-    } break;
-
-    default: assert(false); break;
+static bool memo_same_object(Object a, Object b) {
+    if (a.tag != b.tag) return false;
+    switch (a.tag) {
+    case OBJECT_INTEGER:  return a.integer == b.integer;
+    case OBJECT_FLOATING: return *(u64 *)&a.floating == *(u64 *)&b.floating;
+    case OBJECT_BOOLEAN:  return a.boolean == b.boolean;
+    case OBJECT_NULL:     return true;
+    case OBJECT_STRING:   return object_string_equals(a, b);
+    default: return false;
     }
 }
 
-static u8 runtime_equals1(Object a, Object b) {
-    if (a.tag == OBJECT_FLOATING) {
-        if (b.tag == OBJECT_INTEGER) {
-            return ((u64)a.floating == b.integer);
+// Builds the key of a memoised call from the arguments on top of call_storage, first argument on top.
+static void memo_make_key(Stack *call_storage, u32 num_args, MemoKey *key) {
+    key->hash = 14695981039346656037u;
+    key->cacheable = true;
+    for (u32 i = 0; i < num_args; i++) {
+        // Hashed where it is, so a string argument keeps its hash when it's popped into the callee's frame.
+        Object *arg = (call_storage->data + call_storage->top-i);
+        if (!memo_hash_object(arg, &key->hash)) {
+            key->cacheable = false;
+            return;
         }
+        key->args[i] = *arg;
     }
+}
 
-    if (a.tag != b.tag) return 0;
-
-    switch (a.tag) {
-    case OBJECT_FLOATING:  return a.floating == b.floating;            break;
-    case OBJECT_STRING:    return (strcmp(a.pointer, b.pointer) == 0); break;
-    case OBJECT_INTEGER:   return a.integer == b.integer;              break;
-    case OBJECT_BOOLEAN:   return a.boolean == b.boolean;              break;
-    case OBJECT_NULL:      return (b.tag == OBJECT_NULL);              break;
-    case OBJECT_UNDEFINED: return (b.tag == OBJECT_UNDEFINED);         break;
-    
-    default: assert(false); break;
+static MemoEntry *memo_entry(MemoTable *table, MemoKey *key) {
+    if (!table->entries) {
+        table->entries = calloc(MEMO_TABLE_SIZE, sizeof(MemoEntry));
     }
+    return (table->entries + (key->hash & (MEMO_TABLE_SIZE-1)));
 }
 
-static u8 runtime_equals(Object a, Object b) {
-    return (runtime_equals1(a, b) || runtime_equals1(b, a));
+static bool memo_matches(MemoTable *table, MemoEntry *entry, MemoKey *key) {
+    if (!entry->used || entry->hash != key->hash) return false;
+    for (u32 i = 0; i < table->num_args; i++) {
+        if (!memo_same_object(entry->args[i], key->args[i])) return false;
+    }
+    return true;
 }
 
-static char *runtime_string_concat(Interp *interp, Object a, Object b) {
-    u64 a_len = strlen(a.pointer);
-    u64 b_len = strlen(b.pointer);
-    u64 new_length = a_len + b_len + 1;
-
-    char *result = string_allocator(&interp->strings, new_length);
-    strcpy(result, a.pointer);
-    strcat(result, b.pointer);
+// Rewrites the instruction at the current pc into a form specialised for the operand tags it just saw.
+// Instructions which keep falling back to their generic form are left alone.
+static void quicken(Interp *interp, Op specialised) {
+    Instruction *at = (interp->instructions.data + interp->pc);
+    if (at->arg >= QUICKEN_MAX_DEOPTS) return;
+    at->op = specialised;
+}
 
-    result[new_length] = 0;
-    return result;
+// Undoes `quicken` when a specialised instruction sees operands it can't handle.
+// The caller should re-dispatch the same pc so the generic handler runs.
+static void deoptimize(Interp *interp, Op generic) {
+    Instruction *at = (interp->instructions.data + interp->pc);
+    at->op = generic;
+    at->arg++;
 }
 
-static s64 runtime_len(Object o) {
-    if (o.tag == OBJECT_ARRAY) {
-        return o.array.length;
-    }
-    if (o.tag == OBJECT_STRING) {
-        return strlen(o.pointer);
-    }
-    return -1;
+// Checks the tags of the two operands on top of `stack` without popping them.
+static inline bool top_two_are(Stack *stack, ObjectTag tag) {
+    return (stack->data[stack->top].tag == tag && stack->data[stack->top-1].tag == tag);
 }
 
 void run_interpreter(Interp *interp) {
     frame_push(interp, interp->root_scope);
     StackFrame *scope = frame_top(interp);
 
+    Jit *jit = NULL;
+    if ((interp->flags & COMPILE_JIT) && jit_init(interp)) jit = interp->jit;
+
+    // Code compiled with -O is already as optimised as tiering would make it.
+    Tier *tier = NULL;
+    if ((interp->flags & COMPILE_TIERED) && !(interp->flags & COMPILE_OPTIMIZE)) {
+        tier_init(interp);
+        tier = interp->tier;
+    }
+
+    // Set when native code has just handed an instruction back, so the interpreter runs it instead of re-entering.
+    bool bailed = false;
+
     while (true) {
         if (interp->pc >= interp->instructions.length || interp->pc < 0) {
             break;
         }
 
+        if (jit && jit->recording) jit_record(interp);
+        if (jit && !jit->recording && !bailed && (jit->traces[interp->pc] || jit->entries[interp->pc])) {
+            interp->pc = jit_run(interp, interp->pc, &bailed);
+            continue;
+        }
+        bailed = false;
+
         Instruction instr = interp->instructions.data[interp->pc];
         scope = frame_top(interp);
 
         switch (instr.op) {
 
         case HALT: {
-            break;
+            // Code lowered from the IR isn't laid out in execution order, so HALT may not be the last instruction.
+            return;
         } break;
 
         case CONST: {
             assert(false);
         } break;
 
+        case NOP: {
+        } break;
+
         case LOAD: {
             stack_push(&scope->stack, scope->constant_pool.data[instr.arg]);
         } break;
@@ -132,55 +157,76 @@ void run_interpreter(Interp *interp) {
         } break;
 
         case EQUALS: {
-            Object left = stack_pop(&scope->stack);
-            Object right = stack_pop(&scope->stack);
+            bool ints   = top_two_are(&scope->stack, OBJECT_INTEGER);
+            bool floats = top_two_are(&scope->stack, OBJECT_FLOATING);
+            runtime_binary(interp, instr, &scope->stack);
 
-            Object result = (Object){
-                .tag=OBJECT_BOOLEAN,
-                .boolean=runtime_equals(left, right),
-            };
-            
-            stack_push(&scope->stack, result);
+            if (ints) quicken(interp, EQUALS_INT);
+            else if (floats) quicken(interp, EQUALS_FLOAT);
         } break;
 
-        case PRINT: {
-            for (int i = 0; i < instr.arg; i++) {
-                runtime_print(stack_pop(&interp->call_storage));
-                printf(" ");
+        case EQUALS_INT: {
+            if (!top_two_are(&scope->stack, OBJECT_INTEGER)) {
+                deoptimize(interp, EQUALS);
+                continue;
             }
-            printf("\n");
+            s64 right = stack_pop(&scope->stack).integer;
+            s64 left  = stack_pop(&scope->stack).integer;
+            stack_push(&scope->stack, (Object){.tag=OBJECT_BOOLEAN, .boolean=(left == right)});
         } break;
 
-        case APPEND: {
-            Object value  = stack_pop(&interp->call_storage);
-            Object target = scope->constant_pool.data[instr.arg];
-
-            if (target.tag != OBJECT_ARRAY) {
-                runtime_error(interp, instr, "attempt to append to non-array");
-                return;
+        case EQUALS_FLOAT: {
+            if (!top_two_are(&scope->stack, OBJECT_FLOATING)) {
+                deoptimize(interp, EQUALS);
+                continue;
             }
+            f64 right = stack_pop(&scope->stack).floating;
+            f64 left  = stack_pop(&scope->stack).floating;
+            stack_push(&scope->stack, (Object){.tag=OBJECT_BOOLEAN, .boolean=(left == right)});
+        } break;
+
+        case PRINT: {
+            runtime_print_arguments(interp, instr);
+        } break;
+
+        case APPEND: {
+            if (!runtime_append(interp, instr, scope)) return;
+        } break;
 
-            array_add(target.array, value);
-            stack_push(&interp->call_storage, target);
+        case APPEND_IN_PLACE: {
+            if (!runtime_append_in_place(interp, instr, scope)) return;
         } break;
 
         case LEN: {
-            Object value = scope->constant_pool.data[instr.arg];
-            Object result = (Object){0};
-            s64 len = runtime_len(value);
-            if (len == -1) {
-                runtime_error(interp, instr, "argument of 'len' must be array or string");
-                return;
-            }
-            result.integer = len;
-            result.tag = OBJECT_INTEGER;
-            stack_push(&interp->call_storage, result);
+            if (!runtime_builtin_len(interp, instr, scope)) return;
+        } break;
+
+        case SUM:
+        case MIN:
+        case MAX:
+        case DOT:
+        case SCALE:
+        case FILL: {
+            if (!runtime_array_builtin(interp, instr, scope)) return;
+        } break;
+
+        case MAP_GET:
+        case MAP_SET:
+        case MAP_HAS:
+        case MAP_DELETE: {
+            if (!runtime_map_builtin(interp, instr, scope)) return;
         } break;
 
         case ARRAY_SUBSCRIPT: {
-            Object index = stack_pop(&scope->stack);
-            Object array = scope->constant_pool.data[instr.arg];
-            scope->constant_pool.data[ARRAY_SUBSCRIPT_RESULT_INDEX] = array.array.data[index.integer];
+            if (!runtime_subscript(interp, instr, scope)) return;
+        } break;
+
+        case NEW_ARRAY: {
+            runtime_new_array(interp, instr, scope);
+        } break;
+
+        case NEW_MAP: {
+            if (!runtime_new_map(interp, instr, scope)) return;
         } break;
 
         case BEGIN_BLOCK: {
@@ -198,7 +244,7 @@ void run_interpreter(Interp *interp) {
 
         case LOAD_SCOPE: {
             StackFrame *new_scope = interp->root_scope->constant_pool.data[instr.arg].scope;
-            frame_push(interp, new_scope);
+            frame_enter(interp, new_scope);
         } break;
 
         case POP_SCOPE: {
@@ -225,7 +271,59 @@ void run_interpreter(Interp *interp) {
 
         case CALL_FUNC: {
             // Jump to the new place
+            if (tier) tier_note_call(interp, instr.arg);
             interp->pc = interp->root_scope->constant_pool.data[instr.arg].integer;
+            if (jit) jit_note_call(interp, interp->pc);
+            continue;
+        } break;
+
+        case MEMO_LOOKUP: {
+            MemoTable *table = (interp->memo_tables.data + instr.arg);
+            MemoKey *key = &interp->memo_stack.data[++interp->memo_stack.top];
+            assert(interp->memo_stack.top < CONTEXT_STACK_SIZE);
+
+            memo_make_key(&interp->call_storage, table->num_args, key);
+            if (!key->cacheable) break;
+
+            MemoEntry *entry = memo_entry(table, key);
+            if (!memo_matches(table, entry, key)) {
+                table->misses++;
+                break;
+            }
+
+            // Hit: drop the arguments and skip the LOAD_PC, CALL_FUNC and MEMO_STORE that follow.
+            interp->memo_stack.top--;
+            for (u32 i = 0; i < table->num_args; i++) {
+                stack_pop(&interp->call_storage);
+            }
+            stack_push(&interp->call_storage, entry->result);
+            table->hits++;
+            interp->pc += 3;
+        } break;
+
+        case MEMO_STORE: {
+            MemoTable *table = (interp->memo_tables.data + instr.arg);
+            MemoKey *key = &interp->memo_stack.data[interp->memo_stack.top--];
+            if (!key->cacheable) break;
+            // Whoever an array or map is returned to can change it, so it can't be handed out again.
+            ObjectTag result_tag = stack_top(interp->call_storage).tag;
+            if (result_tag == OBJECT_ARRAY || result_tag == OBJECT_MAP) break;
+
+            MemoEntry *entry = memo_entry(table, key);
+            entry->used = true;
+            entry->hash = key->hash;
+            memcpy(entry->args, key->args, sizeof(key->args));
+            entry->result = stack_top(interp->call_storage);
+        } break;
+
+        case TAIL_CALL: {
+            // The arguments are already in call_storage, so the caller's frame can go.
+            // The return address on the jump stack is still the one the caller was given,
+            // so the callee returns straight past the caller.
+            frame_pop(interp);
+            if (tier) tier_note_call(interp, instr.arg);
+            interp->pc = interp->root_scope->constant_pool.data[instr.arg].integer;
+            if (jit) jit_note_call(interp, interp->pc);
             continue;
         } break;
 
@@ -254,257 +352,78 @@ void run_interpreter(Interp *interp) {
         } break;
 
         case JUMP: {
+            if (jit && instr.arg < (s64)interp->pc) jit_note_back_edge(interp, instr.arg+1, interp->pc);
+            if (tier && instr.arg < (s64)interp->pc) tier_note_back_edge(interp, interp->pc);
             interp->pc = instr.arg;
         } break;
 
         case NEG: {
-            Object negate = stack_pop(&scope->stack);
-            Object result = (Object){0};
-            result.tag = negate.tag;
-            if (negate.tag == OBJECT_INTEGER) {
-                result.integer = -negate.integer;
-            } else if (negate.tag == OBJECT_FLOATING) {
-                result.floating = -negate.floating;
-            } else {
-                runtime_error(interp, instr, "operand of unary negation must be numerical");
-                return;
-            }
-            stack_push(&scope->stack, result);
-        } break;
-
-        case GREATER_THAN: {
-            Object right = stack_pop(&scope->stack);
-            Object left  = stack_pop(&scope->stack);
-
-            if (left.tag != right.tag) {
-                runtime_error(interp, instr, "type mismatch: cannot compare two different types");
-                return;
-            }
-
-            Object result = (Object){0};
-            result.tag = OBJECT_BOOLEAN;
-
-            switch (left.tag) {
-            case OBJECT_INTEGER: {
-                result.boolean = (left.integer > right.integer);
-            } break;
-            case OBJECT_FLOATING: {
-                result.boolean = (left.floating > right.floating);
-            } break;
-
-            default: {
-                runtime_error(interp, instr, "operands of '>' must be integer or float");
-                return;
-            } break;
-            }
-
-            stack_push(&scope->stack, result);
+            if (!runtime_negate(interp, instr, &scope->stack)) return;
         } break;
 
+        case SUB:
+        case MUL:
+        case DIV:
+        case LESS_THAN_EQUALS:
+        case GREATER_THAN:
         case GREATER_THAN_EQUALS: {
-            Object right = stack_pop(&scope->stack);
-            Object left  = stack_pop(&scope->stack);
-
-            if (left.tag != right.tag) {
-                runtime_error(interp, instr, "type mismatch: cannot compare two different types");
-                return;
-            }
-
-            Object result = (Object){0};
-            result.tag = OBJECT_BOOLEAN;
-
-            switch (left.tag) {
-            case OBJECT_INTEGER: {
-                result.boolean = (left.integer >= right.integer);
-            } break;
-            case OBJECT_FLOATING: {
-                result.boolean = (left.floating >= right.floating);
-            } break;
-
-            default: {
-                runtime_error(interp, instr, "operands of '>=' must be integer or float");
-                return;
-            } break;
-            }
-
-            stack_push(&scope->stack, result);
+            if (!runtime_binary(interp, instr, &scope->stack)) return;
         } break;
 
         case LESS_THAN: {
-            Object right = stack_pop(&scope->stack);
-            Object left  = stack_pop(&scope->stack);
-
-            if (left.tag != right.tag) {
-                runtime_error(interp, instr, "type mismatch: cannot compare two different types");
-                return;
-            }
+            ObjectTag tag = scope->stack.data[scope->stack.top].tag;
+            if (!runtime_binary(interp, instr, &scope->stack)) return;
 
-            Object result = (Object){0};
-            result.tag = OBJECT_BOOLEAN;
-
-            switch (left.tag) {
-            case OBJECT_INTEGER: {
-                result.boolean = (left.integer < right.integer);
-            } break;
-            case OBJECT_FLOATING: {
-                result.boolean = (left.floating < right.floating);
-            } break;
-
-            default: {
-                runtime_error(interp, instr, "operands of '<' must be integer or float");
-                return;
-            } break;
-            }
-
-            stack_push(&scope->stack, result);
+            if (tag == OBJECT_INTEGER) quicken(interp, LESS_THAN_INT);
+            else if (tag == OBJECT_FLOATING) quicken(interp, LESS_THAN_FLOAT);
         } break;
 
-        case LESS_THAN_EQUALS: {
-            Object right = stack_pop(&scope->stack);
-            Object left  = stack_pop(&scope->stack);
-
-            if (left.tag != right.tag) {
-                runtime_error(interp, instr, "type mismatch: cannot compare two different types");
-                return;
+        case LESS_THAN_INT: {
+            if (!top_two_are(&scope->stack, OBJECT_INTEGER)) {
+                deoptimize(interp, LESS_THAN);
+                continue;
             }
-
-            Object result = (Object){0};
-            result.tag = OBJECT_BOOLEAN;
-
-            switch (left.tag) {
-            case OBJECT_INTEGER: {
-                result.boolean = (left.integer <= right.integer);
-            } break;
-            case OBJECT_FLOATING: {
-                result.boolean = (left.floating <= right.floating);
-            } break;
-
-            default: {
-                runtime_error(interp, instr, "operands of '<=' must be integer or float");
-                return;
-            } break;
-            }
-
-            stack_push(&scope->stack, result);
+            s64 right = stack_pop(&scope->stack).integer;
+            s64 left  = stack_pop(&scope->stack).integer;
+            stack_push(&scope->stack, (Object){.tag=OBJECT_BOOLEAN, .boolean=(left < right)});
         } break;
 
-        case ADD: {
-            Object right = stack_pop(&scope->stack);
-            Object left  = stack_pop(&scope->stack);
-
-            if (left.tag != right.tag) {
-                runtime_error(interp, instr, "type mismatch: cannot add two different types");
-                return;
+        case LESS_THAN_FLOAT: {
+            if (!top_two_are(&scope->stack, OBJECT_FLOATING)) {
+                deoptimize(interp, LESS_THAN);
+                continue;
             }
-
-            Object result = (Object){0};
-            assert(left.tag == right.tag);
-            result.tag = left.tag;
-
-            switch (left.tag) {
-            case OBJECT_INTEGER: {
-                result.integer = left.integer + right.integer;
-            } break;
-            case OBJECT_FLOATING: {
-                result.floating = left.floating + right.floating;
-            } break;
-            case OBJECT_STRING: {
-                result.pointer = runtime_string_concat(interp, left, right);
-            } break;
-
-            default: {
-                runtime_error(interp, instr, "operands of addition must be integer, float or string");
-                return;
-            } break;
-            }
-            stack_push(&scope->stack, result);
+            f64 right = stack_pop(&scope->stack).floating;
+            f64 left  = stack_pop(&scope->stack).floating;
+            stack_push(&scope->stack, (Object){.tag=OBJECT_BOOLEAN, .boolean=(left < right)});
         } break;
 
-        case SUB: {
-            Object right = stack_pop(&scope->stack);
-            Object left  = stack_pop(&scope->stack);
-
-            if (left.tag != right.tag) {
-                runtime_error(interp, instr, "type mismatch: cannot subtract two different types");
-                return;
-            }
+        case ADD: {
+            if (!runtime_binary(interp, instr, &scope->stack)) return;
 
-            Object result = (Object){0};
-            assert(left.tag == right.tag);
-            result.tag = left.tag;
-
-            switch (left.tag) {
-            case OBJECT_INTEGER: {
-                result.integer = left.integer - right.integer;
-            } break;
-            case OBJECT_FLOATING: {
-                result.floating = left.floating - right.floating;
-            } break;
-
-            default: {
-                runtime_error(interp, instr, "operands of subtraction must be numerical");
-                return;
-            } break;
-            }
-            stack_push(&scope->stack, result);
+            ObjectTag tag = scope->stack.data[scope->stack.top].tag;
+            if (tag == OBJECT_INTEGER) quicken(interp, ADD_INT);
+            else if (tag == OBJECT_FLOATING) quicken(interp, ADD_FLOAT);
         } break;
 
-        case MUL: {
-            Object right = stack_pop(&scope->stack);
-            Object left  = stack_pop(&scope->stack);
-
-            if (left.tag != right.tag) {
-                runtime_error(interp, instr, "type mismatch: cannot multiply two different types");
-                return;
+        case ADD_INT: {
+            if (!top_two_are(&scope->stack, OBJECT_INTEGER)) {
+                deoptimize(interp, ADD);
+                continue;
             }
-
-            Object result = (Object){0};
-            assert(left.tag == right.tag);
-            result.tag = left.tag;
-
-            switch (left.tag) {
-            case OBJECT_INTEGER: {
-                result.integer = left.integer * right.integer;
-            } break;
-            case OBJECT_FLOATING: {
-                result.floating = left.floating * right.floating;
-            } break;
-
-            default: {
-                runtime_error(interp, instr, "operands of multiplication must be numerical");
-                return;
-            } break;
-            }
-            stack_push(&scope->stack, result);
+            s64 right = stack_pop(&scope->stack).integer;
+            s64 left  = stack_pop(&scope->stack).integer;
+            stack_push(&scope->stack, (Object){.tag=OBJECT_INTEGER, .integer=(left + right)});
         } break;
 
-        case DIV: {
-            Object right = stack_pop(&scope->stack);
-            Object left  = stack_pop(&scope->stack);
-
-            if (left.tag != right.tag) {
-                runtime_error(interp, instr, "type mismatch: cannot multiply two different types");
-                return;
-            }
-
-            Object result = (Object){0};
-            assert(left.tag == right.tag);
-            result.tag = left.tag;
-
-            switch (left.tag) {
-            case OBJECT_INTEGER: {
-                result.integer = left.integer / right.integer;
-            } break;
-            case OBJECT_FLOATING: {
-                result.floating = left.floating / right.floating;
-            } break;
-
-            default: {
-                runtime_error(interp, instr, "operands of division must be numerical");
-                return;
-            } break;
+        case ADD_FLOAT: {
+            if (!top_two_are(&scope->stack, OBJECT_FLOATING)) {
+                deoptimize(interp, ADD);
+                continue;
             }
-            stack_push(&scope->stack, result);
+            f64 right = stack_pop(&scope->stack).floating;
+            f64 left  = stack_pop(&scope->stack).floating;
+            stack_push(&scope->stack, (Object){.tag=OBJECT_FLOATING, .floating=(left + right)});
         } break;
 
         
@@ -0,0 +1,1106 @@
+// Construction of the SSA IR from the AST, plus the helpers shared by the passes and the lowering.
+// Values are built on the fly using the algorithm from Braun et al., "Simple and Efficient Construction
+// of Static Single Assignment Form": each block remembers the current value of every variable assigned
+// in it, and reads in other blocks walk up the predecessors, creating phis at merge points.
+//
+// While loops are built rotated, as `if cond { do { body } while cond }`, so that the loop has a
+// preheader which only runs when the body is going to run at least once.
+#include "ir.h"
+#include "context.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+typedef struct IrBuilder {
+    IrFunction *f;
+    Interp     *interp;
+    u32         block;          // 0 when the code being built is unreachable
+    BlockStack  ast_blocks;     // for name lookup
+    Ast         known;          // declarations which are in scope and have been built
+    u32         break_target;
+    u32         continue_target;
+} IrBuilder;
+
+static u32 build_expr(IrBuilder *b, AstNode *expr);
+static void build_block(IrBuilder *b, AstNode *block);
+
+//
+// Values and blocks
+//
+static u32 new_block(IrFunction *f) {
+    IrBlock block = (IrBlock){0};
+    array_init(block.values, u32);
+    array_init(block.preds, u32);
+    array_init(block.succs, u32);
+    array_init(block.defs, IrVariableDef);
+    array_init(block.incomplete_phis, IrVariableDef);
+    array_add(f->blocks, block);
+    return f->blocks.length-1;
+}
+
+static u32 new_value(IrFunction *f, IrOp op, u32 block, u64 line) {
+    IrValue v = (IrValue){0};
+    v.op = op;
+    v.block = block;
+    v.line = line;
+    if (op == IR_PHI || op == IR_CALL || op == IR_PRINT || op == IR_NEW_MAP || op == IR_MAP) {
+        array_init(v.list, u32);
+    }
+    array_add(f->values, v);
+    return f->values.length-1;
+}
+
+static u32 append_value(IrFunction *f, IrOp op, u32 block, u32 a, u32 b, u64 line) {
+    u32 v = new_value(f, op, block, line);
+    f->values.data[v].a = a;
+    f->values.data[v].b = b;
+    array_add(f->blocks.data[block].values, v);
+    return v;
+}
+
+static u32 new_const(IrFunction *f, Object o) {
+    u32 v = new_value(f, IR_CONST, 0, 0);
+    f->values.data[v].constant = o;
+    array_add(f->blocks.data[0].values, v);
+    return v;
+}
+
+static u32 new_phi(IrFunction *f, u32 block) {
+    u32 v = new_value(f, IR_PHI, block, 0);
+
+    // Phis go before everything else in the block.
+    IrBlock *b = (f->blocks.data + block);
+    u64 at = 0;
+    while (at < b->values.length && f->values.data[b->values.data[at]].op == IR_PHI) at++;
+    array_add(b->values, 0);
+    memmove(b->values.data+at+1, b->values.data+at, (b->values.length-at-1)*sizeof(u32));
+    b->values.data[at] = v;
+
+    return v;
+}
+
+static void add_edge(IrFunction *f, u32 from, u32 to) {
+    array_add(f->blocks.data[from].succs, to);
+    array_add(f->blocks.data[to].preds, from);
+}
+
+// Follows the forwarding pointers left by replaced values.
+u32 ir_resolve(IrFunction *f, u32 value) {
+    u32 v = value;
+    while (f->values.data[v].replaced_by) v = f->values.data[v].replaced_by;
+
+    // Path compression.
+    while (f->values.data[value].replaced_by && f->values.data[value].replaced_by != v) {
+        u32 next = f->values.data[value].replaced_by;
+        f->values.data[value].replaced_by = v;
+        value = next;
+    }
+    return v;
+}
+
+// Points `out` at the operands of `v`. `scratch` needs room for two.
+u64 ir_operands(IrValue *v, u32 **out, u32 *scratch) {
+    switch (v->op) {
+    case IR_PHI:
+    case IR_CALL:
+    case IR_PRINT:
+    case IR_NEW_MAP:
+    case IR_MAP: {
+        *out = v->list.data;
+        return v->list.length;
+    } break;
+
+    case IR_NONE:
+    case IR_CONST:
+    case IR_PARAM:
+    case IR_NEW_ARRAY: {
+        *out = scratch;
+        return 0;
+    } break;
+
+    case IR_COPY:
+    case IR_NEG:
+    case IR_LEN: {
+        scratch[0] = v->a;
+        *out = scratch;
+        return 1;
+    } break;
+    }
+
+    if (v->op == IR_BUILTIN && !v->b) {
+        scratch[0] = v->a;
+        *out = scratch;
+        return 1;
+    }
+
+    scratch[0] = v->a;
+    scratch[1] = v->b;
+    *out = scratch;
+    return 2;
+}
+
+// Removes the edge from `pred` into `block`, along with the phi operands which came in over it.
+void ir_remove_pred(IrFunction *f, u32 block, u32 pred) {
+    IrBlock *b = (f->blocks.data + block);
+    u64 k = 0;
+    while (k < b->preds.length && b->preds.data[k] != pred) k++;
+    if (k == b->preds.length) return;
+
+    memmove(b->preds.data+k, b->preds.data+k+1, (b->preds.length-k-1)*sizeof(u32));
+    b->preds.length--;
+
+    for (u64 i = 0; i < b->values.length; i++) {
+        IrValue *v = (f->values.data + b->values.data[i]);
+        if (v->op != IR_PHI) break;
+        if (k >= v->list.length) continue;
+        memmove(v->list.data+k, v->list.data+k+1, (v->list.length-k-1)*sizeof(u32));
+        v->list.length--;
+    }
+}
+
+//
+// Variables
+//
+static void write_variable(IrFunction *f, u32 block, AstNode *decl, u32 value) {
+    IrBlock *b = (f->blocks.data + block);
+    for (u64 i = 0; i < b->defs.length; i++) {
+        if (b->defs.data[i].decl == decl) {
+            b->defs.data[i].value = value;
+            return;
+        }
+    }
+    IrVariableDef def = (IrVariableDef){.decl = decl, .value = value};
+    array_add(b->defs, def);
+}
+
+static u32 read_variable(IrBuilder *b, u32 block, AstNode *decl);
+
+// Replaces a phi whose operands are all the same value (or itself) with that value.
+static u32 try_remove_trivial_phi(IrFunction *f, u32 phi) {
+    u32 same = 0;
+    IrList ops = f->values.data[phi].list;
+    for (u64 i = 0; i < ops.length; i++) {
+        u32 op = ir_resolve(f, ops.data[i]);
+        if (op == same || op == phi) continue;
+        if (same) return phi;
+        same = op;
+    }
+
+    if (!same) {
+        same = new_const(f, (Object){.tag = OBJECT_UNDEFINED});
+    }
+
+    f->values.data[phi].replaced_by = same;
+    f->values.data[phi].dead = true;
+    return same;
+}
+
+static u32 add_phi_operands(IrBuilder *b, AstNode *decl, u32 phi) {
+    IrFunction *f = b->f;
+    u32 block = f->values.data[phi].block;
+    for (u64 i = 0; i < f->blocks.data[block].preds.length; i++) {
+        u32 pred = f->blocks.data[block].preds.data[i];
+        u32 operand = read_variable(b, pred, decl);
+        array_add(f->values.data[phi].list, operand);
+    }
+    return try_remove_trivial_phi(f, phi);
+}
+
+static u32 read_variable_recursive(IrBuilder *b, u32 block, AstNode *decl) {
+    IrFunction *f = b->f;
+    u32 value;
+
+    if (!f->blocks.data[block].sealed) {
+        // Not all predecessors are known yet, the operands are filled in by `seal_block`.
+        value = new_phi(f, block);
+        IrVariableDef incomplete = (IrVariableDef){.decl = decl, .value = value};
+        array_add(f->blocks.data[block].incomplete_phis, incomplete);
+
+    } else if (f->blocks.data[block].preds.length == 0) {
+        // Read before any assignment.
+        value = new_const(f, (Object){.tag = OBJECT_UNDEFINED});
+
+    } else if (f->blocks.data[block].preds.length == 1) {
+        value = read_variable(b, f->blocks.data[block].preds.data[0], decl);
+
+    } else {
+        // Break cycles by writing the phi before looking for its operands.
+        value = new_phi(f, block);
+        write_variable(f, block, decl, value);
+        value = add_phi_operands(b, decl, value);
+    }
+
+    write_variable(f, block, decl, value);
+    return value;
+}
+
+static u32 read_variable(IrBuilder *b, u32 block, AstNode *decl) {
+    IrBlock *blk = (b->f->blocks.data + block);
+    for (u64 i = 0; i < blk->defs.length; i++) {
+        if (blk->defs.data[i].decl == decl) return ir_resolve(b->f, blk->defs.data[i].value);
+    }
+    return read_variable_recursive(b, block, decl);
+}
+
+// Called once every predecessor of a block is known.
+static void seal_block(IrBuilder *b, u32 block) {
+    IrFunction *f = b->f;
+    for (u64 i = 0; i < f->blocks.data[block].incomplete_phis.length; i++) {
+        IrVariableDef incomplete = f->blocks.data[block].incomplete_phis.data[i];
+        add_phi_operands(b, incomplete.decl, incomplete.value);
+    }
+    f->blocks.data[block].incomplete_phis.length = 0;
+    f->blocks.data[block].sealed = true;
+}
+
+//
+// Terminators
+//
+static void jump(IrBuilder *b, u32 to, u64 line) {
+    IrBlock *from = (b->f->blocks.data + b->block);
+    from->term = IR_TERM_JUMP;
+    from->term_line = line;
+    add_edge(b->f, b->block, to);
+    b->block = 0;
+}
+
+static void branch(IrBuilder *b, u32 condition, u32 if_true, u32 if_false, u64 line) {
+    IrBlock *from = (b->f->blocks.data + b->block);
+    from->term = IR_TERM_BRANCH;
+    from->term_value = condition;
+    from->term_line = line;
+    add_edge(b->f, b->block, if_true);
+    add_edge(b->f, b->block, if_false);
+    b->block = 0;
+}
+
+static void fail(IrBuilder *b) {
+    b->f->failed = true;
+}
+
+//
+// Expressions
+//
+static bool is_known(IrBuilder *b, AstNode *decl) {
+    for (u64 i = 0; i < b->known.length; i++) {
+        if (b->known.data[i] == decl) return true;
+    }
+    return false;
+}
+
+static AstNode *lookup(IrBuilder *b, char *name) {
+    AstNode *decl = find_decl(current_block(b->ast_blocks), b->interp->program, name);
+    if (!decl || !is_known(b, decl)) {
+        // Either undeclared, or a variable from outside of this function; the bytecode compiler deals with both.
+        fail(b);
+        return NULL;
+    }
+    return decl;
+}
+
+static bool literal_object(Interp *interp, AstNode *node, Object *out) {
+    *out = (Object){0};
+    switch (node->tag) {
+    case NODE_INT_LITERAL:     out->tag = OBJECT_INTEGER;  out->integer = node->literal.integer;  return true;
+    case NODE_FLOAT_LITERAL:   out->tag = OBJECT_FLOATING; out->floating = node->literal.floating; return true;
+    case NODE_STRING_LITERAL:  *out = constant_string(interp, node->literal.string); return true;
+    case NODE_NULL_LITERAL:    out->tag = OBJECT_NULL;     return true;
+    case NODE_BOOLEAN_LITERAL: out->tag = OBJECT_BOOLEAN;  out->boolean = node->boolean.value;    return true;
+    }
+    return false;
+}
+
+static IrOp binary_op(TokenType op) {
+    switch (op) {
+    case Token_PLUS:          return IR_ADD;
+    case Token_MINUS:         return IR_SUB;
+    case Token_STAR:          return IR_MUL;
+    case Token_SLASH:         return IR_DIV;
+    case Token_EQUAL_EQUAL:   return IR_EQUALS;
+    case Token_LESS:          return IR_LESS_THAN;
+    case Token_LESS_EQUAL:    return IR_LESS_THAN_EQUALS;
+    case Token_GREATER:       return IR_GREATER_THAN;
+    case Token_GREATER_EQUAL: return IR_GREATER_THAN_EQUALS;
+    case Token_PLUS_EQUAL:    return IR_ADD;
+    case Token_MINUS_EQUAL:   return IR_SUB;
+    case Token_STAR_EQUAL:    return IR_MUL;
+    case Token_SLASH_EQUAL:   return IR_DIV;
+    }
+    return IR_NONE;
+}
+
+// Arguments are evaluated last to first, the same as compile_loads_for_expression_list.
+static bool build_args(IrBuilder *b, Ast args, IrList *out) {
+    out->length = 0;
+    for (u64 i = 0; i < args.length; i++) array_add(*out, 0);
+
+    for (u64 j = args.length; j > 0; j--) {
+        u32 v = build_expr(b, args.data[j-1]);
+        if (!v) return false;
+        out->data[j-1] = v;
+    }
+    return true;
+}
+
+static u32 build_call(IrBuilder *b, AstNode *call) {
+    IrFunction *f = b->f;
+    AstNode *name = call->call.name;
+    if (name->tag != NODE_IDENTIFIER) {
+        fail(b);
+        return 0;
+    }
+
+    char *ident = name->identifier;
+    Ast args = call->call.args->expression_list.expressions;
+
+    if (strcmp(ident, "print") == 0) {
+        IrList values;
+        array_init(values, u32);
+        if (!build_args(b, args, &values)) {
+            array_free(values);
+            return 0;
+        }
+        u32 v = append_value(f, IR_PRINT, b->block, 0, 0, call->line);
+        f->values.data[v].list = values;
+        return new_const(f, (Object){.tag = OBJECT_NULL});
+    }
+
+    if (strcmp(ident, "append") == 0) {
+        if (args.length != 2) {
+            fail(b);
+            return 0;
+        }
+        u32 value = build_expr(b, args.data[1]);
+        if (!value) return 0;
+        u32 array = build_expr(b, args.data[0]);
+        if (!array) return 0;
+        // The array is appended to in place, so the result is the same array.
+        append_value(f, IR_APPEND, b->block, array, value, call->line);
+        return array;
+    }
+
+    if (strcmp(ident, "len") == 0) {
+        if (args.length != 1) {
+            fail(b);
+            return 0;
+        }
+        u32 value = build_expr(b, args.data[0]);
+        if (!value) return 0;
+        return append_value(f, IR_LEN, b->block, value, 0, call->line);
+    }
+
+    u32 num_builtin_args;
+    Op builtin = array_builtin(b->interp, ident, &num_builtin_args);
+    if (builtin != NOP) {
+        if (args.length != num_builtin_args) {
+            fail(b);
+            return 0;
+        }
+        u32 value = 0;
+        if (args.length == 2) {
+            value = build_expr(b, args.data[1]);
+            if (!value) return 0;
+        }
+        u32 array = build_expr(b, args.data[0]);
+        if (!array) return 0;
+        u32 v = append_value(f, IR_BUILTIN, b->block, array, value, call->line);
+        f->values.data[v].extra = builtin;
+        return v;
+    }
+
+    // Evaluated in the same order as compile_call: the value of `set`, the key, then the map.
+    builtin = map_builtin(b->interp, ident, &num_builtin_args);
+    if (builtin != NOP) {
+        if (args.length != num_builtin_args) {
+            fail(b);
+            return 0;
+        }
+        IrList operands;
+        array_init(operands, u32);
+        for (u64 i = 0; i < args.length; i++) array_add(operands, 0);
+        for (u64 i = args.length; i > 0; i--) {
+            u32 operand = build_expr(b, args.data[i-1]);
+            if (!operand) {
+                array_free(operands);
+                return 0;
+            }
+            operands.data[i-1] = operand;
+        }
+        u32 v = append_value(f, IR_MAP, b->block, 0, 0, call->line);
+        f->values.data[v].list = operands;
+        f->values.data[v].extra = builtin;
+        return v;
+    }
+
+    AstNode *lambda = find_lambda(b->interp, ident);
+    if (!lambda) {
+        fail(b);
+        return 0;
+    }
+
+    Ast params = lambda->lambda.args->expression_list.expressions;
+    if (params.length != args.length) {
+        fail(b);
+        return 0;
+    }
+
+    IrList values;
+    array_init(values, u32);
+    if (!build_args(b, args, &values)) {
+        array_free(values);
+        return 0;
+    }
+
+    // Small functions are inlined the same way compile_inline_call does it, by binding the parameters to the arguments.
+    AstNode *body = inlinable_body(lambda);
+    if (body) {
+        for (u64 i = 0; i < params.length; i++) {
+            write_variable(f, b->block, params.data[i], values.data[i]);
+            array_add(b->known, params.data[i]);
+        }
+        array_free(values);
+
+        push_block(&b->ast_blocks, lambda->lambda.block);
+        u32 result = build_expr(b, body);
+        pop_block(&b->ast_blocks);
+        return result;
+    }
+
+    u32 v = append_value(f, IR_CALL, b->block, 0, 0, call->line);
+    f->values.data[v].list = values;
+    f->values.data[v].extra = (s64)lambda;
+    return v;
+}
+
+static u32 build_expr(IrBuilder *b, AstNode *expr) {
+    IrFunction *f = b->f;
+    if (f->failed) return 0;
+
+    Object literal;
+    if (literal_object(b->interp, expr, &literal)) {
+        return new_const(f, literal);
+    }
+
+    switch (expr->tag) {
+    case NODE_ENCLOSED_EXPRESSION: {
+        return build_expr(b, expr->enclosed_expr.inner);
+    } break;
+
+    case NODE_ARRAY_LITERAL: {
+        // Array literals are built at compile time, so only literal elements are supported.
+        // Each evaluation copies the array that was built.
+        Object array = (Object){0};
+        array.tag = OBJECT_ARRAY;
+        array.array = object_array_new(b->interp->heap);
+
+        AstNode *elements = expr->array_literal;
+        Ast list = (Ast){0};
+        if (elements && elements->tag == NODE_EXPRESSION_LIST) {
+            list = elements->expression_list.expressions;
+        } else if (elements) {
+            list.data = &expr->array_literal;
+            list.length = 1;
+        }
+
+        for (u64 i = 0; i < list.length; i++) {
+            Object element;
+            if (!literal_object(b->interp, list.data[i], &element)) {
+                fail(b); // the array is left for the collector
+                
+                return 0;
+            }
+            object_array_add(array.array, element);
+        }
+
+        u32 v = append_value(f, IR_NEW_ARRAY, b->block, 0, 0, expr->line);
+        f->values.data[v].constant = array;
+        return v;
+    } break;
+
+    case NODE_MAP_LITERAL: {
+        IrList operands;
+        array_init(operands, u32);
+        for (u64 i = 0; i < expr->map_literal.keys.length; i++) {
+            u32 key = build_expr(b, expr->map_literal.keys.data[i]);
+            u32 value = (key ? build_expr(b, expr->map_literal.values.data[i]) : 0);
+            if (!value) {
+                array_free(operands);
+                return 0;
+            }
+            array_add(operands, key);
+            array_add(operands, value);
+        }
+        u32 v = append_value(f, IR_NEW_MAP, b->block, 0, 0, expr->line);
+        f->values.data[v].list = operands;
+        return v;
+    } break;
+
+    case NODE_IDENTIFIER: {
+        AstNode *decl = lookup(b, expr->identifier);
+        if (!decl) return 0;
+        return read_variable(b, b->block, decl);
+    } break;
+
+    case NODE_UNARY: {
+        if (expr->unary.op != Token_MINUS) {
+            fail(b);
+            return 0;
+        }
+        u32 operand = build_expr(b, expr->unary.operand);
+        if (!operand) return 0;
+        return append_value(f, IR_NEG, b->block, operand, 0, expr->line);
+    } break;
+
+    case NODE_BINARY: {
+        IrOp op = binary_op(expr->binary.op);
+        if (op == IR_NONE || (expr->binary.op > Token_ASSIGNMENTS_START && expr->binary.op < Token_ASSIGNMENTS_END)) {
+            fail(b);
+            return 0;
+        }
+        u32 left = build_expr(b, expr->binary.left);
+        if (!left) return 0;
+        u32 right = build_expr(b, expr->binary.right);
+        if (!right) return 0;
+        return append_value(f, op, b->block, left, right, expr->line);
+    } break;
+
+    case NODE_SUBSCRIPT: {
+        if (!expr->subscript.inner_expr) {
+            fail(b);
+            return 0;
+        }
+        u32 array = build_expr(b, expr->subscript.array);
+        if (!array) return 0;
+        u32 index = build_expr(b, expr->subscript.inner_expr);
+        if (!index) return 0;
+        return append_value(f, IR_SUBSCRIPT, b->block, array, index, expr->line);
+    } break;
+
+    case NODE_CALL: {
+        return build_call(b, expr);
+    } break;
+    }
+
+    fail(b);
+    return 0;
+}
+
+//
+// Statements
+//
+static void build_assignment(IrBuilder *b, AstNode *node) {
+    IrFunction *f = b->f;
+    AstNode *target = node->binary.left;
+    if (target->tag != NODE_IDENTIFIER) {
+        fail(b);
+        return;
+    }
+
+    AstNode *decl = lookup(b, target->identifier);
+    if (!decl) return;
+    if (decl->let.flags & DECL_NON_MUTABLE) {
+        fail(b); // compile_assignment reports the error
+        return;
+    }
+
+    u32 value = build_expr(b, node->binary.right);
+    if (!value) return;
+
+    if (node->binary.op != Token_EQUAL) {
+        u32 current = read_variable(b, b->block, decl);
+        value = append_value(f, binary_op(node->binary.op), b->block, current, value, node->line);
+    }
+
+    u32 copy = append_value(f, IR_COPY, b->block, value, 0, node->line);
+    write_variable(f, b->block, decl, copy);
+}
+
+static void build_if(IrBuilder *b, AstNode *cf) {
+    IrFunction *f = b->f;
+    if (cf->cf.else_branch) {
+        fail(b);
+        return;
+    }
+
+    u32 condition = build_expr(b, cf->cf.condition);
+    if (!condition) return;
+
+    u32 then_block = new_block(f);
+    u32 merge = new_block(f);
+    branch(b, condition, then_block, merge, cf->line);
+    seal_block(b, then_block);
+
+    b->block = then_block;
+    build_block(b, cf->cf.block);
+    if (b->block) jump(b, merge, cf->line);
+
+    seal_block(b, merge);
+    b->block = merge;
+}
+
+static void build_loop(IrBuilder *b, AstNode *cf) {
+    IrFunction *f = b->f;
+
+    u32 condition = build_expr(b, cf->cf.condition);
+    if (!condition) return;
+
+    u32 preheader = new_block(f);
+    u32 exit = new_block(f);
+    branch(b, condition, preheader, exit, cf->line);
+    seal_block(b, preheader);
+
+    u32 header = new_block(f);
+    b->block = preheader;
+    jump(b, header, cf->line);
+
+    u32 latch = new_block(f);
+
+    u32 saved_break = b->break_target;
+    u32 saved_continue = b->continue_target;
+    b->break_target = exit;
+    b->continue_target = latch;
+
+    b->block = header;
+    build_block(b, cf->cf.block);
+    if (b->block) jump(b, latch, cf->line);
+
+    b->break_target = saved_break;
+    b->continue_target = saved_continue;
+
+    seal_block(b, latch);
+
+    if (f->blocks.data[latch].preds.length > 0) {
+        b->block = latch;
+        u32 again = build_expr(b, cf->cf.condition);
+        if (!again) return;
+        branch(b, again, header, exit, cf->line);
+    }
+
+    seal_block(b, header);
+    seal_block(b, exit);
+
+    f->blocks.data[header].loop_preheader = preheader;
+    f->blocks.data[header].loop_end = f->blocks.length-1;
+
+    b->block = exit;
+}
+
+static bool is_param(IrFunction *f, AstNode *node) {
+    if (!f->lambda) return false;
+    Ast params = f->lambda->lambda.args->expression_list.expressions;
+    for (u64 i = 0; i < params.length; i++) {
+        if (params.data[i] == node) return true;
+    }
+    return false;
+}
+
+static void build_statement(IrBuilder *b, AstNode *stmt) {
+    IrFunction *f = b->f;
+
+    switch (stmt->tag) {
+    case NODE_LET: {
+        // The parser appends a function's parameters to its block, they aren't statements.
+        if (is_param(f, stmt)) return;
+
+        u32 value;
+        if (stmt->let.expr) {
+            value = build_expr(b, stmt->let.expr);
+            if (!value) return;
+        } else {
+            value = new_const(f, (Object){.tag = OBJECT_NULL});
+        }
+
+        array_add(b->known, stmt);
+        u32 copy = append_value(f, IR_COPY, b->block, value, 0, stmt->line);
+        write_variable(f, b->block, stmt, copy);
+    } break;
+
+    case NODE_BINARY: {
+        if (stmt->binary.op > Token_ASSIGNMENTS_START && stmt->binary.op < Token_ASSIGNMENTS_END) {
+            build_assignment(b, stmt);
+        } else {
+            fail(b);
+        }
+    } break;
+
+    case NODE_CALL: {
+        build_call(b, stmt);
+    } break;
+
+    case NODE_RETURN: {
+        if (!f->lambda) {
+            fail(b);
+            return;
+        }
+        u32 value = 0;
+        if (stmt->ret.value) {
+            value = build_expr(b, stmt->ret.value);
+            if (!value) return;
+        }
+        IrBlock *block = (f->blocks.data + b->block);
+        block->term = IR_TERM_RETURN;
+        block->term_value = value;
+        block->term_line = stmt->line;
+        b->block = 0;
+    } break;
+
+    case NODE_CONTROL_FLOW_IF: {
+        build_if(b, stmt);
+    } break;
+
+    case NODE_CONTROL_FLOW_LOOP: {
+        build_loop(b, stmt);
+    } break;
+
+    case NODE_BREAK_OR_CONTINUE: {
+        u32 target = (stmt->break_cont.which == Token_CONTINUE ? b->continue_target : b->break_target);
+        if (!target) {
+            fail(b);
+            return;
+        }
+        jump(b, target, stmt->line);
+    } break;
+
+    case NODE_BLOCK: {
+        build_block(b, stmt);
+    } break;
+
+    default: {
+        fail(b);
+    } break;
+    }
+}
+
+static void build_block(IrBuilder *b, AstNode *block) {
+    if (!block->block.statements.data) return;
+
+    u64 known_before = b->known.length;
+    push_block(&b->ast_blocks, block);
+
+    for (u64 i = 0; i < block->block.statements.length; i++) {
+        // Anything after a return, break or continue is unreachable.
+        if (b->f->failed || !b->block) break;
+        build_statement(b, block->block.statements.data[i]);
+    }
+
+    pop_block(&b->ast_blocks);
+    b->known.length = known_before;
+}
+
+static void init_function(IrFunction *f, IrBuilder *b, Interp *interp) {
+    *f = (IrFunction){0};
+    array_init(f->values, IrValue);
+    array_init(f->blocks, IrBlock);
+    array_init(f->order, u32);
+
+    // Index 0 is reserved for "no value"/"no block". Block 0 holds the constants, which belong to no block.
+    new_value(f, IR_NONE, 0, 0);
+    new_block(f);
+    f->blocks.data[0].sealed = true;
+
+    *b = (IrBuilder){0};
+    b->f = f;
+    b->interp = interp;
+    init_blocks(&b->ast_blocks);
+    array_init(b->known, AstNode *);
+
+    b->block = new_block(f);
+    seal_block(b, b->block);
+}
+
+bool ir_build_function(IrFunction *f, Interp *interp, AstNode *lambda) {
+    IrBuilder b;
+    init_function(f, &b, interp);
+    f->name = lambda->lambda.name;
+    f->lambda = lambda;
+
+    Ast params = lambda->lambda.args->expression_list.expressions;
+    f->num_params = params.length;
+    for (u64 i = 0; i < params.length; i++) {
+        u32 v = append_value(f, IR_PARAM, b.block, 0, 0, lambda->line);
+        f->values.data[v].extra = i;
+        write_variable(f, b.block, params.data[i], v);
+        array_add(b.known, params.data[i]);
+    }
+
+    build_block(&b, lambda->lambda.block);
+
+    // Falling off the end returns undefined, like POP_SCOPE_RETURN 0.
+    if (!f->failed && b.block) {
+        IrBlock *block = (f->blocks.data + b.block);
+        block->term = IR_TERM_RETURN;
+        block->term_value = 0;
+    }
+
+    array_free(b.known);
+    return !f->failed;
+}
+
+bool ir_build_program(IrFunction *f, Interp *interp, Ast ast) {
+    IrBuilder b;
+    init_function(f, &b, interp);
+
+    for (u64 i = 0; i < ast.length; i++) {
+        AstNode *node = ast.data[i];
+        if (!node) break;
+        if (node->tag == NODE_LAMBDA) continue;
+        if (f->failed || !b.block) break;
+        build_statement(&b, node);
+    }
+
+    if (!f->failed && b.block) {
+        f->blocks.data[b.block].term = IR_TERM_HALT;
+    }
+
+    array_free(b.known);
+    return !f->failed;
+}
+
+void ir_free(IrFunction *f) {
+    for (u64 i = 0; i < f->values.length; i++) {
+        IrValue *v = (f->values.data + i);
+        if (v->op == IR_PHI || v->op == IR_CALL || v->op == IR_PRINT || v->op == IR_NEW_MAP || v->op == IR_MAP) {
+            array_free(v->list);
+        }
+    }
+    for (u64 i = 0; i < f->blocks.length; i++) {
+        IrBlock *b = (f->blocks.data + i);
+        array_free(b->values);
+        array_free(b->preds);
+        array_free(b->succs);
+        array_free(b->defs);
+        array_free(b->incomplete_phis);
+    }
+    array_free(f->values);
+    array_free(f->blocks);
+    array_free(f->order);
+}
+
+//
+// Dominators, using the iterative algorithm from Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm".
+//
+static void postorder(IrFunction *f, u32 block, bool *visited, IrList *out) {
+    visited[block] = true;
+    IrList succs = f->blocks.data[block].succs;
+    for (u64 i = 0; i < succs.length; i++) {
+        if (!visited[succs.data[i]]) postorder(f, succs.data[i], visited, out);
+    }
+    array_add(*out, block);
+}
+
+void ir_compute_dominators(IrFunction *f) {
+    u64 num_blocks = f->blocks.length;
+    bool *visited = calloc(num_blocks, sizeof(bool));
+    u32  *order   = calloc(num_blocks, sizeof(u32)); // postorder number of each block
+
+    IrList post;
+    array_init(post, u32);
+    postorder(f, 1, visited, &post);
+
+    for (u64 i = 0; i < num_blocks; i++) {
+        f->blocks.data[i].idom = 0;
+        f->blocks.data[i].reachable = visited[i];
+    }
+    f->order.length = 0;
+    for (u64 i = 0; i < post.length; i++) {
+        order[post.data[i]] = i;
+        array_add(f->order, post.data[post.length-1-i]);
+    }
+
+    f->blocks.data[1].idom = 1;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        // Reverse postorder, skipping the entry.
+        for (u64 i = post.length-1; i > 0; i--) {
+            u32 block = post.data[i-1];
+            IrList preds = f->blocks.data[block].preds;
+
+            u32 idom = 0;
+            for (u64 j = 0; j < preds.length; j++) {
+                u32 pred = preds.data[j];
+                if (!f->blocks.data[pred].idom) continue;
+                if (!idom) {
+                    idom = pred;
+                    continue;
+                }
+
+                u32 a = pred, b = idom;
+                while (a != b) {
+                    while (order[a] < order[b]) a = f->blocks.data[a].idom;
+                    while (order[b] < order[a]) b = f->blocks.data[b].idom;
+                }
+                idom = a;
+            }
+
+            if (f->blocks.data[block].idom != idom) {
+                f->blocks.data[block].idom = idom;
+                changed = true;
+            }
+        }
+    }
+
+    array_free(post);
+    free(order);
+    free(visited);
+}
+
+// Whether block `a` dominates block `b`. Block 0, which holds the constants, dominates everything.
+bool ir_dominates(IrFunction *f, u32 a, u32 b) {
+    if (a == 0) return true;
+    while (true) {
+        if (a == b) return true;
+        u32 idom = f->blocks.data[b].idom;
+        if (idom == b || idom == 0) return false;
+        b = idom;
+    }
+}
+
+//
+// Dumping
+//
+static const char *ir_op_strings[] = {
+    "none",
+    "const",
+    "param",
+    "phi",
+    "copy",
+    "add",
+    "sub",
+    "mul",
+    "div",
+    "neg",
+    "equals",
+    "less_than",
+    "less_than_equals",
+    "greater_than",
+    "greater_than_equals",
+    "len",
+    "append",
+    "builtin",
+    "subscript",
+    "new_array",
+    "new_map",
+    "map",
+    "call",
+    "print",
+};
+
+static const char *ir_type_strings[] = {
+    "?",
+    "int",
+    "float",
+    "string",
+    "bool",
+    "null",
+    "array",
+    "map",
+    "undefined",
+    "none",
+};
+
+static void dump_constant(Object o) {
+    switch (o.tag) {
+    case OBJECT_INTEGER:   printf("%ld", o.integer); break;
+    case OBJECT_FLOATING:  printf("%f", o.floating); break;
+    case OBJECT_STRING:    printf("\"%.*s\"", (int)o.string.length, object_string_data(&o)); break;
+    case OBJECT_BOOLEAN:   printf("%s", (o.boolean ? "true" : "false")); break;
+    case OBJECT_NULL:      printf("null"); break;
+    case OBJECT_UNDEFINED: printf("undefined"); break;
+    case OBJECT_ARRAY:     printf("[%ld elements]", o.array->length); break;
+    default:               printf("?"); break;
+    }
+}
+
+static void dump_value(IrFunction *f, u32 id) {
+    IrValue *v = (f->values.data + id);
+    printf("    v%u = %s", id, ir_op_strings[v->op]);
+
+    switch (v->op) {
+    case IR_CONST:
+    case IR_NEW_ARRAY: printf(" "); dump_constant(v->constant); break;
+    case IR_PARAM: printf(" %ld", v->extra); break;
+
+    case IR_PHI: {
+        IrList preds = f->blocks.data[v->block].preds;
+        for (u64 i = 0; i < v->list.length; i++) {
+            printf("%s[b%u: v%u]", (i ? ", " : " "), (i < preds.length ? preds.data[i] : 0), ir_resolve(f, v->list.data[i]));
+        }
+    } break;
+
+    case IR_CALL:
+    case IR_PRINT:
+    case IR_NEW_MAP:
+    case IR_MAP: {
+        if (v->op == IR_CALL) printf(" %s", ((AstNode *)v->extra)->lambda.name);
+        if (v->op == IR_MAP) printf(" %s", instruction_strings[v->extra]);
+        for (u64 i = 0; i < v->list.length; i++) {
+            printf("%sv%u", (i ? ", " : " "), ir_resolve(f, v->list.data[i]));
+        }
+    } break;
+
+    case IR_COPY:
+    case IR_NEG:
+    case IR_LEN: {
+        printf(" v%u", ir_resolve(f, v->a));
+    } break;
+
+    case IR_BUILTIN: {
+        printf(" %s v%u", instruction_strings[v->extra], ir_resolve(f, v->a));
+        if (v->b) printf(", v%u", ir_resolve(f, v->b));
+    } break;
+
+    default: {
+        printf(" v%u, v%u", ir_resolve(f, v->a), ir_resolve(f, v->b));
+    } break;
+    }
+
+    printf(" : %s\n", ir_type_strings[v->type]);
+}
+
+void ir_dump(IrFunction *f) {
+    if (f->name) {
+        printf("function %s(%u params):\n", f->name, f->num_params);
+    } else {
+        printf("program:\n");
+    }
+
+    for (u64 i = 0; i < f->blocks.data[0].values.length; i++) {
+        u32 id = f->blocks.data[0].values.data[i];
+        if (!f->values.data[id].dead) dump_value(f, id);
+    }
+
+    for (u64 b = 1; b < f->blocks.length; b++) {
+        IrBlock *block = (f->blocks.data + b);
+        if (block->term == IR_TERM_NONE && block->preds.length == 0 && b != 1) continue;
+
+        printf("  b%lu:", b);
+        if (block->preds.length) {
+            printf(" ; preds");
+            for (u64 i = 0; i < block->preds.length; i++) printf(" b%u", block->preds.data[i]);
+        }
+        if (block->loop_preheader) printf(" ; loop header, preheader b%u", block->loop_preheader);
+        printf("\n");
+
+        for (u64 i = 0; i < block->values.length; i++) {
+            u32 id = block->values.data[i];
+            if (!f->values.data[id].dead) dump_value(f, id);
+        }
+
+        switch (block->term) {
+        case IR_TERM_JUMP:   printf("    jump b%u\n", block->succs.data[0]); break;
+        case IR_TERM_BRANCH: printf("    branch v%u, b%u, b%u\n", ir_resolve(f, block->term_value), block->succs.data[0], block->succs.data[1]); break;
+        case IR_TERM_HALT:   printf("    halt\n"); break;
+        case IR_TERM_RETURN: {
+            if (block->term_value) printf("    return v%u\n", ir_resolve(f, block->term_value));
+            else printf("    return\n");
+        } break;
+        default: printf("    <no terminator>\n"); break;
+        }
+    }
+    printf("\n");
+}
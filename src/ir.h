@@ -0,0 +1,157 @@
+#ifndef IR_h
+#define IR_h
+
+#include "context.h"
+#include "common.h"
+#include "array.h"
+#include "ast.h"
+
+// A mid-level SSA representation which sits between the AST and the bytecode when compiling with -O.
+// Each function (and the top-level program) is lowered into basic blocks of values, optimised by
+// the passes in `ir_optimize`, and then lowered again into instructions.
+
+typedef enum IrOp {
+    IR_NONE,
+
+    IR_CONST,
+    IR_PARAM,
+    IR_PHI,
+    IR_COPY,
+
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_NEG,
+
+    IR_EQUALS,
+    IR_LESS_THAN,
+    IR_LESS_THAN_EQUALS,
+    IR_GREATER_THAN,
+    IR_GREATER_THAN_EQUALS,
+
+    IR_LEN,
+    IR_APPEND,
+    IR_BUILTIN,           // a numeric array builtin, see array_builtin
+    IR_SUBSCRIPT,
+    IR_NEW_ARRAY,
+    IR_NEW_MAP,           // a map literal, its list is the keys and values in turn
+    IR_MAP,               // a map builtin, its list is the map, the key and (for MAP_SET) the value
+    IR_CALL,
+    IR_PRINT,
+} IrOp;
+
+typedef enum IrType {
+    IR_TYPE_UNKNOWN,
+    IR_TYPE_INTEGER,
+    IR_TYPE_FLOATING,
+    IR_TYPE_STRING,
+    IR_TYPE_BOOLEAN,
+    IR_TYPE_NULL,
+    IR_TYPE_ARRAY,
+    IR_TYPE_MAP,
+    IR_TYPE_UNDEFINED,
+
+    IR_TYPE_NONE,         // not known yet, only used while inferring types
+} IrType;
+
+typedef enum IrTerminator {
+    IR_TERM_NONE,
+    IR_TERM_JUMP,
+    IR_TERM_BRANCH,
+    IR_TERM_RETURN,
+    IR_TERM_HALT,
+} IrTerminator;
+
+typedef Array(u32) IrList;
+
+// Values are referred to by their index in IrFunction.values. Index 0 is never a valid value.
+typedef struct IrValue {
+    IrOp   op;
+    IrType type;
+    u32    block;
+    u32    a, b;          // operands of unary and binary values
+    IrList list;          // operands of phis (one per predecessor, in order), calls, prints and maps
+    Object constant;      // IR_CONST, and the literal IR_NEW_ARRAY copies
+    s64    extra;         // IR_PARAM: parameter number, IR_CALL: the callee's AstNode, IR_BUILTIN and IR_MAP: its Op
+    u64    line;
+    u32    replaced_by;   // forwarding pointer left behind when a value is replaced
+    bool   dead;
+
+    u64    slot;          // assigned during lowering
+} IrValue;
+
+typedef struct IrVariableDef {
+    AstNode *decl;
+    u32 value;
+} IrVariableDef;
+
+typedef struct IrBlock {
+    IrList values;        // in order, phis first
+    IrList preds;
+    IrList succs;
+
+    IrTerminator term;
+    u32 term_value;       // the condition of a branch, or the returned value (0 for none)
+    u64 term_line;
+
+    Array(IrVariableDef) defs;
+    Array(IrVariableDef) incomplete_phis;
+    bool sealed;
+    bool reachable;
+
+    u32 idom;             // immediate dominator, computed by `ir_compute_dominators`
+    u32 loop_preheader;   // set on loop headers: the block which enters the loop
+    u32 loop_end;         // set on loop headers: the last block created for the loop
+    u64 start;            // first instruction, assigned during lowering
+} IrBlock;
+
+typedef struct IrFunction {
+    char    *name;        // NULL for the top-level program
+    AstNode *lambda;
+    Array(IrValue) values;
+    Array(IrBlock) blocks;
+    IrList order;         // reachable blocks in reverse postorder, computed by `ir_compute_dominators`
+    u32 num_params;
+    bool failed;          // set while building if the AST uses something the IR can't express
+} IrFunction;
+
+typedef struct IrPass {
+    const char *name;
+    bool (*run)(IrFunction *f, Interp *interp);
+} IrPass;
+
+// The passes are run in order, over and over, until none of them change anything or this many rounds have run.
+#define IR_MAX_ROUNDS 8
+
+bool ir_build_function(IrFunction *f, Interp *interp, AstNode *lambda);
+bool ir_build_program(IrFunction *f, Interp *interp, Ast ast);
+void ir_optimize(IrFunction *f, Interp *interp);
+void ir_lower(IrFunction *f, Interp *interp);
+void ir_dump(IrFunction *f);
+void ir_free(IrFunction *f);
+
+u32  ir_resolve(IrFunction *f, u32 value);
+u64  ir_operands(IrValue *v, u32 **out, u32 *scratch);
+void ir_remove_pred(IrFunction *f, u32 block, u32 pred);
+void ir_compute_dominators(IrFunction *f);
+bool ir_dominates(IrFunction *f, u32 a, u32 b);
+
+// Compiles a function or the top-level program through the IR.
+// Returns false, having emitted nothing, if the IR can't represent it.
+bool compile_func_optimized(Interp *interp, AstNode *lambda);
+bool compile_program_optimized(Interp *interp, Ast ast);
+
+// Provided by bytecode.c.
+void instr(Interp *interp, Op op, s32 arg, u64 line_number);
+u64  push_frame(Interp *interp);
+void pop_frame(Interp *interp);
+u64  reserve_constant(Interp *interp);
+u64  add_constant(Interp *interp, Object o);
+Object constant_string(Interp *interp, char *text);
+AstNode *find_lambda(Interp *interp, char *name);
+Op   array_builtin(Interp *interp, char *name, u32 *num_args);
+Op   map_builtin(Interp *interp, char *name, u32 *num_args);
+AstNode *inlinable_body(AstNode *lambda);
+
+#endif
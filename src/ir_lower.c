@@ -0,0 +1,442 @@
+// Lowering of the SSA IR into bytecode.
+// Every value gets its own slot in the frame's constant pool, and phis become copies on the edges into their block.
+#include "ir.h"
+#include "context.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+typedef struct IrFixup {
+    u64 at;      // the jump instruction
+    u32 block;   // the block it jumps to
+} IrFixup;
+
+typedef struct Lowering {
+    IrFunction *f;
+    Interp     *interp;
+    Array(IrFixup) fixups;
+    u32        *uses;
+} Lowering;
+
+static bool is_live(IrFunction *f, u32 id) {
+    IrValue *v = (f->values.data + id);
+    return (!v->dead && (v->block == 0 || f->blocks.data[v->block].reachable));
+}
+
+static u64 slot(IrFunction *f, u32 id) {
+    return f->values.data[ir_resolve(f, id)].slot;
+}
+
+static u64 constant_slot(Interp *interp, Object o) {
+    switch (o.tag) {
+    case OBJECT_UNDEFINED: return UNDEFINED_OBJECT_INDEX;
+    case OBJECT_NULL:      return NULL_OBJECT_INDEX;
+    case OBJECT_BOOLEAN:   return (o.boolean ? TRUE_OBJECT_INDEX : FALSE_OBJECT_INDEX);
+    }
+    return add_constant(interp, o);
+}
+
+static void assign_slots(Lowering *l) {
+    IrFunction *f = l->f;
+    for (u64 id = 1; id < f->values.length; id++) {
+        if (!is_live(f, id)) continue;
+        IrValue *v = (f->values.data + id);
+        if (v->op == IR_CONST) {
+            v->slot = constant_slot(l->interp, v->constant);
+        } else if (v->op != IR_PRINT && v->op != IR_APPEND) {
+            v->slot = reserve_constant(l->interp);
+        }
+    }
+}
+
+static void count_uses(Lowering *l) {
+    IrFunction *f = l->f;
+    l->uses = calloc(f->values.length, sizeof(u32));
+    for (u64 id = 1; id < f->values.length; id++) {
+        if (!is_live(f, id)) continue;
+        u32 scratch[2];
+        u32 *operands;
+        u64 count = ir_operands(f->values.data + id, &operands, scratch);
+        for (u64 i = 0; i < count; i++) l->uses[ir_resolve(f, operands[i])]++;
+    }
+    for (u64 b = 1; b < f->blocks.length; b++) {
+        IrBlock *block = (f->blocks.data + b);
+        if (block->reachable && block->term_value) l->uses[ir_resolve(f, block->term_value)]++;
+    }
+}
+
+static void jump_to(Lowering *l, Op op, u32 block, u64 line) {
+    IrFixup fixup = (IrFixup){.at = l->interp->instructions.length, .block = block};
+    array_add(l->fixups, fixup);
+    instr(l->interp, op, 0, line);
+}
+
+static Op binary_instruction(IrFunction *f, IrValue *v) {
+    IrType a = f->values.data[ir_resolve(f, v->a)].type;
+    IrType b = f->values.data[ir_resolve(f, v->b)].type;
+    bool ints   = (a == IR_TYPE_INTEGER && b == IR_TYPE_INTEGER);
+    bool floats = (a == IR_TYPE_FLOATING && b == IR_TYPE_FLOATING);
+
+    switch (v->op) {
+    case IR_ADD:                 return (ints ? ADD_INT : floats ? ADD_FLOAT : ADD);
+    case IR_LESS_THAN:           return (ints ? LESS_THAN_INT : floats ? LESS_THAN_FLOAT : LESS_THAN);
+    case IR_EQUALS:              return (ints ? EQUALS_INT : floats ? EQUALS_FLOAT : EQUALS);
+    case IR_SUB:                 return SUB;
+    case IR_MUL:                 return MUL;
+    case IR_DIV:                 return DIV;
+    case IR_LESS_THAN_EQUALS:    return LESS_THAN_EQUALS;
+    case IR_GREATER_THAN:        return GREATER_THAN;
+    case IR_GREATER_THAN_EQUALS: return GREATER_THAN_EQUALS;
+    }
+    assert(false);
+    return HALT;
+}
+
+// `tail` is set for a call whose result is immediately returned.
+static void lower_value(Lowering *l, u32 id, bool tail) {
+    IrFunction *f = l->f;
+    Interp *interp = l->interp;
+    IrValue *v = (f->values.data + id);
+    u64 line = v->line;
+
+    switch (v->op) {
+    case IR_CONST:
+    case IR_PHI: {
+        // Constants live in the pool and phis are written by their predecessors.
+    } break;
+
+    case IR_PARAM: {
+        instr(interp, STORE_ARG_OR_RETVAL, v->slot, line);
+    } break;
+
+    case IR_COPY: {
+        instr(interp, LOAD, slot(f, v->a), line);
+        instr(interp, STORE, v->slot, line);
+    } break;
+
+    case IR_NEG: {
+        instr(interp, LOAD, slot(f, v->a), line);
+        instr(interp, NEG, 0, line);
+        instr(interp, STORE, v->slot, line);
+    } break;
+
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_EQUALS:
+    case IR_LESS_THAN:
+    case IR_LESS_THAN_EQUALS:
+    case IR_GREATER_THAN:
+    case IR_GREATER_THAN_EQUALS: {
+        instr(interp, LOAD, slot(f, v->a), line);
+        instr(interp, LOAD, slot(f, v->b), line);
+        instr(interp, binary_instruction(f, v), 0, line);
+        instr(interp, STORE, v->slot, line);
+    } break;
+
+    case IR_LEN: {
+        instr(interp, LEN, slot(f, v->a), line);
+        instr(interp, STORE_ARG_OR_RETVAL, v->slot, line);
+    } break;
+
+    case IR_APPEND: {
+        instr(interp, LOAD_ARG, slot(f, v->b), line);
+        instr(interp, APPEND_IN_PLACE, slot(f, v->a), line);
+    } break;
+
+    case IR_BUILTIN: {
+        if (v->b) instr(interp, LOAD_ARG, slot(f, v->b), line);
+        instr(interp, (Op)v->extra, slot(f, v->a), line);
+        instr(interp, STORE_ARG_OR_RETVAL, v->slot, line);
+    } break;
+
+    case IR_NEW_ARRAY: {
+        instr(interp, NEW_ARRAY, add_constant(interp, v->constant), line);
+        instr(interp, STORE, v->slot, line);
+    } break;
+
+    // Like compile_map_literal, the first MAP_LITERAL_MAX_PAIRS keys and values go to NEW_MAP and the rest are set after.
+    case IR_NEW_MAP: {
+        u64 count = v->list.length / 2;
+        if (count > MAP_LITERAL_MAX_PAIRS) count = MAP_LITERAL_MAX_PAIRS;
+        for (u64 j = 0; j < 2*count; j++) instr(interp, LOAD, slot(f, v->list.data[j]), line);
+        instr(interp, NEW_MAP, count, line);
+        instr(interp, STORE, v->slot, line);
+
+        for (u64 j = 2*count; j < v->list.length; j += 2) {
+            instr(interp, LOAD_ARG, slot(f, v->list.data[j+1]), line);
+            instr(interp, LOAD_ARG, slot(f, v->list.data[j]), line);
+            instr(interp, MAP_SET, v->slot, line);
+            instr(interp, STORE_ARG_OR_RETVAL, reserve_constant(interp), line);
+        }
+    } break;
+
+    case IR_MAP: {
+        for (u64 j = v->list.length-1; j > 0; j--) instr(interp, LOAD_ARG, slot(f, v->list.data[j]), line);
+        instr(interp, (Op)v->extra, slot(f, v->list.data[0]), line);
+        instr(interp, STORE_ARG_OR_RETVAL, v->slot, line);
+    } break;
+
+    case IR_SUBSCRIPT: {
+        instr(interp, LOAD, slot(f, v->b), line);
+        instr(interp, ARRAY_SUBSCRIPT, slot(f, v->a), line);
+        instr(interp, LOAD, ARRAY_SUBSCRIPT_RESULT_INDEX, line);
+        instr(interp, STORE, v->slot, line);
+    } break;
+
+    case IR_PRINT: {
+        for (u64 j = v->list.length; j > 0; j--) {
+            instr(interp, LOAD_ARG, slot(f, v->list.data[j-1]), line);
+        }
+        instr(interp, PRINT, v->list.length, line);
+    } break;
+
+    case IR_CALL: {
+        AstLambda callee = ((AstNode *)v->extra)->lambda;
+        for (u64 j = v->list.length; j > 0; j--) {
+            instr(interp, LOAD_ARG, slot(f, v->list.data[j-1]), line);
+        }
+
+        if (tail) {
+            instr(interp, TAIL_CALL, callee.constant_pool_index, line);
+            return;
+        }
+
+        if (callee.memo_table >= 0) {
+            instr(interp, MEMO_LOOKUP, callee.memo_table, line);
+            instr(interp, LOAD_PC, 0, line);
+            instr(interp, CALL_FUNC, callee.constant_pool_index, line);
+            instr(interp, MEMO_STORE, callee.memo_table, line);
+        } else {
+            instr(interp, LOAD_PC, 0, line);
+            instr(interp, CALL_FUNC, callee.constant_pool_index, line);
+        }
+        instr(interp, STORE_ARG_OR_RETVAL, v->slot, line);
+    } break;
+
+    default: {
+        assert(false);
+    } break;
+    }
+}
+
+static u64 pred_index(IrFunction *f, u32 from, u32 to) {
+    IrList preds = f->blocks.data[to].preds;
+    for (u64 k = 0; k < preds.length; k++) {
+        if (preds.data[k] == from) return k;
+    }
+    assert(false);
+    return 0;
+}
+
+static bool has_edge_copies(IrFunction *f, u32 from, u32 to) {
+    u64 k = pred_index(f, from, to);
+    IrList values = f->blocks.data[to].values;
+    for (u64 i = 0; i < values.length; i++) {
+        IrValue *phi = (f->values.data + values.data[i]);
+        if (phi->op != IR_PHI) break;
+        if (!phi->dead && slot(f, phi->list.data[k]) != phi->slot) return true;
+    }
+    return false;
+}
+
+// Writes the phis of `to` with the values coming from `from`. The phis are all assigned at once,
+// so every value is loaded before any of them are stored.
+static void emit_edge_copies(Lowering *l, u32 from, u32 to, u64 line) {
+    IrFunction *f = l->f;
+    Interp *interp = l->interp;
+    u64 k = pred_index(f, from, to);
+
+    IrList copies;
+    array_init(copies, u32);
+
+    IrList values = f->blocks.data[to].values;
+    for (u64 i = 0; i < values.length; i++) {
+        IrValue *phi = (f->values.data + values.data[i]);
+        if (phi->op != IR_PHI) break;
+        if (!phi->dead && slot(f, phi->list.data[k]) != phi->slot) array_add(copies, values.data[i]);
+    }
+
+    if (copies.length <= CONTEXT_STACK_SIZE/2) {
+        for (u64 i = 0; i < copies.length; i++) {
+            instr(interp, LOAD, slot(f, f->values.data[copies.data[i]].list.data[k]), line);
+        }
+        for (u64 i = copies.length; i > 0; i--) {
+            instr(interp, STORE, f->values.data[copies.data[i-1]].slot, line);
+        }
+    } else {
+        // Too many to fit on the stack, go through temporaries instead.
+        u64 first_temp = interp->scope->constant_pool.length;
+        for (u64 i = 0; i < copies.length; i++) {
+            u64 temp = reserve_constant(interp);
+            instr(interp, LOAD, slot(f, f->values.data[copies.data[i]].list.data[k]), line);
+            instr(interp, STORE, temp, line);
+        }
+        for (u64 i = 0; i < copies.length; i++) {
+            instr(interp, LOAD, first_temp+i, line);
+            instr(interp, STORE, f->values.data[copies.data[i]].slot, line);
+        }
+    }
+
+    array_free(copies);
+}
+
+// The call whose result `block` returns, if it can be made a tail call.
+static u32 tail_call_in(Lowering *l, u32 b) {
+    IrFunction *f = l->f;
+    IrBlock *block = (f->blocks.data + b);
+    if (!f->lambda || block->term != IR_TERM_RETURN || !block->term_value) return 0;
+
+    u32 value = ir_resolve(f, block->term_value);
+    IrValue *v = (f->values.data + value);
+    if (v->op != IR_CALL || v->block != b || l->uses[value] != 1) return 0;
+
+    // It has to be the last thing in the block.
+    for (u64 i = block->values.length; i > 0; i--) {
+        u32 id = block->values.data[i-1];
+        if (id == value) return value;
+        if (!f->values.data[id].dead && f->values.data[id].op != IR_CONST) return 0;
+    }
+    return 0;
+}
+
+void ir_lower(IrFunction *f, Interp *interp) {
+    Lowering l = (Lowering){0};
+    l.f = f;
+    l.interp = interp;
+    array_init(l.fixups, IrFixup);
+
+    ir_compute_dominators(f);
+    assign_slots(&l);
+    count_uses(&l);
+
+    for (u64 b = 1; b < f->blocks.length; b++) {
+        IrBlock *block = (f->blocks.data + b);
+        if (!block->reachable) continue;
+
+        u32 next = b+1;
+        while (next < f->blocks.length && !f->blocks.data[next].reachable) next++;
+
+        block->start = interp->instructions.length;
+
+        u32 tail_call = tail_call_in(&l, b);
+        for (u64 i = 0; i < block->values.length; i++) {
+            u32 id = block->values.data[i];
+            if (f->values.data[id].dead) continue;
+            lower_value(&l, id, (id == tail_call));
+        }
+
+        block = (f->blocks.data + b);
+        u64 line = block->term_line;
+
+        switch (block->term) {
+        case IR_TERM_JUMP: {
+            u32 to = block->succs.data[0];
+            emit_edge_copies(&l, b, to, line);
+            if (to != next) jump_to(&l, JUMP, to, line);
+        } break;
+
+        case IR_TERM_BRANCH: {
+            u32 if_true  = block->succs.data[0];
+            u32 if_false = block->succs.data[1];
+
+            // When not taken, JUMP_FALSE skips the instruction after it.
+            instr(interp, LOAD, slot(f, block->term_value), line);
+
+            if (has_edge_copies(f, b, if_false)) {
+                u64 jump_false = interp->instructions.length;
+                instr(interp, JUMP_FALSE, 0, line);
+                instr(interp, NOP, 0, line);
+
+                emit_edge_copies(&l, b, if_true, line);
+                jump_to(&l, JUMP, if_true, line);
+
+                interp->instructions.data[jump_false].arg = interp->instructions.length-1;
+                emit_edge_copies(&l, b, if_false, line);
+                if (if_false != next) jump_to(&l, JUMP, if_false, line);
+            } else {
+                jump_to(&l, JUMP_FALSE, if_false, line);
+                instr(interp, NOP, 0, line);
+
+                emit_edge_copies(&l, b, if_true, line);
+                if (if_true != next) jump_to(&l, JUMP, if_true, line);
+            }
+        } break;
+
+        case IR_TERM_RETURN: {
+            if (tail_call) break;
+            instr(interp, POP_SCOPE_RETURN, (block->term_value ? slot(f, block->term_value) : 0), line);
+        } break;
+
+        case IR_TERM_HALT: {
+            instr(interp, HALT, 0, line);
+        } break;
+
+        default: {
+            assert(false);
+        } break;
+        }
+    }
+
+    // Jumps continue from the instruction after their argument.
+    for (u64 i = 0; i < l.fixups.length; i++) {
+        IrFixup fixup = l.fixups.data[i];
+        interp->instructions.data[fixup.at].arg = f->blocks.data[fixup.block].start-1;
+    }
+
+    array_free(l.fixups);
+    free(l.uses);
+}
+
+static void optimize(IrFunction *f, Interp *interp) {
+    bool dump = (interp->flags & COMPILE_DUMP_IR);
+    if (dump) {
+        printf("; before optimisation\n");
+        ir_dump(f);
+    }
+    ir_optimize(f, interp);
+    if (dump) {
+        printf("; after optimisation\n");
+        ir_dump(f);
+    }
+}
+
+bool compile_func_optimized(Interp *interp, AstNode *lambda) {
+    IrFunction f;
+    if (!ir_build_function(&f, interp, lambda)) {
+        ir_free(&f);
+        return false;
+    }
+    optimize(&f, interp);
+
+    // The same prologue and epilogue as compile_func.
+    u64 lambda_index = lambda->lambda.constant_pool_index;
+    assert(lambda_index != 0);
+    instr(interp, BEGIN_BLOCK, lambda_index, lambda->line);
+
+    u64 scope_index = push_frame(interp);
+    instr(interp, LOAD_SCOPE, scope_index, lambda->line);
+    ir_lower(&f, interp);
+    pop_frame(interp);
+
+    instr(interp, END_BLOCK, lambda_index, 0);
+
+    ir_free(&f);
+    return true;
+}
+
+bool compile_program_optimized(Interp *interp, Ast ast) {
+    IrFunction f;
+    if (!ir_build_program(&f, interp, ast)) {
+        ir_free(&f);
+        return false;
+    }
+    optimize(&f, interp);
+    ir_lower(&f, interp);
+
+    ir_free(&f);
+    return true;
+}
@@ -0,0 +1,663 @@
+// The optimisation passes over the SSA IR, and the pass manager which runs them.
+// Each pass returns true if it changed anything.
+#include "ir.h"
+#include "context.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static bool is_live(IrFunction *f, u32 id) {
+    IrValue *v = (f->values.data + id);
+    return (!v->dead && (v->block == 0 || f->blocks.data[v->block].reachable));
+}
+
+static IrType type_of(IrFunction *f, u32 id) {
+    return f->values.data[ir_resolve(f, id)].type;
+}
+
+static bool is_numeric(IrType t) {
+    return (t == IR_TYPE_INTEGER || t == IR_TYPE_FLOATING);
+}
+
+static bool is_scalar(IrType t) {
+    return (t == IR_TYPE_INTEGER || t == IR_TYPE_FLOATING || t == IR_TYPE_STRING || t == IR_TYPE_BOOLEAN || t == IR_TYPE_NULL || t == IR_TYPE_UNDEFINED);
+}
+
+static IrValue *constant_operand(IrFunction *f, u32 id) {
+    IrValue *v = (f->values.data + ir_resolve(f, id));
+    return (v->op == IR_CONST ? v : NULL);
+}
+
+// Whether `v` can never raise a runtime error, judging by the types of its operands.
+static bool cannot_trap(IrFunction *f, IrValue *v) {
+    IrType a = type_of(f, v->a);
+    IrType b = (v->b ? type_of(f, v->b) : IR_TYPE_UNKNOWN);
+
+    switch (v->op) {
+    case IR_CONST:
+    case IR_PARAM:
+    case IR_PHI:
+    case IR_COPY:
+    case IR_NEW_ARRAY: return true;
+
+    case IR_SUBSCRIPT: return (a == IR_TYPE_ARRAY);
+
+    case IR_ADD:       return (a == b && (is_numeric(a) || a == IR_TYPE_STRING));
+    case IR_SUB:
+    case IR_MUL:
+    case IR_LESS_THAN:
+    case IR_LESS_THAN_EQUALS:
+    case IR_GREATER_THAN:
+    case IR_GREATER_THAN_EQUALS: return (a == b && is_numeric(a));
+    case IR_NEG:       return is_numeric(a);
+    case IR_EQUALS:    return (is_scalar(a) && is_scalar(b));
+    case IR_LEN:       return (a == IR_TYPE_ARRAY || a == IR_TYPE_STRING || a == IR_TYPE_MAP);
+    case IR_APPEND:    return (a == IR_TYPE_ARRAY);
+
+    case IR_MAP: {
+        if (type_of(f, v->list.data[0]) != IR_TYPE_MAP) return false;
+        IrType key = type_of(f, v->list.data[1]);
+        return (key == IR_TYPE_INTEGER || key == IR_TYPE_STRING);
+    } break;
+
+    case IR_NEW_MAP: {
+        for (u64 i = 0; i < v->list.length; i += 2) {
+            IrType key = type_of(f, v->list.data[i]);
+            if (key != IR_TYPE_INTEGER && key != IR_TYPE_STRING) return false;
+        }
+        return true;
+    } break;
+
+    case IR_DIV: {
+        if (a != b || !is_numeric(a)) return false;
+        if (a == IR_TYPE_FLOATING) return true;
+        IrValue *divisor = constant_operand(f, v->b);
+        return (divisor && divisor->constant.integer != 0 && divisor->constant.integer != -1);
+    } break;
+    }
+    return false;
+}
+
+//
+// Unreachable code.
+//
+static bool remove_unreachable_blocks(IrFunction *f, Interp *interp) {
+    ir_compute_dominators(f);
+
+    bool changed = false;
+    for (u64 b = 1; b < f->blocks.length; b++) {
+        IrBlock *block = (f->blocks.data + b);
+        if (block->reachable) continue;
+
+        for (u64 i = 0; i < block->succs.length; i++) {
+            ir_remove_pred(f, block->succs.data[i], b);
+            changed = true;
+        }
+        block->succs.length = 0;
+        block->preds.length = 0;
+        block->term = IR_TERM_NONE;
+        block->loop_preheader = 0;
+
+        for (u64 i = 0; i < block->values.length; i++) {
+            IrValue *v = (f->values.data + block->values.data[i]);
+            if (!v->dead) changed = true;
+            v->dead = true;
+        }
+    }
+    return changed;
+}
+
+//
+// Copy propagation, which also removes phis made trivial by the other passes.
+//
+static bool propagate_copies(IrFunction *f, Interp *interp) {
+    bool changed = false;
+    for (u64 id = 1; id < f->values.length; id++) {
+        if (!is_live(f, id)) continue;
+        IrValue *v = (f->values.data + id);
+
+        if (v->op == IR_COPY) {
+            v->replaced_by = ir_resolve(f, v->a);
+            v->dead = true;
+            changed = true;
+            continue;
+        }
+
+        if (v->op == IR_PHI) {
+            u32 same = 0;
+            bool trivial = true;
+            for (u64 i = 0; i < v->list.length; i++) {
+                u32 op = ir_resolve(f, v->list.data[i]);
+                if (op == same || op == id) continue;
+                if (same) {
+                    trivial = false;
+                    break;
+                }
+                same = op;
+            }
+            if (trivial && same) {
+                v->replaced_by = same;
+                v->dead = true;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+//
+// Type inference. Types only ever move from IR_TYPE_NONE to a concrete type to IR_TYPE_UNKNOWN, so this terminates.
+//
+static IrType constant_type(Object o) {
+    switch (o.tag) {
+    case OBJECT_INTEGER:   return IR_TYPE_INTEGER;
+    case OBJECT_FLOATING:  return IR_TYPE_FLOATING;
+    case OBJECT_STRING:    return IR_TYPE_STRING;
+    case OBJECT_BOOLEAN:   return IR_TYPE_BOOLEAN;
+    case OBJECT_NULL:      return IR_TYPE_NULL;
+    case OBJECT_ARRAY:     return IR_TYPE_ARRAY;
+    case OBJECT_UNDEFINED: return IR_TYPE_UNDEFINED;
+    }
+    return IR_TYPE_UNKNOWN;
+}
+
+static IrType infer_type(IrFunction *f, IrValue *v) {
+    switch (v->op) {
+    case IR_CONST:  return constant_type(v->constant);
+    case IR_COPY:   return type_of(f, v->a);
+    case IR_LEN:    return IR_TYPE_INTEGER;
+    case IR_BUILTIN: return ((v->extra == SCALE || v->extra == FILL) ? IR_TYPE_ARRAY : IR_TYPE_UNKNOWN);
+    case IR_APPEND:
+    case IR_NEW_ARRAY: return IR_TYPE_ARRAY;
+    case IR_NEW_MAP: return IR_TYPE_MAP;
+    case IR_PRINT:  return IR_TYPE_NULL;
+
+    case IR_MAP: {
+        if (v->extra == MAP_HAS || v->extra == MAP_DELETE) return IR_TYPE_BOOLEAN;
+        if (v->extra == MAP_SET) return type_of(f, v->list.data[0]);
+        return IR_TYPE_UNKNOWN;
+    } break;
+
+    case IR_EQUALS:
+    case IR_LESS_THAN:
+    case IR_LESS_THAN_EQUALS:
+    case IR_GREATER_THAN:
+    case IR_GREATER_THAN_EQUALS: return IR_TYPE_BOOLEAN;
+
+    case IR_NEG: {
+        IrType a = type_of(f, v->a);
+        return ((a == IR_TYPE_NONE || is_numeric(a)) ? a : IR_TYPE_UNKNOWN);
+    } break;
+
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV: {
+        IrType a = type_of(f, v->a);
+        IrType b = type_of(f, v->b);
+        if (a == IR_TYPE_NONE || b == IR_TYPE_NONE) return IR_TYPE_NONE;
+        if (a != b) return IR_TYPE_UNKNOWN;
+        if (is_numeric(a)) return a;
+        if (a == IR_TYPE_STRING && v->op == IR_ADD) return a;
+        return IR_TYPE_UNKNOWN;
+    } break;
+
+    case IR_PHI: {
+        IrType t = IR_TYPE_NONE;
+        for (u64 i = 0; i < v->list.length; i++) {
+            IrType operand = type_of(f, v->list.data[i]);
+            if (operand == IR_TYPE_NONE) continue;
+            if (t == IR_TYPE_NONE) t = operand;
+            else if (t != operand) return IR_TYPE_UNKNOWN;
+        }
+        return t;
+    } break;
+    }
+    return IR_TYPE_UNKNOWN;
+}
+
+static bool infer_types(IrFunction *f, Interp *interp) {
+    IrType *before = malloc(f->values.length * sizeof(IrType));
+    for (u64 id = 0; id < f->values.length; id++) {
+        before[id] = f->values.data[id].type;
+        f->values.data[id].type = IR_TYPE_NONE;
+    }
+
+    bool again = true;
+    while (again) {
+        again = false;
+        for (u64 id = 1; id < f->values.length; id++) {
+            if (!is_live(f, id)) continue;
+            IrValue *v = (f->values.data + id);
+            IrType t = infer_type(f, v);
+            if (t != v->type) {
+                v->type = t;
+                again = true;
+            }
+        }
+    }
+
+    bool changed = false;
+    for (u64 id = 0; id < f->values.length; id++) {
+        IrValue *v = (f->values.data + id);
+        if (v->type == IR_TYPE_NONE) v->type = IR_TYPE_UNKNOWN;
+        if (v->type != before[id]) changed = true;
+    }
+    free(before);
+    return changed;
+}
+
+//
+// Constant folding, and folding of branches on constant conditions.
+//
+static bool fold_comparison(IrOp op, f64 l, f64 r) {
+    switch (op) {
+    case IR_EQUALS:              return l == r;
+    case IR_LESS_THAN:           return l < r;
+    case IR_LESS_THAN_EQUALS:    return l <= r;
+    case IR_GREATER_THAN:        return l > r;
+    case IR_GREATER_THAN_EQUALS: return l >= r;
+    }
+    assert(false);
+    return false;
+}
+
+static bool fold_int_comparison(IrOp op, s64 l, s64 r) {
+    switch (op) {
+    case IR_EQUALS:              return l == r;
+    case IR_LESS_THAN:           return l < r;
+    case IR_LESS_THAN_EQUALS:    return l <= r;
+    case IR_GREATER_THAN:        return l > r;
+    case IR_GREATER_THAN_EQUALS: return l >= r;
+    }
+    assert(false);
+    return false;
+}
+
+// Computes `l op r` the same way the interpreter would. Returns false if it can't be done at compile time.
+static bool fold_binary(IrOp op, Object l, Object r, Object *out) {
+    *out = (Object){0};
+    if (l.tag != r.tag) return false;
+
+    bool comparison = (op >= IR_EQUALS && op <= IR_GREATER_THAN_EQUALS);
+
+    if (l.tag == OBJECT_INTEGER) {
+        // Wrap around like the interpreter does, without the undefined behaviour.
+        u64 a = (u64)l.integer, b = (u64)r.integer;
+        out->tag = OBJECT_INTEGER;
+        switch (op) {
+        case IR_ADD: out->integer = (s64)(a + b); return true;
+        case IR_SUB: out->integer = (s64)(a - b); return true;
+        case IR_MUL: out->integer = (s64)(a * b); return true;
+        case IR_DIV: {
+            if (r.integer == 0 || r.integer == -1) return false;
+            out->integer = l.integer / r.integer;
+            return true;
+        } break;
+        }
+        if (comparison) {
+            out->tag = OBJECT_BOOLEAN;
+            out->boolean = fold_int_comparison(op, l.integer, r.integer);
+            return true;
+        }
+        return false;
+    }
+
+    if (l.tag == OBJECT_FLOATING) {
+        out->tag = OBJECT_FLOATING;
+        switch (op) {
+        case IR_ADD: out->floating = l.floating + r.floating; return true;
+        case IR_SUB: out->floating = l.floating - r.floating; return true;
+        case IR_MUL: out->floating = l.floating * r.floating; return true;
+        case IR_DIV: out->floating = l.floating / r.floating; return true;
+        }
+        if (comparison) {
+            out->tag = OBJECT_BOOLEAN;
+            out->boolean = fold_comparison(op, l.floating, r.floating);
+            return true;
+        }
+        return false;
+    }
+
+    if (op != IR_EQUALS) return false;
+
+    out->tag = OBJECT_BOOLEAN;
+    switch (l.tag) {
+    case OBJECT_STRING:    out->boolean = object_string_equals(l, r); return true;
+    case OBJECT_BOOLEAN:   out->boolean = (l.boolean == r.boolean);            return true;
+    case OBJECT_NULL:
+    case OBJECT_UNDEFINED: out->boolean = true;                                return true;
+    }
+    return false;
+}
+
+static bool fold_value(IrFunction *f, IrValue *v, Object *out) {
+    IrValue *a = (v->a ? constant_operand(f, v->a) : NULL);
+    if (!a) return false;
+
+    switch (v->op) {
+    case IR_NEG: {
+        *out = a->constant;
+        if (a->constant.tag == OBJECT_INTEGER) out->integer = (s64)(0 - (u64)a->constant.integer);
+        else if (a->constant.tag == OBJECT_FLOATING) out->floating = -a->constant.floating;
+        else return false;
+        return true;
+    } break;
+
+    case IR_LEN: {
+        *out = (Object){.tag = OBJECT_INTEGER};
+        if (a->constant.tag == OBJECT_STRING) out->integer = a->constant.string.length;
+        else return false;
+        return true;
+    } break;
+
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_EQUALS:
+    case IR_LESS_THAN:
+    case IR_LESS_THAN_EQUALS:
+    case IR_GREATER_THAN:
+    case IR_GREATER_THAN_EQUALS: {
+        IrValue *b = constant_operand(f, v->b);
+        if (!b) return false;
+        return fold_binary(v->op, a->constant, b->constant, out);
+    } break;
+    }
+    return false;
+}
+
+static bool fold_constants(IrFunction *f, Interp *interp) {
+    bool changed = false;
+
+    for (u64 id = 1; id < f->values.length; id++) {
+        if (!is_live(f, id)) continue;
+        IrValue *v = (f->values.data + id);
+
+        Object result;
+        if (fold_value(f, v, &result)) {
+            v->op = IR_CONST;
+            v->constant = result;
+            v->a = v->b = 0;
+            v->type = constant_type(result);
+            changed = true;
+        }
+    }
+
+    for (u64 b = 1; b < f->blocks.length; b++) {
+        IrBlock *block = (f->blocks.data + b);
+        if (!block->reachable || block->term != IR_TERM_BRANCH) continue;
+
+        IrValue *condition = constant_operand(f, block->term_value);
+        if (!condition || condition->constant.tag != OBJECT_BOOLEAN) continue;
+
+        u32 taken     = block->succs.data[condition->constant.boolean ? 0 : 1];
+        u32 not_taken = block->succs.data[condition->constant.boolean ? 1 : 0];
+        ir_remove_pred(f, not_taken, b);
+
+        block->succs.data[0] = taken;
+        block->succs.length = 1;
+        block->term = IR_TERM_JUMP;
+        block->term_value = 0;
+        changed = true;
+    }
+
+    return changed;
+}
+
+//
+// Common subexpression elimination. A value is replaced by an identical one which dominates it.
+// Lengths are left alone (here and in loop-invariant code motion) since appending changes an array in place.
+//
+static bool is_cse_candidate(IrValue *v) {
+    switch (v->op) {
+    case IR_CONST:
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_NEG:
+    case IR_EQUALS:
+    case IR_LESS_THAN:
+    case IR_LESS_THAN_EQUALS:
+    case IR_GREATER_THAN:
+    case IR_GREATER_THAN_EQUALS:
+    case IR_SUBSCRIPT: return true;
+    }
+    return false;
+}
+
+static u64 value_hash(IrFunction *f, IrValue *v) {
+    u64 h = v->op * 31;
+    if (v->op == IR_CONST) {
+        h ^= v->constant.tag;
+        if (v->constant.tag == OBJECT_STRING) {
+            h = h * 31 + object_string_hash(&v->constant);
+        } else {
+            h = h * 31 + (u64)v->constant.integer;
+        }
+        return h;
+    }
+    h = h * 31 + ir_resolve(f, v->a);
+    h = h * 31 + (v->b ? ir_resolve(f, v->b) : 0);
+    return h;
+}
+
+static bool same_value(IrFunction *f, IrValue *a, IrValue *b) {
+    if (a->op != b->op) return false;
+    if (a->op == IR_CONST) {
+        Object x = a->constant, y = b->constant;
+        if (x.tag != y.tag) return false;
+        switch (x.tag) {
+        case OBJECT_INTEGER:  return x.integer == y.integer;
+        case OBJECT_FLOATING: return *(u64 *)&x.floating == *(u64 *)&y.floating;
+        case OBJECT_BOOLEAN:  return x.boolean == y.boolean;
+        case OBJECT_STRING:   return object_string_equals(x, y);
+        case OBJECT_NULL:
+        case OBJECT_UNDEFINED: return true;
+        }
+        return false;
+    }
+    if (ir_resolve(f, a->a) != ir_resolve(f, b->a)) return false;
+    return ((a->b ? ir_resolve(f, a->b) : 0) == (b->b ? ir_resolve(f, b->b) : 0));
+}
+
+static bool eliminate_common_subexpressions(IrFunction *f, Interp *interp) {
+    ir_compute_dominators(f);
+
+    u64 num_buckets = 64;
+    while (num_buckets < f->values.length * 2) num_buckets *= 2;
+    u32 *buckets = calloc(num_buckets, sizeof(u32));
+    u32 *next    = calloc(f->values.length, sizeof(u32));
+
+    bool changed = false;
+
+    // Visiting the constants and then the blocks in reverse postorder means dominating values are always seen first.
+    for (u64 i = 0; i <= f->order.length; i++) {
+        u32 b = (i == 0 ? 0 : f->order.data[i-1]);
+        IrList values = f->blocks.data[b].values;
+
+        for (u64 j = 0; j < values.length; j++) {
+            u32 id = values.data[j];
+            IrValue *v = (f->values.data + id);
+            if (v->dead || !is_cse_candidate(v)) continue;
+
+            u64 bucket = value_hash(f, v) & (num_buckets-1);
+            u32 found = 0;
+            for (u32 other = buckets[bucket]; other; other = next[other]) {
+                IrValue *w = (f->values.data + other);
+                if (same_value(f, v, w) && ir_dominates(f, w->block, v->block)) {
+                    found = other;
+                    break;
+                }
+            }
+
+            if (found) {
+                v->replaced_by = found;
+                v->dead = true;
+                changed = true;
+            } else {
+                next[id] = buckets[bucket];
+                buckets[bucket] = id;
+            }
+        }
+    }
+
+    free(next);
+    free(buckets);
+    return changed;
+}
+
+//
+// Loop-invariant code motion. Values in a loop whose operands are all defined outside of it are moved to the
+// loop's preheader. Since loops are rotated the preheader only runs when the loop body does, but values in a
+// conditional part of the body still run speculatively, so only values which can't raise an error are moved.
+//
+static bool is_hoistable(IrFunction *f, IrValue *v) {
+    switch (v->op) {
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_NEG:
+    case IR_EQUALS:
+    case IR_LESS_THAN:
+    case IR_LESS_THAN_EQUALS:
+    case IR_GREATER_THAN:
+    case IR_GREATER_THAN_EQUALS: return cannot_trap(f, v);
+    }
+    return false;
+}
+
+static bool defined_outside(IrFunction *f, u32 id, u32 first, u32 last) {
+    u32 block = f->values.data[ir_resolve(f, id)].block;
+    return (block < first || block > last);
+}
+
+static bool hoist_loop_invariants(IrFunction *f, Interp *interp) {
+    bool changed = false;
+
+    for (u64 header = 1; header < f->blocks.length; header++) {
+        u32 preheader = f->blocks.data[header].loop_preheader;
+        if (!preheader || !f->blocks.data[header].reachable || !f->blocks.data[preheader].reachable) continue;
+
+        // The blocks of a loop are the ones created between its header and its last block.
+        u32 last = f->blocks.data[header].loop_end;
+
+        for (u64 b = header; b <= last; b++) {
+            IrBlock *block = (f->blocks.data + b);
+            if (!block->reachable) continue;
+
+            u64 kept = 0;
+            for (u64 i = 0; i < block->values.length; i++) {
+                u32 id = block->values.data[i];
+                IrValue *v = (f->values.data + id);
+
+                bool invariant = (!v->dead && is_hoistable(f, v) && defined_outside(f, v->a, header, last));
+                if (invariant && v->b) invariant = defined_outside(f, v->b, header, last);
+
+                if (invariant) {
+                    v->block = preheader;
+                    array_add(f->blocks.data[preheader].values, id);
+                    block = (f->blocks.data + b);
+                    changed = true;
+                } else {
+                    block->values.data[kept++] = id;
+                }
+            }
+            block->values.length = kept;
+        }
+    }
+    return changed;
+}
+
+//
+// Dead code elimination. Everything is dead unless it has a side effect, might raise an error,
+// or is used by something which is live.
+//
+static bool has_side_effects(IrFunction *f, IrValue *v) {
+    switch (v->op) {
+    case IR_PRINT:
+    case IR_APPEND: return true; // the array changes in place
+    case IR_MAP:    return (v->extra == MAP_SET || v->extra == MAP_DELETE || !cannot_trap(f, v));
+    case IR_PARAM:  return true; // parameters are always popped off the call storage
+    case IR_CALL:  return !(((AstNode *)v->extra)->lambda.flags & LAMBDA_PURE);
+    }
+    return !cannot_trap(f, v);
+}
+
+static void mark_live(IrFunction *f, bool *live, IrList *worklist, u32 id) {
+    id = ir_resolve(f, id);
+    if (!id || live[id]) return;
+    live[id] = true;
+    array_add(*worklist, id);
+}
+
+static bool eliminate_dead_code(IrFunction *f, Interp *interp) {
+    bool *live = calloc(f->values.length, sizeof(bool));
+    IrList worklist;
+    array_init(worklist, u32);
+
+    for (u64 id = 1; id < f->values.length; id++) {
+        if (is_live(f, id) && has_side_effects(f, f->values.data + id)) mark_live(f, live, &worklist, id);
+    }
+    for (u64 b = 1; b < f->blocks.length; b++) {
+        IrBlock *block = (f->blocks.data + b);
+        if (block->reachable && block->term_value) mark_live(f, live, &worklist, block->term_value);
+    }
+
+    while (worklist.length) {
+        IrValue *v = (f->values.data + worklist.data[--worklist.length]);
+        u32 scratch[2];
+        u32 *operands;
+        u64 count = ir_operands(v, &operands, scratch);
+        for (u64 i = 0; i < count; i++) mark_live(f, live, &worklist, operands[i]);
+    }
+
+    bool changed = false;
+    for (u64 id = 1; id < f->values.length; id++) {
+        if (is_live(f, id) && !live[id]) {
+            f->values.data[id].dead = true;
+            changed = true;
+        }
+    }
+
+    array_free(worklist);
+    free(live);
+    return changed;
+}
+
+static IrPass passes[] = {
+    {"unreachable-blocks", remove_unreachable_blocks},
+    {"copy-propagation",   propagate_copies},
+    {"type-inference",     infer_types},
+    {"constant-folding",   fold_constants},
+    {"cse",                eliminate_common_subexpressions},
+    {"licm",               hoist_loop_invariants},
+    {"dce",                eliminate_dead_code},
+};
+
+void ir_optimize(IrFunction *f, Interp *interp) {
+    bool dump = (interp->flags & COMPILE_DUMP_IR);
+    u64 num_passes = sizeof(passes)/sizeof(passes[0]);
+
+    for (int round = 0; round < IR_MAX_ROUNDS; round++) {
+        bool changed = false;
+        for (u64 i = 0; i < num_passes; i++) {
+            if (!passes[i].run(f, interp)) continue;
+            changed = true;
+            if (dump) {
+                printf("; after %s (round %d)\n", passes[i].name, round+1);
+                ir_dump(f);
+            }
+        }
+        if (!changed) break;
+    }
+
+    // The lowering relies on these being up to date.
+    remove_unreachable_blocks(f, interp);
+    infer_types(f, interp);
+}
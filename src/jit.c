@@ -0,0 +1,1488 @@
+#define _DEFAULT_SOURCE
+#include "jit.h"
+#include "context.h"
+#include "common.h"
+#include "array.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+
+#if defined(__linux__) && defined(__x86_64__)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+//
+// x86-64 encoding.
+//
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+enum {
+    XMM0, XMM1,
+};
+
+// Condition codes, as used by jcc and setcc.
+enum {
+    CC_B  = 0x2,
+    CC_AE = 0x3,
+    CC_E  = 0x4,
+    CC_NE = 0x5,
+    CC_A  = 0x7,
+    CC_NP = 0xB,
+    CC_L  = 0xC,
+    CC_GE = 0xD,
+    CC_LE = 0xE,
+    CC_G  = 0xF,
+};
+
+// Two-operand ALU instructions with the destination in r/m.
+enum {
+    ALU_ADD = 0x01,
+    ALU_SUB = 0x29,
+    ALU_XOR = 0x31,
+    ALU_CMP = 0x39,
+};
+
+// SSE2 scalar double instructions, all prefixed with F2 0F.
+enum {
+    SSE_LOAD  = 0x10,
+    SSE_STORE = 0x11,
+    SSE_ADD   = 0x58,
+    SSE_MUL   = 0x59,
+    SSE_SUB   = 0x5C,
+    SSE_DIV   = 0x5E,
+};
+
+typedef enum FixupKind {
+    FIXUP_LABEL, // jump to the code of an instruction in the region, or leave if it's outside
+    FIXUP_EXIT,  // leave native code and resume interpreting at the pc
+} FixupKind;
+
+typedef struct Fixup {
+    u64 at;        // offset of the rel32 to patch
+    u64 pc;
+    FixupKind kind;
+} Fixup;
+
+typedef struct Emitter {
+    Array(u8) code;
+    Array(Fixup) fixups;
+    u64 *labels;   // code offset of each instruction in the region
+    u64 first, last;
+    u64 epilogue;
+} Emitter;
+
+#define NO_LABEL ((u64)-1)
+
+// Offsets into the runtime's structures, used as displacements.
+#define OBJ_SIZE   ((s32)sizeof(Object))
+#define OBJ_TAG    ((s32)offsetof(Object, tag))
+#define OBJ_INT    ((s32)offsetof(Object, integer))
+#define OBJ_BOOL   ((s32)offsetof(Object, boolean))
+#define OBJ_ARRAY  ((s32)offsetof(Object, array))
+#define ARRAY_DATA   ((s32)offsetof(ObjectArray, data))
+#define ARRAY_LENGTH ((s32)offsetof(ObjectArray, length))
+#define ARRAY_KIND   ((s32)offsetof(ObjectArray, kind))
+#define STACK_DATA ((s32)offsetof(Stack, data))
+#define STACK_TOP  ((s32)offsetof(Stack, top))
+
+static void emit_byte(Emitter *e, u8 b) {
+    array_add(e->code, b);
+}
+
+static void emit_u32(Emitter *e, u32 v) {
+    for (int i = 0; i < 4; i++) emit_byte(e, (v >> (i * 8)) & 0xFF);
+}
+
+static void emit_u64(Emitter *e, u64 v) {
+    for (int i = 0; i < 8; i++) emit_byte(e, (v >> (i * 8)) & 0xFF);
+}
+
+static void emit_rex(Emitter *e, bool wide, int reg, int base) {
+    u8 rex = 0x40 | (wide << 3) | (((reg >> 3) & 1) << 2) | ((base >> 3) & 1);
+    if (rex != 0x40) emit_byte(e, rex);
+}
+
+// ModRM for [base + disp32], with the SIB byte rsp and r12 need.
+static void emit_mem(Emitter *e, int reg, int base, s32 disp) {
+    emit_byte(e, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) emit_byte(e, 0x24);
+    emit_u32(e, (u32)disp);
+}
+
+static void emit_modrm_rr(Emitter *e, int reg, int rm) {
+    emit_byte(e, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// mov reg, [base + disp]
+static void mov_load(Emitter *e, int reg, int base, s32 disp) {
+    emit_rex(e, true, reg, base);
+    emit_byte(e, 0x8B);
+    emit_mem(e, reg, base, disp);
+}
+
+// mov [base + disp], reg
+static void mov_store(Emitter *e, int base, s32 disp, int reg) {
+    emit_rex(e, true, reg, base);
+    emit_byte(e, 0x89);
+    emit_mem(e, reg, base, disp);
+}
+
+static void mov_rr(Emitter *e, int dst, int src) {
+    emit_rex(e, true, src, dst);
+    emit_byte(e, 0x89);
+    emit_modrm_rr(e, src, dst);
+}
+
+static void mov_imm64(Emitter *e, int reg, u64 imm) {
+    emit_rex(e, true, 0, reg);
+    emit_byte(e, 0xB8 + (reg & 7));
+    emit_u64(e, imm);
+}
+
+static void alu_rr(Emitter *e, u8 op, int dst, int src) {
+    emit_rex(e, true, src, dst);
+    emit_byte(e, op);
+    emit_modrm_rr(e, src, dst);
+}
+
+// add/sub/cmp reg, imm32 (sign extended). `ext` is the ModRM reg field selecting the operation.
+static void alu_imm(Emitter *e, int ext, int reg, s32 imm) {
+    emit_rex(e, true, 0, reg);
+    emit_byte(e, 0x81);
+    emit_modrm_rr(e, ext, reg);
+    emit_u32(e, (u32)imm);
+}
+#define add_imm(e, reg, imm) alu_imm(e, 0, reg, imm)
+#define sub_imm(e, reg, imm) alu_imm(e, 5, reg, imm)
+#define cmp_imm(e, reg, imm) alu_imm(e, 7, reg, imm)
+
+// add/sub qword [base + disp], imm32
+static void alu_mem_imm(Emitter *e, int ext, int base, s32 disp, s32 imm) {
+    emit_rex(e, true, 0, base);
+    emit_byte(e, 0x81);
+    emit_mem(e, ext, base, disp);
+    emit_u32(e, (u32)imm);
+}
+
+// cmp dword [base + disp], imm32
+static void cmp_mem32_imm(Emitter *e, int base, s32 disp, u32 imm) {
+    emit_rex(e, false, 0, base);
+    emit_byte(e, 0x81);
+    emit_mem(e, 7, base, disp);
+    emit_u32(e, imm);
+}
+
+// cmp byte [base + disp], imm8
+static void cmp_mem8_imm(Emitter *e, int base, s32 disp, u8 imm) {
+    emit_rex(e, false, 0, base);
+    emit_byte(e, 0x80);
+    emit_mem(e, 7, base, disp);
+    emit_byte(e, imm);
+}
+
+// mov dword [base + disp], imm32
+static void mov_mem32_imm(Emitter *e, int base, s32 disp, u32 imm) {
+    emit_rex(e, false, 0, base);
+    emit_byte(e, 0xC7);
+    emit_mem(e, 0, base, disp);
+    emit_u32(e, imm);
+}
+
+// mov qword [base + disp], imm32 (sign extended)
+static void mov_mem64_imm(Emitter *e, int base, s32 disp, s32 imm) {
+    emit_rex(e, true, 0, base);
+    emit_byte(e, 0xC7);
+    emit_mem(e, 0, base, disp);
+    emit_u32(e, (u32)imm);
+}
+
+// mov byte [base + disp], imm8
+static void mov_mem8_imm(Emitter *e, int base, s32 disp, u8 imm) {
+    emit_rex(e, false, 0, base);
+    emit_byte(e, 0xC6);
+    emit_mem(e, 0, base, disp);
+    emit_byte(e, imm);
+}
+
+// setcc byte [base + disp]
+static void setcc_mem(Emitter *e, u8 cc, int base, s32 disp) {
+    emit_rex(e, false, 0, base);
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0x90 | cc);
+    emit_mem(e, 0, base, disp);
+}
+
+static void imul_rr(Emitter *e, int dst, int src) {
+    emit_rex(e, true, dst, src);
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0xAF);
+    emit_modrm_rr(e, dst, src);
+}
+
+// imul dst, src, imm32
+static void imul_imm(Emitter *e, int dst, int src, s32 imm) {
+    emit_rex(e, true, dst, src);
+    emit_byte(e, 0x69);
+    emit_modrm_rr(e, dst, src);
+    emit_u32(e, (u32)imm);
+}
+
+static void neg_r(Emitter *e, int reg) {
+    emit_rex(e, true, 0, reg);
+    emit_byte(e, 0xF7);
+    emit_modrm_rr(e, 3, reg);
+}
+
+// cqo; idiv reg
+static void idiv_r(Emitter *e, int reg) {
+    emit_byte(e, 0x48);
+    emit_byte(e, 0x99);
+    emit_rex(e, true, 0, reg);
+    emit_byte(e, 0xF7);
+    emit_modrm_rr(e, 7, reg);
+}
+
+static void sse_mem(Emitter *e, u8 op, int xmm, int base, s32 disp) {
+    emit_byte(e, 0xF2);
+    emit_rex(e, false, xmm, base);
+    emit_byte(e, 0x0F);
+    emit_byte(e, op);
+    emit_mem(e, xmm, base, disp);
+}
+
+static void sse_rr(Emitter *e, u8 op, int dst, int src) {
+    emit_byte(e, 0xF2);
+    emit_byte(e, 0x0F);
+    emit_byte(e, op);
+    emit_modrm_rr(e, dst, src);
+}
+
+static void ucomisd(Emitter *e, int a, int b) {
+    emit_byte(e, 0x66);
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0x2E);
+    emit_modrm_rr(e, a, b);
+}
+
+// setcc al
+static void setcc_al(Emitter *e, u8 cc) {
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0x90 | cc);
+    emit_byte(e, 0xC0);
+}
+
+// setnp cl
+static void setnp_cl(Emitter *e) {
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0x90 | CC_NP);
+    emit_byte(e, 0xC1);
+}
+
+// and al, cl
+static void and_al_cl(Emitter *e) {
+    emit_byte(e, 0x20);
+    emit_byte(e, 0xC8);
+}
+
+// movzx eax, al
+static void movzx_eax_al(Emitter *e) {
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0xB6);
+    emit_byte(e, 0xC0);
+}
+
+// movzx reg, byte [base + disp]
+static void movzx_load8(Emitter *e, int reg, int base, s32 disp) {
+    emit_rex(e, true, reg, base);
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0xB6);
+    emit_mem(e, reg, base, disp);
+}
+
+// movq xmm, rax
+static void movq_xmm_rax(Emitter *e, int xmm) {
+    emit_byte(e, 0x66);
+    emit_byte(e, 0x48);
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0x6E);
+    emit_modrm_rr(e, xmm, RAX);
+}
+
+static void xorpd(Emitter *e, int dst, int src) {
+    emit_byte(e, 0x66);
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0x57);
+    emit_modrm_rr(e, dst, src);
+}
+
+static void push_r(Emitter *e, int reg) {
+    emit_rex(e, false, 0, reg);
+    emit_byte(e, 0x50 + (reg & 7));
+}
+
+static void pop_r(Emitter *e, int reg) {
+    emit_rex(e, false, 0, reg);
+    emit_byte(e, 0x58 + (reg & 7));
+}
+
+static void jmp_r(Emitter *e, int reg) {
+    emit_rex(e, false, 0, reg);
+    emit_byte(e, 0xFF);
+    emit_modrm_rr(e, 4, reg);
+}
+
+// Emits a jump with an empty rel32 and returns the offset of the rel32.
+static u64 jmp_rel(Emitter *e) {
+    emit_byte(e, 0xE9);
+    emit_u32(e, 0);
+    return e->code.length - 4;
+}
+
+static u64 jcc_rel(Emitter *e, u8 cc) {
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0x80 | cc);
+    emit_u32(e, 0);
+    return e->code.length - 4;
+}
+
+static void patch(Emitter *e, u64 at, u64 target) {
+    s32 rel = (s32)((s64)target - (s64)(at + 4));
+    memcpy(e->code.data + at, &rel, 4);
+}
+
+static void add_fixup(Emitter *e, u64 at, u64 pc, FixupKind kind) {
+    Fixup f = (Fixup){.at = at, .pc = pc, .kind = kind};
+    array_add(e->fixups, f);
+}
+
+// Conditionally leaves native code, with the interpreter running instruction `pc` itself.
+static void bail_if(Emitter *e, u8 cc, u64 pc) {
+    add_fixup(e, jcc_rel(e, cc), pc, FIXUP_EXIT);
+}
+
+static void exit_to(Emitter *e, u64 pc) {
+    add_fixup(e, jmp_rel(e), pc, FIXUP_EXIT);
+}
+
+static void jump_to(Emitter *e, u64 pc) {
+    add_fixup(e, jmp_rel(e), pc, FIXUP_LABEL);
+}
+
+static void jump_to_if(Emitter *e, u8 cc, u64 pc) {
+    add_fixup(e, jcc_rel(e, cc), pc, FIXUP_LABEL);
+}
+
+//
+// Templates.
+//
+// Register use inside a region:
+//   rbx  the current frame's constant pool
+//   r12  the current frame's value stack
+//   r14  interp->call_storage
+//   rax, rcx, rdx, rsi, rdi, xmm0, xmm1 are scratch. rax holds the pc to resume at when leaving.
+//
+
+static void copy_object(Emitter *e, int dst, s32 dst_disp, int src, s32 src_disp) {
+    for (s32 off = 0; off < OBJ_SIZE; off += 8) {
+        mov_load(e, RCX, src, src_disp + off);
+        mov_store(e, dst, dst_disp + off, RCX);
+    }
+}
+
+static void zero_object(Emitter *e, int base, s32 disp) {
+    for (s32 off = 0; off < OBJ_SIZE; off += 8) {
+        mov_mem64_imm(e, base, disp + off, 0);
+    }
+}
+
+// rax = the address of stack->data[top] minus STACK_DATA, bailing unless at least `needed` values are on it.
+static void stack_top_address(Emitter *e, int stack, u64 needed, u64 pc) {
+    mov_load(e, RAX, stack, STACK_TOP);
+    cmp_imm(e, RAX, (s32)needed);
+    bail_if(e, CC_B, pc);
+    imul_imm(e, RAX, RAX, OBJ_SIZE);
+    alu_rr(e, ALU_ADD, RAX, stack);
+}
+
+static void emit_push_constant(Emitter *e, int stack, s32 index, u64 pc) {
+    mov_load(e, RAX, stack, STACK_TOP);
+    cmp_imm(e, RAX, CONTEXT_STACK_SIZE - 1);
+    bail_if(e, CC_AE, pc);
+    add_imm(e, RAX, 1);
+    mov_store(e, stack, STACK_TOP, RAX);
+    imul_imm(e, RAX, RAX, OBJ_SIZE);
+    alu_rr(e, ALU_ADD, RAX, stack);
+    copy_object(e, RAX, STACK_DATA, RBX, index * OBJ_SIZE);
+}
+
+static void emit_pop_constant(Emitter *e, int stack, s32 index, u64 pc) {
+    stack_top_address(e, stack, 1, pc);
+    alu_mem_imm(e, 5, stack, STACK_TOP, 1);
+    copy_object(e, RBX, index * OBJ_SIZE, RAX, STACK_DATA);
+}
+
+// Checks both operands on top of the value stack are `tag`, jumping to the returned rel32 if the right one isn't.
+// Bails if only the left one isn't.
+static u64 check_operands(Emitter *e, ObjectTag tag, u64 pc) {
+    const s32 right = STACK_DATA, left = STACK_DATA - OBJ_SIZE;
+    cmp_mem32_imm(e, RAX, right + OBJ_TAG, tag);
+    u64 other = jcc_rel(e, CC_NE);
+    cmp_mem32_imm(e, RAX, left + OBJ_TAG, tag);
+    bail_if(e, CC_NE, pc);
+    return other;
+}
+
+static void emit_arithmetic(Emitter *e, Op op, u64 pc) {
+    const s32 right = STACK_DATA, left = STACK_DATA - OBJ_SIZE;
+    stack_top_address(e, R12, 2, pc);
+
+    u64 not_int = check_operands(e, OBJECT_INTEGER, pc);
+    mov_load(e, RCX, RAX, left + OBJ_INT);
+    mov_load(e, RDX, RAX, right + OBJ_INT);
+    switch (op) {
+    case ADD: alu_rr(e, ALU_ADD, RCX, RDX); break;
+    case SUB: alu_rr(e, ALU_SUB, RCX, RDX); break;
+    case MUL: imul_rr(e, RCX, RDX); break;
+    case DIV: {
+        // Division by zero and INT64_MIN / -1 trap in hardware, so leave them to the interpreter.
+        cmp_imm(e, RDX, 0);
+        bail_if(e, CC_E, pc);
+        cmp_imm(e, RDX, -1);
+        bail_if(e, CC_E, pc);
+        mov_rr(e, RSI, RAX);
+        mov_rr(e, RAX, RCX);
+        mov_rr(e, RCX, RDX);
+        idiv_r(e, RCX);
+        mov_rr(e, RCX, RAX);
+        mov_rr(e, RAX, RSI);
+    } break;
+    default: assert(false);
+    }
+    zero_object(e, RAX, left);
+    mov_store(e, RAX, left + OBJ_INT, RCX);
+    mov_mem32_imm(e, RAX, left + OBJ_TAG, OBJECT_INTEGER);
+    alu_mem_imm(e, 5, R12, STACK_TOP, 1);
+    u64 done = jmp_rel(e);
+
+    patch(e, not_int, e->code.length);
+    cmp_mem32_imm(e, RAX, right + OBJ_TAG, OBJECT_FLOATING);
+    bail_if(e, CC_NE, pc);
+    cmp_mem32_imm(e, RAX, left + OBJ_TAG, OBJECT_FLOATING);
+    bail_if(e, CC_NE, pc);
+    sse_mem(e, SSE_LOAD, XMM0, RAX, left);
+    sse_mem(e, SSE_LOAD, XMM1, RAX, right);
+    switch (op) {
+    case ADD: sse_rr(e, SSE_ADD, XMM0, XMM1); break;
+    case SUB: sse_rr(e, SSE_SUB, XMM0, XMM1); break;
+    case MUL: sse_rr(e, SSE_MUL, XMM0, XMM1); break;
+    case DIV: sse_rr(e, SSE_DIV, XMM0, XMM1); break;
+    default: assert(false);
+    }
+    zero_object(e, RAX, left);
+    sse_mem(e, SSE_STORE, XMM0, RAX, left);
+    mov_mem32_imm(e, RAX, left + OBJ_TAG, OBJECT_FLOATING);
+    alu_mem_imm(e, 5, R12, STACK_TOP, 1);
+
+    patch(e, done, e->code.length);
+}
+
+static void emit_comparison(Emitter *e, Op op, u64 pc) {
+    const s32 right = STACK_DATA, left = STACK_DATA - OBJ_SIZE;
+    stack_top_address(e, R12, 2, pc);
+
+    u8 int_cc = 0;
+    switch (op) {
+    case EQUALS:              int_cc = CC_E;  break;
+    case LESS_THAN:           int_cc = CC_L;  break;
+    case LESS_THAN_EQUALS:    int_cc = CC_LE; break;
+    case GREATER_THAN:        int_cc = CC_G;  break;
+    case GREATER_THAN_EQUALS: int_cc = CC_GE; break;
+    default: assert(false);
+    }
+
+    u64 not_int = check_operands(e, OBJECT_INTEGER, pc);
+    mov_load(e, RCX, RAX, left + OBJ_INT);
+    mov_load(e, RDX, RAX, right + OBJ_INT);
+    alu_rr(e, ALU_CMP, RCX, RDX);
+    zero_object(e, RAX, left);
+    setcc_mem(e, int_cc, RAX, left + OBJ_BOOL);
+    mov_mem32_imm(e, RAX, left + OBJ_TAG, OBJECT_BOOLEAN);
+    alu_mem_imm(e, 5, R12, STACK_TOP, 1);
+    u64 done = jmp_rel(e);
+
+    // Unordered comparisons set CF, ZF and PF, so each test is arranged to come out false for NaN.
+    patch(e, not_int, e->code.length);
+    cmp_mem32_imm(e, RAX, right + OBJ_TAG, OBJECT_FLOATING);
+    bail_if(e, CC_NE, pc);
+    cmp_mem32_imm(e, RAX, left + OBJ_TAG, OBJECT_FLOATING);
+    bail_if(e, CC_NE, pc);
+    sse_mem(e, SSE_LOAD, XMM0, RAX, left);
+    sse_mem(e, SSE_LOAD, XMM1, RAX, right);
+    u8 float_cc = 0;
+    switch (op) {
+    case EQUALS:              ucomisd(e, XMM0, XMM1); float_cc = CC_E;  break;
+    case LESS_THAN:           ucomisd(e, XMM1, XMM0); float_cc = CC_A;  break;
+    case LESS_THAN_EQUALS:    ucomisd(e, XMM1, XMM0); float_cc = CC_AE; break;
+    case GREATER_THAN:        ucomisd(e, XMM0, XMM1); float_cc = CC_A;  break;
+    case GREATER_THAN_EQUALS: ucomisd(e, XMM0, XMM1); float_cc = CC_AE; break;
+    default: assert(false);
+    }
+    zero_object(e, RAX, left);
+    setcc_mem(e, float_cc, RAX, left + OBJ_BOOL);
+    if (op == EQUALS) {
+        u64 ordered = jcc_rel(e, CC_NP);
+        mov_mem8_imm(e, RAX, left + OBJ_BOOL, 0);
+        patch(e, ordered, e->code.length);
+    }
+    mov_mem32_imm(e, RAX, left + OBJ_TAG, OBJECT_BOOLEAN);
+    alu_mem_imm(e, 5, R12, STACK_TOP, 1);
+
+    patch(e, done, e->code.length);
+}
+
+static void emit_negate(Emitter *e, u64 pc) {
+    stack_top_address(e, R12, 1, pc);
+    cmp_mem32_imm(e, RAX, STACK_DATA + OBJ_TAG, OBJECT_INTEGER);
+    u64 not_int = jcc_rel(e, CC_NE);
+    mov_load(e, RCX, RAX, STACK_DATA + OBJ_INT);
+    neg_r(e, RCX);
+    zero_object(e, RAX, STACK_DATA);
+    mov_store(e, RAX, STACK_DATA + OBJ_INT, RCX);
+    mov_mem32_imm(e, RAX, STACK_DATA + OBJ_TAG, OBJECT_INTEGER);
+    u64 done = jmp_rel(e);
+
+    // Flipping the sign bit is what the compiler does for -x.
+    patch(e, not_int, e->code.length);
+    cmp_mem32_imm(e, RAX, STACK_DATA + OBJ_TAG, OBJECT_FLOATING);
+    bail_if(e, CC_NE, pc);
+    mov_load(e, RCX, RAX, STACK_DATA + OBJ_INT);
+    mov_imm64(e, RDX, 0x8000000000000000ull);
+    alu_rr(e, ALU_XOR, RCX, RDX);
+    zero_object(e, RAX, STACK_DATA);
+    mov_store(e, RAX, STACK_DATA + OBJ_INT, RCX);
+    mov_mem32_imm(e, RAX, STACK_DATA + OBJ_TAG, OBJECT_FLOATING);
+
+    patch(e, done, e->code.length);
+}
+
+static void emit_branch(Emitter *e, bool when, s32 target, u64 pc) {
+    stack_top_address(e, R12, 1, pc);
+    cmp_mem32_imm(e, RAX, STACK_DATA + OBJ_TAG, OBJECT_BOOLEAN);
+    bail_if(e, CC_NE, pc);
+    alu_mem_imm(e, 5, R12, STACK_TOP, 1);
+    cmp_mem8_imm(e, RAX, STACK_DATA + OBJ_BOOL, when ? 1 : 0);
+    jump_to_if(e, CC_E, target + 1);
+    jump_to(e, pc + 2);
+}
+
+static void emit_subscript(Emitter *e, s32 index, u64 pc) {
+    const s32 array = index * OBJ_SIZE;
+    stack_top_address(e, R12, 1, pc);
+    cmp_mem32_imm(e, RAX, STACK_DATA + OBJ_TAG, OBJECT_INTEGER);
+    bail_if(e, CC_NE, pc);
+    cmp_mem32_imm(e, RBX, array + OBJ_TAG, OBJECT_ARRAY);
+    bail_if(e, CC_NE, pc);
+    mov_load(e, RCX, RAX, STACK_DATA + OBJ_INT);
+    mov_load(e, RDI, RBX, array + OBJ_ARRAY);
+    mov_load(e, RDX, RDI, ARRAY_LENGTH);
+    alu_rr(e, ALU_CMP, RCX, RDX);
+    bail_if(e, CC_AE, pc);
+    alu_mem_imm(e, 5, R12, STACK_TOP, 1);
+    mov_load(e, RSI, RDI, ARRAY_DATA);
+
+    // Unboxed elements are 8 bytes, given the tag their array's kind implies.
+    const s32 result = ARRAY_SUBSCRIPT_RESULT_INDEX * OBJ_SIZE;
+    cmp_mem32_imm(e, RDI, ARRAY_KIND, ARRAY_OBJECTS);
+    u64 boxed = jcc_rel(e, CC_E);
+    zero_object(e, RBX, result);
+    mov_mem32_imm(e, RBX, result + OBJ_TAG, OBJECT_INTEGER);
+    cmp_mem32_imm(e, RDI, ARRAY_KIND, ARRAY_INTEGERS);
+    u64 integers = jcc_rel(e, CC_E);
+    mov_mem32_imm(e, RBX, result + OBJ_TAG, OBJECT_FLOATING);
+    patch(e, integers, e->code.length);
+    imul_imm(e, RCX, RCX, 8);
+    alu_rr(e, ALU_ADD, RSI, RCX);
+    mov_load(e, RCX, RSI, 0);
+    mov_store(e, RBX, result + OBJ_INT, RCX);
+    u64 done = jmp_rel(e);
+
+    patch(e, boxed, e->code.length);
+    imul_imm(e, RCX, RCX, OBJ_SIZE);
+    alu_rr(e, ALU_ADD, RSI, RCX);
+    copy_object(e, RBX, result, RSI, 0);
+    patch(e, done, e->code.length);
+}
+
+// Emits the template for one instruction. Returns false if it has none, having emitted an exit instead.
+static bool emit_instruction(Emitter *e, Instruction instr, u64 pc) {
+    switch (instr.op) {
+    case NOP:
+    case END_BLOCK: {
+    } break;
+
+    case LOAD: {
+        emit_push_constant(e, R12, instr.arg, pc);
+    } break;
+
+    case LOAD_ARG: {
+        emit_push_constant(e, R14, instr.arg, pc);
+    } break;
+
+    case STORE: {
+        emit_pop_constant(e, R12, instr.arg, pc);
+    } break;
+
+    case STORE_ARG_OR_RETVAL: {
+        emit_pop_constant(e, R14, instr.arg, pc);
+    } break;
+
+    case JUMP: {
+        jump_to(e, instr.arg + 1);
+    } break;
+
+    case JUMP_TRUE: {
+        emit_branch(e, true, instr.arg, pc);
+    } break;
+
+    case JUMP_FALSE: {
+        emit_branch(e, false, instr.arg, pc);
+    } break;
+
+    case ADD:
+    case ADD_INT:
+    case ADD_FLOAT: {
+        emit_arithmetic(e, ADD, pc);
+    } break;
+
+    case SUB:
+    case MUL:
+    case DIV: {
+        emit_arithmetic(e, instr.op, pc);
+    } break;
+
+    case NEG: {
+        emit_negate(e, pc);
+    } break;
+
+    case LESS_THAN:
+    case LESS_THAN_INT:
+    case LESS_THAN_FLOAT: {
+        emit_comparison(e, LESS_THAN, pc);
+    } break;
+
+    case EQUALS:
+    case EQUALS_INT:
+    case EQUALS_FLOAT: {
+        emit_comparison(e, EQUALS, pc);
+    } break;
+
+    case LESS_THAN_EQUALS:
+    case GREATER_THAN:
+    case GREATER_THAN_EQUALS: {
+        emit_comparison(e, instr.op, pc);
+    } break;
+
+    case ARRAY_SUBSCRIPT: {
+        emit_subscript(e, instr.arg, pc);
+    } break;
+
+    default: {
+        exit_to(e, pc);
+        return false;
+    } break;
+    }
+    return true;
+}
+
+// BEGIN_BLOCK also starts the bodies of ifs and loops, which are entered by branching past it.
+static bool is_function(Interp *interp, s32 block) {
+    Jit *jit = interp->jit;
+    return block >= 0 && (u64)block < jit->num_lambdas && jit->lambdas[block];
+}
+
+// Returns the END_BLOCK closing the function whose body starts at `start`.
+static u64 find_end_block(Interp *interp, u64 start, s32 lambda) {
+    u64 pc = start;
+    while (pc < interp->instructions.length - 1) {
+        Instruction instr = interp->instructions.data[pc];
+        if (instr.op == END_BLOCK && instr.arg == lambda) break;
+        pc++;
+    }
+    return pc;
+}
+
+typedef u64 (*JitFunction)(Interp *interp, StackFrame *scope, void *target);
+
+// Native code returns the pc to continue at, with this bit set if the instruction there was not run because a
+// guard failed. The interpreter has to run that instruction itself rather than going straight back into native code.
+#define JIT_BAILED (1ull << 63)
+
+// Leaves native code with the pc in rax.
+static void emit_exit_stub(Emitter *e, u64 pc, bool bailed) {
+    mov_imm64(e, RAX, pc | (bailed ? JIT_BAILED : 0));
+    patch(e, jmp_rel(e), e->epilogue);
+}
+
+// Saves the registers the generated code pins, and points them at the frame and interp it was called with.
+// Then jumps to `target` if `indirect`, otherwise falls through.
+static void emit_prologue(Emitter *e, bool indirect) {
+    push_r(e, RBX);
+    push_r(e, R12);
+    push_r(e, R14);
+    mov_load(e, RBX, RSI, offsetof(StackFrame, constant_pool) + offsetof(Constants, data));
+    mov_rr(e, R12, RSI);
+    add_imm(e, R12, offsetof(StackFrame, stack));
+    mov_rr(e, R14, RDI);
+    add_imm(e, R14, offsetof(Interp, call_storage));
+    if (indirect) jmp_r(e, RDX);
+}
+
+static void emit_epilogue(Emitter *e) {
+    pop_r(e, R14);
+    pop_r(e, R12);
+    pop_r(e, RBX);
+    emit_byte(e, 0xC3);
+}
+
+// Copies the code into executable memory. Returns NULL if it couldn't be mapped.
+static u8 *install_code(Interp *interp, Emitter *e, u64 first, u64 last) {
+    Jit *jit = interp->jit;
+    u64 page = (u64)sysconf(_SC_PAGESIZE);
+    u64 size = (e->code.length + page - 1) & ~(page - 1);
+    u8 *code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) return NULL;
+
+    memcpy(code, e->code.data, e->code.length);
+    if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, size);
+        return NULL;
+    }
+
+    JitRegion region = (JitRegion){.code = code, .size = size, .first = first, .last = last};
+    array_add(jit->regions, region);
+    jit->code_bytes += e->code.length;
+    return code;
+}
+
+// Translates instructions [first, last] into a new region.
+static void jit_compile(Interp *interp, u64 first, u64 last) {
+    Jit *jit = interp->jit;
+    Emitter e;
+    array_init(e.code, u8);
+    array_init(e.fixups, Fixup);
+    e.labels = malloc(sizeof(u64) * (last - first + 1));
+    e.first  = first;
+    e.last   = last;
+
+    emit_prologue(&e, true);
+    e.epilogue = e.code.length;
+    emit_epilogue(&e);
+
+    bool *has_entry = malloc(sizeof(bool) * (last - first + 1));
+    for (u64 pc = first; pc <= last; pc++) {
+        Instruction instr = interp->instructions.data[pc];
+        e.labels[pc - first] = e.code.length;
+
+        // Loops with a trace are left to the interpreter to enter.
+        if (jit->traces[pc]) {
+            e.labels[pc - first] = NO_LABEL;
+            has_entry[pc - first] = false;
+            add_fixup(&e, jmp_rel(&e), pc, FIXUP_LABEL);
+            continue;
+        }
+
+        has_entry[pc - first] = emit_instruction(&e, instr, pc);
+
+        // BEGIN_BLOCK skips over the function it starts, which is compiled separately when it gets hot.
+        if (instr.op == BEGIN_BLOCK && is_function(interp, instr.arg)) {
+            u64 end = find_end_block(interp, pc + 1, instr.arg);
+            for (pc++; pc <= end && pc <= last; pc++) {
+                e.labels[pc - first] = NO_LABEL;
+                has_entry[pc - first] = false;
+            }
+            pc--;
+        }
+    }
+    jump_to(&e, last + 1);
+
+    // Jumps to instructions in the region go straight to them, everything else leaves through a stub.
+    for (u64 i = 0; i < e.fixups.length; i++) {
+        Fixup f = e.fixups.data[i];
+        if (f.kind == FIXUP_LABEL && f.pc >= first && f.pc <= last && e.labels[f.pc - first] != NO_LABEL) {
+            patch(&e, f.at, e.labels[f.pc - first]);
+            continue;
+        }
+        patch(&e, f.at, e.code.length);
+        emit_exit_stub(&e, f.pc, f.kind == FIXUP_EXIT);
+    }
+
+    u8 *code = install_code(interp, &e, first, last);
+    if (code) {
+        for (u64 pc = first; pc <= last; pc++) {
+            if (!has_entry[pc - first]) continue;
+            jit->entries[pc] = code + e.labels[pc - first];
+            jit->enter[pc]   = code;
+        }
+    }
+
+    free(has_entry);
+    free(e.labels);
+    array_free(e.code);
+    array_free(e.fixups);
+}
+
+//
+// Traces.
+//
+// A trace is the path one iteration of a hot loop took, recorded by the interpreter. It's compiled as straight-line
+// code specialised for the tags seen while recording: each constant slot's tag is checked once when it's first
+// loaded, and everything computed from it after that is known. Values on the stack are kept in registers, or
+// refer to the slot they were loaded from, and are only written to the real stack if the trace exits. Guards
+// which fail, and branches which go the other way than they did while recording, leave the trace.
+//
+
+#define TRACE_MAX_DEPTH 16
+
+typedef enum TraceValueKind {
+    VALUE_SLOT, // the value in a constant slot, which hasn't been stored to since it was loaded
+    VALUE_REG,  // an integer or boolean in a general purpose register
+    VALUE_XMM,  // a float in an SSE register
+} TraceValueKind;
+
+typedef struct TraceValue {
+    TraceValueKind kind;
+    ObjectTag tag;
+    s32 slot;
+    int reg;
+} TraceValue;
+
+typedef struct TraceExit {
+    u64  at;       // the rel32 of the guard
+    u64  pc;
+    bool bailed;
+    u32  depth;
+    TraceValue stack[TRACE_MAX_DEPTH];
+} TraceExit;
+
+typedef struct TraceCompiler {
+    Emitter e;
+    Array(TraceExit) exits;
+    TraceValue stack[TRACE_MAX_DEPTH];
+    u32 depth;
+    bool *known;      // per constant slot, whether its tag has been checked or set in this iteration
+    ObjectTag *tags;
+    u64 num_slots;
+} TraceCompiler;
+
+static const int value_regs[] = {RSI, RDI, R8, R9, R10, R11};
+static const int value_xmms[] = {2, 3, 4, 5, 6, 7};
+
+static bool reg_in_use(TraceCompiler *t, TraceValueKind kind, int reg) {
+    for (u32 i = 0; i < t->depth; i++) {
+        if (t->stack[i].kind == kind && t->stack[i].reg == reg) return true;
+    }
+    return false;
+}
+
+// Returns a free register for a value of `kind`, or -1 if they're all holding values.
+static int alloc_reg(TraceCompiler *t, TraceValueKind kind) {
+    const int *regs = (kind == VALUE_XMM ? value_xmms : value_regs);
+    for (int i = 0; i < 6; i++) {
+        if (!reg_in_use(t, kind, regs[i])) return regs[i];
+    }
+    return -1;
+}
+
+// Leaves the trace if `cc` holds, writing the values on the virtual stack to the real one first.
+static void trace_exit_if(TraceCompiler *t, u8 cc, u64 pc, bool bailed) {
+    TraceExit exit = (TraceExit){.at = jcc_rel(&t->e, cc), .pc = pc, .bailed = bailed, .depth = t->depth};
+    memcpy(exit.stack, t->stack, sizeof(TraceValue) * t->depth);
+    array_add(t->exits, exit);
+}
+
+static void write_value(Emitter *e, int base, s32 disp, TraceValue v) {
+    switch (v.kind) {
+    case VALUE_SLOT: {
+        copy_object(e, base, disp, RBX, v.slot * OBJ_SIZE);
+    } break;
+    case VALUE_REG: {
+        zero_object(e, base, disp);
+        mov_store(e, base, disp + OBJ_INT, v.reg);
+        mov_mem32_imm(e, base, disp + OBJ_TAG, v.tag);
+    } break;
+    case VALUE_XMM: {
+        zero_object(e, base, disp);
+        sse_mem(e, SSE_STORE, v.reg, base, disp);
+        mov_mem32_imm(e, base, disp + OBJ_TAG, v.tag);
+    } break;
+    }
+}
+
+// Loads an integer or boolean value into `reg`.
+static void load_int(Emitter *e, TraceValue v, int reg) {
+    if (v.kind == VALUE_SLOT) {
+        if (v.tag == OBJECT_BOOLEAN) movzx_load8(e, reg, RBX, v.slot * OBJ_SIZE + OBJ_BOOL);
+        else mov_load(e, reg, RBX, v.slot * OBJ_SIZE + OBJ_INT);
+    } else if (v.reg != reg) {
+        mov_rr(e, reg, v.reg);
+    }
+}
+
+static void load_float(Emitter *e, TraceValue v, int xmm) {
+    if (v.kind == VALUE_SLOT) sse_mem(e, SSE_LOAD, xmm, RBX, v.slot * OBJ_SIZE);
+    else if (v.reg != xmm) sse_rr(e, SSE_LOAD, xmm, v.reg);
+}
+
+// Moves values on the virtual stack which refer to `slot` into registers, before the slot is written.
+static bool detach_slot(TraceCompiler *t, s32 slot) {
+    for (u32 i = 0; i < t->depth; i++) {
+        TraceValue *v = &t->stack[i];
+        if (v->kind != VALUE_SLOT || v->slot != slot) continue;
+
+        TraceValueKind kind;
+        if (v->tag == OBJECT_INTEGER || v->tag == OBJECT_BOOLEAN) kind = VALUE_REG;
+        else if (v->tag == OBJECT_FLOATING) kind = VALUE_XMM;
+        else return false;
+
+        int reg = alloc_reg(t, kind);
+        if (reg < 0) return false;
+        if (kind == VALUE_REG) load_int(&t->e, *v, reg);
+        else load_float(&t->e, *v, reg);
+        v->kind = kind;
+        v->reg  = reg;
+    }
+    return true;
+}
+
+static void push_value(TraceCompiler *t, TraceValue v) {
+    t->stack[t->depth++] = v;
+}
+
+static bool is_numeric(ObjectTag tag) {
+    return (tag == OBJECT_INTEGER || tag == OBJECT_FLOATING);
+}
+
+static bool compile_trace_arithmetic(TraceCompiler *t, Op op, u64 pc) {
+    Emitter *e = &t->e;
+    if (t->depth < 2) return false;
+    TraceValue right = t->stack[t->depth-1];
+    TraceValue left  = t->stack[t->depth-2];
+    if (left.tag != right.tag || !is_numeric(left.tag)) return false;
+
+    if (left.tag == OBJECT_INTEGER) {
+        if (op == DIV) {
+            // Division by zero and INT64_MIN / -1 trap in hardware, so leave them to the interpreter.
+            load_int(e, right, RCX);
+            cmp_imm(e, RCX, 0);
+            trace_exit_if(t, CC_E, pc, true);
+            cmp_imm(e, RCX, -1);
+            trace_exit_if(t, CC_E, pc, true);
+        }
+        t->depth -= 2;
+        int dst = alloc_reg(t, VALUE_REG);
+        if (dst < 0) return false;
+
+        if (op == DIV) {
+            load_int(e, left, RAX);
+            idiv_r(e, RCX);
+            mov_rr(e, dst, RAX);
+        } else {
+            load_int(e, right, RCX);
+            load_int(e, left, RAX);
+            switch (op) {
+            case ADD: alu_rr(e, ALU_ADD, RAX, RCX); break;
+            case SUB: alu_rr(e, ALU_SUB, RAX, RCX); break;
+            case MUL: imul_rr(e, RAX, RCX); break;
+            default: assert(false);
+            }
+            mov_rr(e, dst, RAX);
+        }
+        push_value(t, (TraceValue){.kind = VALUE_REG, .tag = OBJECT_INTEGER, .reg = dst});
+        return true;
+    }
+
+    t->depth -= 2;
+    int dst = alloc_reg(t, VALUE_XMM);
+    if (dst < 0) return false;
+    load_float(e, right, XMM1);
+    load_float(e, left, XMM0);
+    switch (op) {
+    case ADD: sse_rr(e, SSE_ADD, XMM0, XMM1); break;
+    case SUB: sse_rr(e, SSE_SUB, XMM0, XMM1); break;
+    case MUL: sse_rr(e, SSE_MUL, XMM0, XMM1); break;
+    case DIV: sse_rr(e, SSE_DIV, XMM0, XMM1); break;
+    default: assert(false);
+    }
+    sse_rr(e, SSE_LOAD, dst, XMM0);
+    push_value(t, (TraceValue){.kind = VALUE_XMM, .tag = OBJECT_FLOATING, .reg = dst});
+    return true;
+}
+
+static bool compile_trace_comparison(TraceCompiler *t, Op op) {
+    Emitter *e = &t->e;
+    if (t->depth < 2) return false;
+    TraceValue right = t->stack[t->depth-1];
+    TraceValue left  = t->stack[t->depth-2];
+    if (left.tag != right.tag || !is_numeric(left.tag)) return false;
+    t->depth -= 2;
+    int dst = alloc_reg(t, VALUE_REG);
+    if (dst < 0) return false;
+
+    if (left.tag == OBJECT_INTEGER) {
+        load_int(e, left, RAX);
+        load_int(e, right, RCX);
+        alu_rr(e, ALU_CMP, RAX, RCX);
+        switch (op) {
+        case EQUALS:              setcc_al(e, CC_E);  break;
+        case LESS_THAN:           setcc_al(e, CC_L);  break;
+        case LESS_THAN_EQUALS:    setcc_al(e, CC_LE); break;
+        case GREATER_THAN:        setcc_al(e, CC_G);  break;
+        case GREATER_THAN_EQUALS: setcc_al(e, CC_GE); break;
+        default: assert(false);
+        }
+    } else {
+        // As in the templates, each test comes out false for NaN.
+        load_float(e, left, XMM0);
+        load_float(e, right, XMM1);
+        switch (op) {
+        case EQUALS: {
+            ucomisd(e, XMM0, XMM1);
+            setcc_al(e, CC_E);
+            setnp_cl(e);
+            and_al_cl(e);
+        } break;
+        case LESS_THAN:           ucomisd(e, XMM1, XMM0); setcc_al(e, CC_A);  break;
+        case LESS_THAN_EQUALS:    ucomisd(e, XMM1, XMM0); setcc_al(e, CC_AE); break;
+        case GREATER_THAN:        ucomisd(e, XMM0, XMM1); setcc_al(e, CC_A);  break;
+        case GREATER_THAN_EQUALS: ucomisd(e, XMM0, XMM1); setcc_al(e, CC_AE); break;
+        default: assert(false);
+        }
+    }
+    movzx_eax_al(e);
+    mov_rr(e, dst, RAX);
+    push_value(t, (TraceValue){.kind = VALUE_REG, .tag = OBJECT_BOOLEAN, .reg = dst});
+    return true;
+}
+
+static Op generic_op(Op op) {
+    switch (op) {
+    case ADD_INT:
+    case ADD_FLOAT:       return ADD;
+    case LESS_THAN_INT:
+    case LESS_THAN_FLOAT: return LESS_THAN;
+    case EQUALS_INT:
+    case EQUALS_FLOAT:    return EQUALS;
+    default:              return op;
+    }
+}
+
+// Compiles one recorded instruction. Returns false if the trace can't be compiled.
+static bool compile_trace_step(TraceCompiler *t, TraceStep step) {
+    Emitter *e = &t->e;
+    Instruction instr = step.instr;
+    s32 arg = instr.arg;
+    u64 pc = step.pc;
+
+    switch (generic_op(instr.op)) {
+    case NOP:
+    case END_BLOCK:
+    case JUMP: {
+    } break;
+
+    case LOAD: {
+        if (t->depth == TRACE_MAX_DEPTH || arg < 0 || (u64)arg >= t->num_slots) return false;
+        if (!t->known[arg]) {
+            cmp_mem32_imm(e, RBX, arg * OBJ_SIZE + OBJ_TAG, step.tag);
+            trace_exit_if(t, CC_NE, pc, true);
+            t->known[arg] = true;
+            t->tags[arg]  = step.tag;
+        }
+        push_value(t, (TraceValue){.kind = VALUE_SLOT, .tag = t->tags[arg], .slot = arg});
+    } break;
+
+    case STORE: {
+        if (t->depth == 0 || arg < 0 || (u64)arg >= t->num_slots) return false;
+        TraceValue v = t->stack[--t->depth];
+        if (!detach_slot(t, arg)) return false;
+        if (v.kind != VALUE_SLOT || v.slot != arg) write_value(e, RBX, arg * OBJ_SIZE, v);
+        t->known[arg] = true;
+        t->tags[arg]  = v.tag;
+    } break;
+
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV: {
+        return compile_trace_arithmetic(t, generic_op(instr.op), pc);
+    } break;
+
+    case EQUALS:
+    case LESS_THAN:
+    case LESS_THAN_EQUALS:
+    case GREATER_THAN:
+    case GREATER_THAN_EQUALS: {
+        return compile_trace_comparison(t, generic_op(instr.op));
+    } break;
+
+    case NEG: {
+        if (t->depth == 0) return false;
+        TraceValue v = t->stack[--t->depth];
+        if (v.tag == OBJECT_INTEGER) {
+            int dst = alloc_reg(t, VALUE_REG);
+            if (dst < 0) return false;
+            load_int(e, v, dst);
+            neg_r(e, dst);
+            push_value(t, (TraceValue){.kind = VALUE_REG, .tag = OBJECT_INTEGER, .reg = dst});
+        } else if (v.tag == OBJECT_FLOATING) {
+            int dst = alloc_reg(t, VALUE_XMM);
+            if (dst < 0) return false;
+            load_float(e, v, dst);
+            mov_imm64(e, RAX, 0x8000000000000000ull);
+            movq_xmm_rax(e, XMM0);
+            xorpd(e, dst, XMM0);
+            push_value(t, (TraceValue){.kind = VALUE_XMM, .tag = OBJECT_FLOATING, .reg = dst});
+        } else {
+            return false;
+        }
+    } break;
+
+    case JUMP_TRUE:
+    case JUMP_FALSE: {
+        if (t->depth == 0) return false;
+        TraceValue v = t->stack[--t->depth];
+        if (v.tag != OBJECT_BOOLEAN) return false;
+
+        // JUMP_FALSE is taken when the boolean is 0, JUMP_TRUE when it's 1.
+        u8 value = (instr.op == JUMP_TRUE ? 1 : 0);
+        if (v.kind == VALUE_SLOT) cmp_mem8_imm(e, RBX, v.slot * OBJ_SIZE + OBJ_BOOL, value);
+        else cmp_imm(e, v.reg, value);
+        if (step.taken) trace_exit_if(t, CC_NE, pc + 2, false);
+        else trace_exit_if(t, CC_E, arg + 1, false);
+    } break;
+
+    case ARRAY_SUBSCRIPT: {
+        if (t->depth == 0 || arg < 0 || (u64)arg >= t->num_slots || step.tag != OBJECT_ARRAY) return false;
+        TraceValue index = t->stack[t->depth-1];
+        if (index.tag != OBJECT_INTEGER) return false;
+        if (!t->known[arg]) {
+            cmp_mem32_imm(e, RBX, arg * OBJ_SIZE + OBJ_TAG, OBJECT_ARRAY);
+            trace_exit_if(t, CC_NE, pc, true);
+            t->known[arg] = true;
+            t->tags[arg]  = OBJECT_ARRAY;
+        }
+        load_int(e, index, RAX);
+        mov_load(e, RDX, RBX, arg * OBJ_SIZE + OBJ_ARRAY);
+        mov_load(e, RCX, RDX, ARRAY_LENGTH);
+        alu_rr(e, ALU_CMP, RAX, RCX);
+        trace_exit_if(t, CC_AE, pc, true);
+
+        cmp_mem32_imm(e, RDX, ARRAY_KIND, step.kind);
+        trace_exit_if(t, CC_NE, pc, true);
+
+        t->depth--;
+        const s32 result = ARRAY_SUBSCRIPT_RESULT_INDEX;
+        if (!detach_slot(t, result)) return false;
+        mov_load(e, RDX, RDX, ARRAY_DATA);
+        if (step.kind == ARRAY_OBJECTS) {
+            imul_imm(e, RAX, RAX, OBJ_SIZE);
+            alu_rr(e, ALU_ADD, RDX, RAX);
+            copy_object(e, RBX, result * OBJ_SIZE, RDX, 0);
+            t->known[result] = false;
+        } else {
+            // The kind guard tells us the element's tag, so later loads of the result needn't check it.
+            ObjectTag tag = (step.kind == ARRAY_INTEGERS ? OBJECT_INTEGER : OBJECT_FLOATING);
+            imul_imm(e, RAX, RAX, 8);
+            alu_rr(e, ALU_ADD, RDX, RAX);
+            mov_load(e, RCX, RDX, 0);
+            write_value(e, RBX, result * OBJ_SIZE, (TraceValue){.kind = VALUE_REG, .tag = tag, .reg = RCX});
+            t->known[result] = true;
+            t->tags[result]  = tag;
+        }
+    } break;
+
+    default: {
+        return false;
+    } break;
+    }
+    return true;
+}
+
+static bool traceable(Op op) {
+    switch (generic_op(op)) {
+    case NOP:
+    case END_BLOCK:
+    case JUMP:
+    case JUMP_TRUE:
+    case JUMP_FALSE:
+    case LOAD:
+    case STORE:
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+    case NEG:
+    case EQUALS:
+    case LESS_THAN:
+    case LESS_THAN_EQUALS:
+    case GREATER_THAN:
+    case GREATER_THAN_EQUALS:
+    case ARRAY_SUBSCRIPT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Compiles the recorded trace, which loops back to its start. Returns false if it can't be.
+static bool compile_trace(Interp *interp) {
+    Jit *jit = interp->jit;
+    TraceCompiler t = {0};
+    array_init(t.e.code, u8);
+    array_init(t.exits, TraceExit);
+    t.num_slots = frame_top(interp)->constant_pool.length;
+    t.known = calloc(t.num_slots, sizeof(bool));
+    t.tags  = calloc(t.num_slots, sizeof(ObjectTag));
+
+    emit_prologue(&t.e, false);
+    u64 loop = t.e.code.length;
+
+    bool ok = true;
+    for (u64 i = 0; i < jit->trace.length && ok; i++) {
+        ok = compile_trace_step(&t, jit->trace.data[i]);
+    }
+    // The loop's back-edge is only reached between statements, when the stack is empty.
+    ok = ok && (t.depth == 0);
+
+    if (ok) {
+        patch(&t.e, jmp_rel(&t.e), loop);
+        t.e.epilogue = t.e.code.length;
+        emit_epilogue(&t.e);
+
+        for (u64 i = 0; i < t.exits.length; i++) {
+            TraceExit *exit = (t.exits.data + i);
+            patch(&t.e, exit->at, t.e.code.length);
+            for (u32 v = 0; v < exit->depth; v++) {
+                mov_load(&t.e, RAX, R12, STACK_TOP);
+                add_imm(&t.e, RAX, 1);
+                mov_store(&t.e, R12, STACK_TOP, RAX);
+                imul_imm(&t.e, RAX, RAX, OBJ_SIZE);
+                alu_rr(&t.e, ALU_ADD, RAX, R12);
+                write_value(&t.e, RAX, STACK_DATA, exit->stack[v]);
+            }
+            emit_exit_stub(&t.e, exit->pc, exit->bailed);
+        }
+
+        u8 *code = install_code(interp, &t.e, jit->trace_header, jit->trace_header);
+        if (code) {
+            jit->traces[jit->trace_header] = code;
+            jit->num_traces++;
+        }
+        ok = (code != NULL);
+    }
+
+    free(t.known);
+    free(t.tags);
+    array_free(t.e.code);
+    array_free(t.exits);
+    return ok;
+}
+
+bool jit_init(Interp *interp) {
+    Jit *jit = malloc(sizeof(Jit));
+    jit->length   = interp->instructions.length;
+    jit->entries  = calloc(jit->length, sizeof(void *));
+    jit->enter    = calloc(jit->length, sizeof(void *));
+    jit->traces   = calloc(jit->length, sizeof(void *));
+    jit->counters = calloc(jit->length, sizeof(u32));
+    jit->code_bytes = 0;
+    jit->num_traces = 0;
+    jit->recording  = false;
+    array_init(jit->regions, JitRegion);
+    array_init(jit->trace, TraceStep);
+
+    // Functions are told apart from other blocks by being called.
+    jit->num_lambdas = interp->root_scope->constant_pool.length;
+    jit->lambdas = calloc(jit->num_lambdas, sizeof(bool));
+    for (u64 pc = 0; pc < jit->length; pc++) {
+        Instruction instr = interp->instructions.data[pc];
+        if (instr.op != CALL_FUNC && instr.op != TAIL_CALL) continue;
+        if (instr.arg >= 0 && (u64)instr.arg < jit->num_lambdas) jit->lambdas[instr.arg] = true;
+    }
+    interp->jit = jit;
+    return true;
+}
+
+void jit_free(Interp *interp) {
+    Jit *jit = interp->jit;
+    if (!jit) return;
+    for (u64 i = 0; i < jit->regions.length; i++) {
+        munmap(jit->regions.data[i].code, jit->regions.data[i].size);
+    }
+    array_free(jit->regions);
+    array_free(jit->trace);
+    free(jit->entries);
+    free(jit->enter);
+    free(jit->traces);
+    free(jit->counters);
+    free(jit->lambdas);
+    free(jit);
+    interp->jit = NULL;
+}
+
+// Makes room for instructions added after the JIT was created.
+void jit_grow(Interp *interp) {
+    Jit *jit = interp->jit;
+    u64 length = interp->instructions.length;
+    if (length <= jit->length) return;
+
+    jit->entries  = realloc(jit->entries, sizeof(void *) * length);
+    jit->enter    = realloc(jit->enter, sizeof(void *) * length);
+    jit->traces   = realloc(jit->traces, sizeof(void *) * length);
+    jit->counters = realloc(jit->counters, sizeof(u32) * length);
+    u64 added = length - jit->length;
+    memset(jit->entries + jit->length, 0, sizeof(void *) * added);
+    memset(jit->enter + jit->length, 0, sizeof(void *) * added);
+    memset(jit->traces + jit->length, 0, sizeof(void *) * added);
+    memset(jit->counters + jit->length, 0, sizeof(u32) * added);
+    jit->length = length;
+}
+
+// Compiles the body of the function starting at `start`.
+static void compile_function(Interp *interp, u64 start) {
+    if (start == 0 || interp->instructions.data[start-1].op != BEGIN_BLOCK) return;
+    u64 end = find_end_block(interp, start, interp->instructions.data[start-1].arg);
+    if (end > start) jit_compile(interp, start, end - 1);
+}
+
+void jit_note_call(Interp *interp, u64 start) {
+    Jit *jit = interp->jit;
+    if (start >= jit->length || ++jit->counters[start] != JIT_HOT_THRESHOLD) return;
+    if (jit->entries[start]) return;
+    compile_function(interp, start);
+}
+
+// Compiles a loop which couldn't be traced along with the rest of the function (or top-level code) it's in.
+// Loops lowered from the IR aren't contiguous, so compiling just the range the back-edge spans would leave native
+// code every iteration.
+static void compile_around_loop(Interp *interp, u64 from) {
+    Jit *jit = interp->jit;
+    for (u64 pc = from; pc-- > 0;) {
+        Instruction instr = interp->instructions.data[pc];
+        if (instr.op != BEGIN_BLOCK || !is_function(interp, instr.arg)) continue;
+        if (find_end_block(interp, pc + 1, instr.arg) > from) {
+            compile_function(interp, pc + 1);
+            return;
+        }
+    }
+    jit_compile(interp, 0, jit->length - 1);
+}
+
+void jit_note_back_edge(Interp *interp, u64 target, u64 from) {
+    Jit *jit = interp->jit;
+    if (target >= jit->length || ++jit->counters[target] != JIT_HOT_THRESHOLD) return;
+    if (jit->entries[target] || jit->traces[target] || jit->recording) return;
+
+    // Record the next iteration, starting when the interpreter gets to the loop's first instruction.
+    jit->recording    = true;
+    jit->trace_header = target;
+    jit->trace_from   = from;
+    jit->trace.length = 0;
+}
+
+void jit_record(Interp *interp) {
+    Jit *jit = interp->jit;
+    u64 pc = interp->pc;
+    Instruction instr = interp->instructions.data[pc];
+
+    if (pc == jit->trace_header && jit->trace.length > 0) {
+        jit->recording = false;
+        if (!compile_trace(interp) && !jit->entries[pc]) compile_around_loop(interp, jit->trace_from);
+        return;
+    }
+
+    if (!traceable(instr.op) || jit->trace.length == JIT_MAX_TRACE_LENGTH) {
+        jit->recording = false;
+        if (!jit->entries[jit->trace_header]) compile_around_loop(interp, jit->trace_from);
+        return;
+    }
+
+    StackFrame *scope = frame_top(interp);
+    Stack *stack = &scope->stack;
+    TraceStep step = (TraceStep){.pc = pc, .instr = instr};
+    switch (instr.op) {
+    case LOAD: {
+        step.tag = scope->constant_pool.data[instr.arg].tag;
+    } break;
+    case ARRAY_SUBSCRIPT: {
+        Object array = scope->constant_pool.data[instr.arg];
+        step.tag = array.tag;
+        if (array.tag == OBJECT_ARRAY) step.kind = array.array->kind;
+    } break;
+    case JUMP_TRUE: {
+        step.taken = (stack->data[stack->top].boolean == 1);
+    } break;
+    case JUMP_FALSE: {
+        step.taken = (stack->data[stack->top].boolean == 0);
+    } break;
+    default: break;
+    }
+    array_add(jit->trace, step);
+}
+
+u64 jit_run(Interp *interp, u64 pc, bool *bailed) {
+    Jit *jit = interp->jit;
+    u64 result;
+    if (jit->traces[pc]) {
+        JitFunction trace = (JitFunction)jit->traces[pc];
+        result = trace(interp, frame_top(interp), NULL);
+    } else {
+        JitFunction enter = (JitFunction)jit->enter[pc];
+        result = enter(interp, frame_top(interp), jit->entries[pc]);
+    }
+    *bailed = (result & JIT_BAILED) != 0;
+    return (result & ~JIT_BAILED);
+}
+
+#else
+
+// Native code generation is only implemented for x86-64 Linux, elsewhere -jit does nothing.
+
+bool jit_init(Interp *interp) {
+    interp->jit = NULL;
+    return false;
+}
+
+void jit_free(Interp *interp) {
+    (void)interp;
+}
+
+void jit_grow(Interp *interp) {
+    (void)interp;
+}
+
+void jit_note_call(Interp *interp, u64 start) {
+    (void)interp; (void)start;
+}
+
+void jit_note_back_edge(Interp *interp, u64 target, u64 from) {
+    (void)interp; (void)target; (void)from;
+}
+
+void jit_record(Interp *interp) {
+    (void)interp;
+}
+
+u64 jit_run(Interp *interp, u64 pc, bool *bailed) {
+    (void)interp;
+    *bailed = true;
+    return pc;
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef JIT_h
+#define JIT_h
+
+#include "context.h"
+#include "common.h"
+#include "array.h"
+
+// A baseline template JIT enabled with -jit. Hot functions and loops are translated, one instruction at
+// a time, into x86-64 code which does what the interpreter's handler would for the common cases.
+// Anything else (calls, printing, strings, unexpected tags) leaves native code and the interpreter
+// carries on from that instruction.
+//
+// Hot while loops are traced instead: one iteration is recorded as it's interpreted, and the path it took is
+// compiled with guards on the tags it saw. Regions are the fallback for loops which can't be traced.
+
+typedef struct JitRegion {
+    u8 *code;
+    u64 size;             // bytes mapped
+    u64 first, last;      // range of instructions compiled
+} JitRegion;
+
+typedef struct TraceStep {
+    u64 pc;
+    Instruction instr;
+    ObjectTag tag;        // of the constant LOAD and ARRAY_SUBSCRIPT read
+    ArrayKind kind;       // of the array ARRAY_SUBSCRIPT read
+    bool taken;           // whether a branch jumped
+} TraceStep;
+
+typedef struct Jit {
+    void **entries;       // native address of each instruction, NULL if it has none
+    void **enter;         // the prologue of the region entries[pc] belongs to
+    u32   *counters;      // calls and back-edges seen, indexed by the pc they lead to
+    u64    length;        // number of instructions when the JIT was created
+    bool  *lambdas;       // indexed by root constant, set for the blocks which are functions
+    u64    num_lambdas;
+
+    Array(JitRegion) regions;
+    u64 code_bytes;       // bytes of machine code emitted
+
+    void **traces;        // compiled trace of the loop starting at each pc, NULL if it has none
+    u64    num_traces;
+    bool   recording;     // set while the interpreter is recording a trace
+    u64    trace_header;  // first instruction of the loop being recorded
+    u64    trace_from;    // the back-edge which made it hot
+    Array(TraceStep) trace;
+} Jit;
+
+// Returns false if native code can't be generated on this platform.
+bool jit_init(Interp *interp);
+void jit_free(Interp *interp);
+void jit_grow(Interp *interp);
+
+// Called by the interpreter on each call (with the callee's first pc) and each backward jump.
+// Compiles the function, or starts recording the loop, once it becomes hot.
+void jit_note_call(Interp *interp, u64 start);
+void jit_note_back_edge(Interp *interp, u64 target, u64 from);
+
+// Called instead of dispatching while recording, before the instruction at interp->pc is run.
+void jit_record(Interp *interp);
+
+// Runs native code from `pc`, which must have an entry or a trace. Returns the pc the interpreter should continue at,
+// and sets `bailed` if the instruction there must be interpreted.
+u64 jit_run(Interp *interp, u64 pc, bool *bailed);
+
+#endif
@@ -8,7 +8,7 @@
 #include <assert.h>
 
 /* Initializes a Lexer */
-void lexer_init(Lexer *tz, const char *path, char *data) {
+void lexer_init(Lexer *tz, const char *path, char *data, Region *region) {
     tz->file_name = path;
 
     tz->line = 1;
@@ -19,7 +19,7 @@ void lexer_init(Lexer *tz, const char *path, char *data) {
     tz->curr = data;
     tz->start = data;
 
-    string_allocator_init(&tz->string_allocator);
+    tz->region = region;
 }
 
 /*
@@ -69,7 +69,7 @@ Token token_new(Lexer *tz, TokenType type) {
     t.length = (s32)(tz->curr - tz->start);
     t.file = tz->file_name;
 
-    t.text = (char *)string_allocator(&tz->string_allocator, t.length+1);
+    t.text = region_alloc_bytes(tz->region, t.length+1);
     strncpy(t.text, tz->start, t.length);
 
     if (type == Token_STRING_LIT) {
@@ -291,7 +291,7 @@ bool lexer_lex(Lexer *l, TokenList *out) {
     while (true) {
         Token t = next_token(l);
         if (t.type == Token_ERROR) return false;
-        array_add(*out, t);
+        region_array_add(l->region, *out, t);
         if (t.type == Token_EOF) break;
     }
     return true;
@@ -2,10 +2,15 @@
 #include "common.h"
 #include "context.h"
 #include "parser.h"
+#include "jit.h"
+#include "tier.h"
+#include "gc.h"
+#include "output.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
 
 static void test_stack() {
     Stack stack;
@@ -24,73 +29,169 @@ static void test_stack() {
     }
 }
 
-int main(int arg_count, char *args[]) {
-    test_stack();
-
-    if (arg_count < 2) {
-        printf("Please supply the path of the main module.\n");
-        return -1;
-    }
-
-    char *file_data = read_file(args[1]);
+// The memory of each phase of a run. Resetting them at the end of one leaves them ready for the next.
+typedef struct Regions {
+    Region lex;
+    Region parse;
+    Region compile;
+} Regions;
 
-    bool verbose = false;
-    if (arg_count > 2 && strcmp(args[2], "-v") == 0) {
-        verbose = true;
-    }
+static int errors_exit(void) {
+    printf("\nThere were errors, exiting.\n");
+    return -1;
+}
 
+// Lexes, parses, compiles and runs (or emits) the program at `path`.
+// Whatever happens, everything it made is in the regions or `interp`, for end_run to release.
+static int run(Regions *regions, Interp *interp, char *path, u32 compile_flags, OutputMode output_mode, bool verbose, char *emit_c_path) {
     Lexer     lexer;
     TokenList tokens;
     Parser    parser;
     Ast       ast;
-    Interp    interp;
 
-    lexer_init(&lexer, args[1], file_data);
-    if (!lexer_lex(&lexer, &tokens)) {
-        printf("\nThere were errors, exiting.\n");
-        return -1; // TODO lots of leaks here
-    }
+    // The tokens have their own copies of the text.
+    char *file_data = read_file(path);
+    lexer_init(&lexer, path, file_data, &regions->lex);
+    bool lexed = lexer_lex(&lexer, &tokens);
+    free(file_data);
+    if (!lexed) return errors_exit();
     if (verbose) token_list_print(tokens);
 
-    parser_init(&parser, tokens, args[1]);
+    parser_init(&parser, tokens, path, &regions->parse);
     ast = run_parser(&parser);
-    if (parser.error_count > 0) {
-        printf("\nThere were errors, exiting.\n");
-        return -1; // TODO lots of leaks here
-    }
+    if (parser.error_count > 0) return errors_exit();
 
     if (verbose) {
         printf("\nsizeof(AstNode) is %ld bytes.", sizeof(AstNode));
         printf("\nsizeof(Object) is %ld bytes.\n", sizeof(Object));
-        printf("\nThere are %ld nodes in the AST (%ld top-level).", parser.node_allocator.total_nodes, ast.length);
-        printf("\nThere are %ld blocks in the node allocator.\n", parser.node_allocator.num_blocks);
+        printf("\nThere are %ld nodes in the AST (%ld top-level).\n", parser.num_nodes, ast.length);
+        printf("\nThe lexer's region has ");
+        region_print_stats(&regions->lex);
+        printf("\nThe parser's region has ");
+        region_print_stats(&regions->parse);
     }
 
-    interp = compile(ast, args[1]);
-    if (interp.error_count > 0) {
-        printf("\nThere were errors, exiting.\n");
-        return -1; // TODO lots of leaks here
+    *interp = compile(ast, path, compile_flags, &regions->compile);
+    if (interp->error_count > 0) return errors_exit();
+
+    // The compiled program doesn't refer to the tokens or the AST, so they can go before it runs.
+    // Tiering compiles functions again from their AST, and it's only done without -O, see run_interpreter.
+    bool tiering = (compile_flags & COMPILE_TIERED) && !(compile_flags & COMPILE_OPTIMIZE);
+    if (!tiering) {
+        interp->program = (Ast){0};
+        region_reset(&regions->parse);
+        region_reset(&regions->lex);
     }
 
     if (verbose && !PRINT_INSTRUCTIONS_DURING_COMPILE) {
-        printf("\nThere are %ld instructions, here they are:\n", interp.instructions.length);
-        for (u64 i = 0; i < interp.instructions.length; i++) {
-            Instruction instr = interp.instructions.data[i];
+        printf("\nThere are %ld instructions, here they are:\n", interp->instructions.length);
+        for (u64 i = 0; i < interp->instructions.length; i++) {
+            Instruction instr = interp->instructions.data[i];
             printf("(%s%ld) Line %s%ld : %s %d\n", (i < 10 ? "0" : ""), i, (instr.line_number < 10 ? "0" : ""), instr.line_number, instruction_strings[instr.op], instr.arg);
         }
         printf("\nRunning the bytecode:\n");
     }
 
-    run_interpreter(&interp);
-    if (interp.error_count > 0) {
-        printf("\nThere were errors, exiting.\n");
-        return -1; // TODO lots of leaks here
+    if (emit_c_path) {
+        return (emit_c(interp, emit_c_path) ? 0 : -1);
+    }
+
+    // What the program prints is written in batches, and has all been written by the time anything else is.
+    interp->out = output_new(STDOUT_FILENO, output_mode);
+    run_interpreter(interp);
+    output_flush(interp->out);
+
+    if (verbose && interp->memo_tables.length > 0) {
+        printf("\nMemoised %ld pure functions:\n", interp->memo_tables.length);
+        for (u64 i = 0; i < interp->memo_tables.length; i++) {
+            MemoTable table = interp->memo_tables.data[i];
+            printf("  table %ld: %ld hits, %ld misses\n", i, table.hits, table.misses);
+        }
+    }
+
+    if (verbose) {
+        printf("\nThe compiler's region has ");
+        region_print_stats(&regions->compile);
+    }
+
+    if (verbose && interp->heap) {
+        Heap *heap = interp->heap;
+        printf("\nCollected garbage %ld times, freeing %ld objects (%ld bytes). %ld bytes are in use.\n", heap->collections, heap->freed, heap->freed_bytes, heap->bytes);
     }
-    
-    string_allocator_free(&lexer.string_allocator);
-    node_allocator_free(&parser.node_allocator);
-    array_free(ast);
-    free_interpreter(&interp);
 
+    if (verbose && interp->jit) {
+        u64 traces = interp->jit->num_traces;
+        printf("\nCompiled %ld regions and %ld traces to %ld bytes of native code.\n", interp->jit->regions.length - traces, traces, interp->jit->code_bytes);
+    }
+
+    if (verbose && interp->tier) {
+        printf("\nRecompiled %ld hot functions through the IR.\n", interp->tier->recompiled);
+    }
+
+    if (interp->error_count > 0) return errors_exit();
     return 0;
 }
+
+// Frees what the run made outside the regions, then resets them, latest phase first.
+static void end_run(Regions *regions, Interp *interp) {
+    tier_free(interp); // kept out of free_interpreter, which is part of the -emit-c runtime
+    free_interpreter(interp);
+    *interp = (Interp){0};
+
+    region_reset(&regions->compile);
+    region_reset(&regions->parse);
+    region_reset(&regions->lex);
+}
+
+int main(int arg_count, char *args[]) {
+    test_stack();
+
+    if (arg_count < 2) {
+        printf("Please supply the path of the main module.\n");
+        return -1;
+    }
+
+    bool verbose = false;
+    u32  compile_flags = 0;
+    char *emit_c_path = NULL;
+    OutputMode output_mode = output_default_mode(STDOUT_FILENO);
+    for (int i = 2; i < arg_count; i++) {
+        if (strcmp(args[i], "-v") == 0) {
+            verbose = true;
+        } else if (strcmp(args[i], "-memo") == 0) {
+            compile_flags |= COMPILE_MEMOIZE_PURE;
+        } else if (strcmp(args[i], "-O") == 0) {
+            compile_flags |= COMPILE_OPTIMIZE;
+        } else if (strcmp(args[i], "-dump-ir") == 0) {
+            compile_flags |= COMPILE_OPTIMIZE | COMPILE_DUMP_IR;
+        } else if (strcmp(args[i], "-jit") == 0) {
+            compile_flags |= COMPILE_JIT;
+        } else if (strcmp(args[i], "-tier") == 0) {
+            compile_flags |= COMPILE_TIERED;
+        } else if (strcmp(args[i], "-line-buffered") == 0) {
+            output_mode = OUTPUT_LINE_BUFFERED;
+        } else if (strcmp(args[i], "-unbuffered") == 0) {
+            output_mode = OUTPUT_UNBUFFERED;
+        } else if (strcmp(args[i], "-emit-c") == 0 && i+1 < arg_count) {
+            emit_c_path = args[++i];
+        } else {
+            printf("Unknown option '%s'.\n", args[i]);
+            return -1;
+        }
+    }
+
+    Regions regions;
+    region_init(&regions.lex);
+    region_init(&regions.parse);
+    region_init(&regions.compile);
+
+    Interp interp = {0};
+    int result = run(&regions, &interp, args[1], compile_flags, output_mode, verbose, emit_c_path);
+    end_run(&regions, &interp);
+
+    region_free(&regions.compile);
+    region_free(&regions.parse);
+    region_free(&regions.lex);
+
+    return result;
+}
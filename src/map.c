@@ -0,0 +1,166 @@
+#include "map.h"
+#include "simd.h"
+#include "gc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The control byte of a full slot is the low seven bits of its key's hash. Empty and deleted slots have the high
+// bit set, so a group's free slots are the high bits of its control bytes.
+#define MAP_EMPTY   0x80
+#define MAP_DELETED 0xFE
+
+// A full table is this many eighths full, counting deleted slots.
+#define MAP_MAX_LOAD 7
+
+// Integers are used as they are and strings by their cached hash, then mixed so that consecutive integers spread
+// across the table.
+static u64 key_hash(Object *key) {
+    u64 h = (key->tag == OBJECT_INTEGER ? (u64)key->integer : object_string_hash(key));
+    h *= 0x9E3779B97F4A7C15u;
+    return h ^ (h >> 32);
+}
+
+static bool keys_equal(Object a, Object b) {
+    if (a.tag != b.tag) return false;
+    if (a.tag == OBJECT_INTEGER) return (a.integer == b.integer);
+    return object_string_equals(a, b);
+}
+
+static u64 capacity_for(u64 length) {
+    u64 capacity = MAP_MIN_CAPACITY;
+    while (capacity * MAP_MAX_LOAD / 8 < length) capacity *= 2;
+    return capacity;
+}
+
+static void alloc_table(ObjectMap *map, u64 capacity) {
+    map->control = malloc(capacity * (1 + sizeof(u32)));
+    memset(map->control, MAP_EMPTY, capacity);
+    map->slots = (u32 *)(map->control + capacity);
+    map->capacity = capacity;
+    map->used = 0;
+}
+
+//
+// Probing.
+// Groups are visited in triangular order (1, 2, 3... groups apart), which reaches every group of a table whose
+// number of groups is a power of two. Probing stops at the first group with an empty slot.
+//
+static s64 find_slot(ObjectMap *map, Object *key, u64 hash) {
+    u64 mask = map->capacity / MAP_GROUP_SIZE - 1;
+    u64 group = (hash >> 7) & mask;
+    for (u64 step = 1;; step++) {
+        u8 *control = map->control + group * MAP_GROUP_SIZE;
+        u32 bits = simd_match_16(control, hash & 0x7f);
+        while (bits) {
+            u64 slot = group * MAP_GROUP_SIZE + __builtin_ctz(bits);
+            if (keys_equal(map->entries[map->slots[slot]].key, *key)) return slot;
+            bits &= bits - 1;
+        }
+        if (simd_match_16(control, MAP_EMPTY)) return -1;
+        group = (group + step) & mask;
+    }
+}
+
+// Puts the entry in the first free slot on its key's probe sequence, which must not already hold the key.
+static void insert_slot(ObjectMap *map, u64 hash, u32 index) {
+    u64 mask = map->capacity / MAP_GROUP_SIZE - 1;
+    u64 group = (hash >> 7) & mask;
+    for (u64 step = 1;; step++) {
+        u8 *control = map->control + group * MAP_GROUP_SIZE;
+        u32 bits = simd_high_bits_16(control);
+        if (bits) {
+            u64 slot = group * MAP_GROUP_SIZE + __builtin_ctz(bits);
+            if (map->control[slot] == MAP_EMPTY) map->used++;
+            map->control[slot] = hash & 0x7f;
+            map->slots[slot] = index;
+            return;
+        }
+        group = (group + step) & mask;
+    }
+}
+
+// Drops the deleted entries and rehashes the rest into a table of `capacity` slots.
+static void map_rebuild(ObjectMap *map, u64 capacity) {
+    u64 length = 0;
+    for (u64 i = 0; i < map->num_entries; i++) {
+        if (map->entries[i].key.tag != OBJECT_UNDEFINED) map->entries[length++] = map->entries[i];
+    }
+    map->num_entries = length;
+
+    free(map->control);
+    alloc_table(map, capacity);
+    for (u64 i = 0; i < length; i++) insert_slot(map, key_hash(&map->entries[i].key), i);
+}
+
+ObjectMap *object_map_new(Heap *heap, u64 length) {
+    ObjectMap *map = calloc(1, sizeof(ObjectMap));
+    alloc_table(map, capacity_for(length));
+    map->entries_capacity = (length > 8 ? length : 8);
+    map->entries = malloc(map->entries_capacity * sizeof(MapEntry));
+    if (heap) gc_own(heap, &map->gc, GC_MAP, object_map_bytes(map));
+    return map;
+}
+
+u64 object_map_bytes(ObjectMap *map) {
+    return sizeof(ObjectMap) + map->capacity * (1 + sizeof(u32)) + map->entries_capacity * sizeof(MapEntry);
+}
+
+void object_map_free(ObjectMap *map) {
+    free(map->control);
+    free(map->entries);
+    free(map);
+}
+
+bool object_map_get(ObjectMap *map, Object key, Object *value) {
+    s64 slot = find_slot(map, &key, key_hash(&key));
+    if (slot < 0) return false;
+    if (value) *value = map->entries[map->slots[slot]].value;
+    return true;
+}
+
+void object_map_set(ObjectMap *map, Object key, Object value) {
+    u64 hash = key_hash(&key); // which also caches the hash of a string in the key that's stored
+    s64 slot = find_slot(map, &key, hash);
+    if (slot >= 0) {
+        map->entries[map->slots[slot]].value = value;
+        return;
+    }
+
+    // When at least half the entries have been deleted, dropping them makes room, otherwise the entries double.
+    if (map->num_entries == map->entries_capacity) {
+        if (map->num_entries - map->length >= map->num_entries / 2) {
+            map_rebuild(map, map->capacity);
+        } else {
+            map->entries_capacity *= 2;
+            map->entries = realloc(map->entries, map->entries_capacity * sizeof(MapEntry));
+        }
+    }
+    // Likewise, a table full of deleted slots is rebuilt at the same size.
+    if ((map->used + 1) * 8 > map->capacity * MAP_MAX_LOAD) {
+        map_rebuild(map, capacity_for(map->length + 1) > map->capacity / 2 ? map->capacity * 2 : map->capacity);
+    }
+
+    insert_slot(map, hash, map->num_entries);
+    map->entries[map->num_entries++] = (MapEntry){key, value};
+    map->length++;
+}
+
+bool object_map_delete(ObjectMap *map, Object key) {
+    s64 slot = find_slot(map, &key, key_hash(&key));
+    if (slot < 0) return false;
+
+    map->entries[map->slots[slot]] = (MapEntry){0};
+    map->length--;
+
+    // A group which still has an empty slot never made a probe move on to the next group, so the slot can be
+    // emptied. Otherwise it's marked deleted, which probing passes over.
+    u8 *group = map->control + (slot & ~(u64)(MAP_GROUP_SIZE - 1));
+    if (simd_match_16(group, MAP_EMPTY)) {
+        map->control[slot] = MAP_EMPTY;
+        map->used--;
+    } else {
+        map->control[slot] = MAP_DELETED;
+    }
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef MAP_h
+#define MAP_h
+
+#include "context.h"
+#include "common.h"
+
+// Maps from integers and strings to objects, with open addressing.
+//
+// The entries are kept in an array in the order their keys were first set, which is the order they're printed in.
+// The table itself holds an index into that array for each key, and a control byte per slot with seven bits of the
+// key's hash. Slots are probed MAP_GROUP_SIZE at a time, comparing all of a group's control bytes at once (see simd.h),
+// so most lookups look at a single key.
+
+#define MAP_GROUP_SIZE   16
+#define MAP_MIN_CAPACITY MAP_GROUP_SIZE
+
+typedef struct MapEntry {
+    Object key;            // OBJECT_UNDEFINED once the key has been deleted
+    Object value;
+} MapEntry;
+
+typedef struct ObjectMap {
+    GcHeader gc;
+    u8  *control;          // a byte per slot, see map.c, followed by the slots themselves
+    u32 *slots;            // the index in `entries` of the key in each full slot
+    u64  capacity;         // slots, a power of two of at least MAP_MIN_CAPACITY
+    u64  used;             // slots which aren't empty, including those of deleted keys
+    MapEntry *entries;
+    u64  num_entries;      // including deleted ones
+    u64  entries_capacity;
+    u64  length;           // keys in the map
+} ObjectMap;
+
+static inline bool object_map_is_key(Object key) {
+    return (key.tag == OBJECT_INTEGER || key.tag == OBJECT_STRING);
+}
+
+// Room for `length` keys before it has to grow. Maps made with a heap belong to its collector.
+ObjectMap *object_map_new(struct Heap *heap, u64 length);
+u64    object_map_bytes(ObjectMap *map);
+void   object_map_free(ObjectMap *map); // but not what's in it
+
+// Keys must be integers or strings. `value` may be NULL for only checking that the key is there.
+bool   object_map_get(ObjectMap *map, Object key, Object *value);
+void   object_map_set(ObjectMap *map, Object key, Object value);
+bool   object_map_delete(ObjectMap *map, Object key);
+
+#endif
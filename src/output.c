@@ -0,0 +1,197 @@
+#define _DEFAULT_SOURCE
+#include "output.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+
+OutputMode output_default_mode(int fd) {
+    return (isatty(fd) ? OUTPUT_LINE_BUFFERED : OUTPUT_FULLY_BUFFERED);
+}
+
+Output *output_new(int fd, OutputMode mode) {
+    Output *out = malloc(sizeof(Output));
+    out->fd = fd;
+    out->mode = mode;
+    out->used = 0;
+
+    // Anything printed through stdio so far has to come out first.
+    fflush(stdout);
+    return out;
+}
+
+static void write_all(int fd, const char *data, u64 length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return; // nowhere to report it, the same as a failed printf
+        }
+        data += written;
+        length -= (u64)written;
+    }
+}
+
+void output_flush(Output *out) {
+    if (out->used == 0) return;
+    write_all(out->fd, out->data, out->used);
+    out->used = 0;
+}
+
+void output_write(Output *out, const char *data, u64 length) {
+    if (out->used + length > OUTPUT_BUFFER_SIZE) output_flush(out);
+
+    // Anything too big for the buffer skips it.
+    if (length > OUTPUT_BUFFER_SIZE || out->mode == OUTPUT_UNBUFFERED) {
+        output_flush(out);
+        write_all(out->fd, data, length);
+        return;
+    }
+    memcpy(out->data + out->used, data, length);
+    out->used += length;
+}
+
+// Makes sure there are `length` bytes free at the end of the buffer.
+static char *output_reserve(Output *out, u64 length) {
+    if (out->used + length > OUTPUT_BUFFER_SIZE) output_flush(out);
+    return (out->data + out->used);
+}
+
+// Called after writing into the space from output_reserve.
+static void output_commit(Output *out, u64 length) {
+    out->used += length;
+    if (out->mode == OUTPUT_UNBUFFERED) output_flush(out);
+}
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Writes the digits of `value` so they end just before `end`, two at a time, and returns where they start.
+static char *format_digits(char *end, u64 value) {
+    while (value >= 100) {
+        const char *pair = digit_pairs + (value % 100) * 2;
+        value /= 100;
+        *--end = pair[1];
+        *--end = pair[0];
+    }
+    if (value >= 10) {
+        const char *pair = digit_pairs + value * 2;
+        *--end = pair[1];
+        *--end = pair[0];
+    } else {
+        *--end = (char)('0' + value);
+    }
+    return end;
+}
+
+void output_integer(Output *out, s64 value) {
+    char digits[20];
+    char *end = digits + sizeof(digits);
+    char *start = format_digits(end, (value < 0 ? -(u64)value : (u64)value));
+
+    char *at = output_reserve(out, 21);
+    u64 length = 0;
+    if (value < 0) at[length++] = '-';
+    memcpy(at + length, start, end - start);
+    output_commit(out, length + (end - start));
+}
+
+// Powers of ten which are exactly representable as doubles.
+static const f64 float_powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// Finds the fewest decimal places `places` for which `value` is exactly `digits` / 10^places, as a double.
+// Both are exact, and IEEE division is correctly rounded, so this is the same double as reading the decimal back.
+// That covers nearly every number a program prints; the rest (huge, tiny, or needing all 17 digits) return false.
+static bool shortest_fixed(f64 value, u64 *digits, int *places) {
+    for (int k = 0; k < (int)(sizeof(float_powers_of_ten) / sizeof(f64)); k++) {
+        f64 scaled = value * float_powers_of_ten[k];
+        if (scaled >= 9007199254740992.0) break; // 2^53, past which not every integer is a double
+        u64 m = (u64)(scaled + 0.5);
+        if ((f64)m / float_powers_of_ten[k] == value) {
+            *digits = m;
+            *places = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+void output_float(Output *out, f64 value) {
+    if (isnan(value)) {
+        output_write(out, "nan", 3);
+        return;
+    }
+
+    char *at = output_reserve(out, 32);
+    u64 length = 0;
+    if (signbit(value)) {
+        at[length++] = '-';
+        value = -value;
+    }
+    if (isinf(value)) {
+        memcpy(at + length, "inf", 3);
+        output_commit(out, length + 3);
+        return;
+    }
+
+    u64 m;
+    int places;
+    if (shortest_fixed(value, &m, &places)) {
+        // At least one digit before the point, so 0.05 is 5 padded to 005.
+        char digits[24];
+        char *end = digits + sizeof(digits);
+        char *start = format_digits(end, m);
+        while (end - start < places + 1) *--start = '0';
+
+        u64 whole = (end - start) - places;
+        memcpy(at + length, start, whole);
+        length += whole;
+        at[length++] = '.';
+        if (places == 0) {
+            at[length++] = '0';
+        } else {
+            memcpy(at + length, start + whole, places);
+            length += places;
+        }
+        output_commit(out, length);
+        return;
+    }
+
+    // Otherwise the first precision which reads back the same. 17 significant digits always do.
+    int written = 0;
+    for (int precision = 1; precision <= 17; precision++) {
+        written = snprintf(at + length, 32 - length, "%.*g", precision, value);
+        if (strtod(at + length, NULL) == value) break;
+    }
+    if (!memchr(at + length, '.', written) && !memchr(at + length, 'e', written)) {
+        memcpy(at + length + written, ".0", 2);
+        written += 2;
+    }
+    output_commit(out, length + written);
+}
+
+void output_end_line(Output *out) {
+    output_byte(out, '\n');
+    if (out->mode == OUTPUT_LINE_BUFFERED) output_flush(out);
+}
+
+void output_free(Output *out) {
+    if (!out) return;
+    output_flush(out);
+    free(out);
+}
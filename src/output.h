@@ -0,0 +1,46 @@
+#ifndef OUTPUT_h
+#define OUTPUT_h
+
+#include "common.h"
+
+// Where `print` writes to. Output is collected in a buffer and handed to write(2) in large pieces, rather than going
+// through stdio a few bytes at a time.
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+typedef enum OutputMode {
+    OUTPUT_FULLY_BUFFERED, // written when the buffer fills up, and when it's flushed
+    OUTPUT_LINE_BUFFERED,  // also at the end of each line
+    OUTPUT_UNBUFFERED,     // written straight away
+} OutputMode;
+
+typedef struct Output {
+    int fd;
+    OutputMode mode;
+    u64 used;
+    char data[OUTPUT_BUFFER_SIZE];
+} Output;
+
+// Terminals are line-buffered and everything else (files, pipes) fully buffered, the same as stdio does.
+OutputMode output_default_mode(int fd);
+
+Output *output_new(int fd, OutputMode mode);
+void    output_write(Output *out, const char *data, u64 length);
+void    output_end_line(Output *out);
+
+// Numbers are written straight into the buffer. Floats are written with as few digits as read back as the same
+// double, and always with a decimal point or an exponent so they don't look like integers.
+void    output_integer(Output *out, s64 value);
+void    output_float(Output *out, f64 value);
+
+void    output_flush(Output *out);
+void    output_free(Output *out); // flushes first
+
+static inline void output_byte(Output *out, char c) {
+    if (out->used == OUTPUT_BUFFER_SIZE || out->mode == OUTPUT_UNBUFFERED) {
+        output_write(out, &c, 1);
+        return;
+    }
+    out->data[out->used++] = c;
+}
+
+#endif
@@ -41,11 +41,12 @@ static AstNode *parse_simple_expression(Parser *p);
 
 static BlockStack block_stack;
 
-void parser_init(Parser *p, const TokenList tokens, char *file_name) {
+void parser_init(Parser *p, const TokenList tokens, char *file_name, Region *region) {
     p->token = tokens.data;
     p->file_name = file_name;
     p->error_count = 0;
-    node_allocator_init(&p->node_allocator);
+    p->region = region;
+    p->num_nodes = 0;
 }
 
 Ast run_parser(Parser *p) {
@@ -58,7 +59,7 @@ Ast run_parser(Parser *p) {
         if (p->token->type == Token_EOF) {
             break;
         }
-        array_add(ast, parse_statement(p));
+        region_array_add(p->region, ast, parse_statement(p));
     }
 
     return ast;
@@ -125,7 +126,7 @@ static AstNode *parse_block(Parser *p) {
         }
         AstNode *temp = parse_statement(p);
         if (!temp) break;
-        array_add(block, temp);
+        region_array_add(p->region, block, temp);
         stmt = temp;
     }
     match(p, Token_CLOSE_BRACE);
@@ -209,7 +210,7 @@ static AstNode *parse_lambda(Parser *p) {
         next(p);
         assert(match(p, Token_CLOSE_PAREN));
 
-        array_add(args->expression_list.expressions, single_arg);
+        region_array_add(p->region, args->expression_list.expressions, single_arg);
     }
     
     else if (!match(p, Token_CLOSE_PAREN)) {
@@ -248,7 +249,7 @@ static AstNode *parse_lambda(Parser *p) {
             return NULL;
         }
 
-        array_add(ast, single);
+        region_array_add(p->region, ast, single);
         pop_block(&block_stack);
 
         block->block.statements = ast;
@@ -275,13 +276,15 @@ static AstNode *parse_lambda(Parser *p) {
         arg->let.name = arg->identifier;
         arg->let.expr = NULL;
         arg->let.constant_pool_index = 0;
-        array_add(block->block.statements, arg);
+        region_array_add(p->region, block->block.statements, arg);
     }
 
     func->lambda.name = name;
     func->lambda.args = args;
     func->lambda.block = block;
     func->lambda.constant_pool_index = 0;
+    func->lambda.memo_table = -1;
+    func->lambda.flags = 0;
     return func;
 }
 
@@ -364,13 +367,13 @@ static AstNode *parse_expression_list(Parser *p) {
     
     if (match(p, Token_COMMA)) {
         Ast expressions;
-        array_init(expressions, AstNode);
-        array_add(expressions, or);
+        array_init(expressions, AstNode *);
+        region_array_add(p->region, expressions, or);
 
         do {
             AstNode *expr = parse_assignment(p);
             if (!expr) return NULL;
-            array_add(expressions, expr);
+            region_array_add(p->region, expressions, expr);
         } while(match(p, Token_COMMA));
         
         AstNode *new = make_node(p, NODE_EXPRESSION_LIST);
@@ -539,6 +542,7 @@ static AstNode *parse_call(Parser *p, AstNode *left) {
     AstNode *args = make_node(p, NODE_EXPRESSION_LIST);
 
     if (match(p, Token_CLOSE_PAREN)) {
+        array_init(args->expression_list.expressions, AstNode *);
         call->call.args = args;
         return call;
     }
@@ -556,7 +560,7 @@ static AstNode *parse_call(Parser *p, AstNode *left) {
     }
 
     array_init(args->expression_list.expressions, AstNode *);
-    array_add(args->expression_list.expressions, expr);
+    region_array_add(p->region, args->expression_list.expressions, expr);
     call->call.args = args;
     return call;
 }
@@ -625,6 +629,33 @@ static AstNode *parse_simple_expression(Parser *p) {
         return node;
     } break;
 
+    // Map literals, `{key: value, ...}`. A newline before the closing brace ends the last pair with a semi-colon.
+    case Token_OPEN_BRACE: {
+        next(p);
+        AstNode *node = make_node(p, NODE_MAP_LITERAL);
+        array_init(node->map_literal.keys, AstNode *);
+        array_init(node->map_literal.values, AstNode *);
+        while (!match(p, Token_CLOSE_BRACE)) {
+            AstNode *key = parse_logical_or(p);
+            if (!key) return NULL;
+            if (!match(p, Token_COLON)) {
+                parser_error(p, "expected ':'");
+                return NULL;
+            }
+            AstNode *value = parse_logical_or(p);
+            if (!value) return NULL;
+            region_array_add(p->region, node->map_literal.keys, key);
+            region_array_add(p->region, node->map_literal.values, value);
+
+            match(p, Token_SEMI_COLON);
+            if (p->token->type != Token_CLOSE_BRACE && !match(p, Token_COMMA)) {
+                parser_error(p, "expected ',' or '}'");
+                return NULL;
+            }
+        }
+        return node;
+    } break;
+
     case Token_MINUS: {
         AstNode *node = make_node(p, NODE_UNARY);
         node->unary.op = p->token->type;
@@ -692,47 +723,6 @@ static AstNode *parse_simple_expression(Parser *p) {
     }
 }
 
-bool node_allocator_init(NodeAllocator *allocator) {
-    NodeBlock *memory = (NodeBlock *)malloc(sizeof(NodeBlock));
-    if (!memory) {
-        return false;
-    }
-    *memory = (NodeBlock){0};
-    allocator->first   = memory;
-    allocator->current = memory;
-    allocator->num_blocks = 1;
-    return true;
-}
-
-AstNode *node_allocator(NodeAllocator *allocator) {
-    if (allocator->current->num_nodes+1 > NODE_BLOCK_LENGTH) {
-        NodeBlock *next = (NodeBlock *)malloc(sizeof(NodeBlock));
-        if (!next) {
-            printf("bad news, out of memory");
-            return NULL;
-        }
-        allocator->current->next = next;
-        allocator->current = next;
-        allocator->num_blocks++;
-    }
-
-    AstNode *out = (allocator->current->data + allocator->current->num_nodes);
-
-    allocator->current->num_nodes++;
-    allocator->total_nodes++;
-    
-    return out;
-}
-
-void node_allocator_free(NodeAllocator *allocator) {
-    NodeBlock *buffer = allocator->first;
-    while (buffer) {
-        NodeBlock *current = buffer;
-        buffer = current->next;
-        free(current);
-    }
-}
-
 static inline void next(Parser *p) {
     p->before = p->token++;
 }
@@ -777,10 +767,10 @@ static void parser_error(Parser *p, const char *fmt, ...) {
 }
 
 static AstNode *make_node(Parser *p, NodeTag tag) {
-    AstNode *node = node_allocator(&p->node_allocator);
-    assert(node);
+    AstNode *node = region_alloc(p->region, sizeof(AstNode));
+    *node = (AstNode){0};
     node->tag = tag;
     node->line = p->token->line;
-    // node->id = p->node_allocator.total_nodes-1;
+    p->num_nodes++;
     return node;
 }
@@ -0,0 +1,125 @@
+#include "region.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define REGION_ALIGNMENT 8
+
+static RegionChunk *new_chunk(u64 size) {
+    RegionChunk *chunk = (RegionChunk *)malloc(sizeof(RegionChunk) + size);
+    if (!chunk) {
+        printf("bad news, out of memory");
+        exit(-1);
+    }
+    chunk->next = NULL;
+    chunk->used = 0;
+    chunk->size = size;
+    return chunk;
+}
+
+void region_init(Region *r) {
+    *r = (Region){0};
+    r->first   = new_chunk(REGION_CHUNK_LENGTH);
+    r->current = r->first;
+    r->num_chunks = 1;
+}
+
+static void *allocate(Region *r, u64 size, u64 align) {
+    if (size >= REGION_LARGE_LENGTH) {
+        RegionChunk *block = new_chunk(size);
+        block->used = size;
+        block->next = r->large;
+        r->large = block;
+        r->num_large++;
+        r->large_bytes += size;
+        r->last = NULL;
+        return block->data;
+    }
+
+    RegionChunk *current = r->current;
+    u64 start = (current->used + align-1) & ~(align-1);
+    if (start + size > current->size) {
+        u64 next_size = current->size * 2;
+        if (next_size > REGION_MAX_CHUNK_LENGTH) next_size = REGION_MAX_CHUNK_LENGTH;
+
+        RegionChunk *next = new_chunk(next_size);
+        current->next = next;
+        r->num_chunks++;
+        r->wasted += current->size - current->used;
+        r->current = next;
+        current = next;
+        start = 0;
+    }
+
+    void *out = current->data + start;
+    current->used = start + size;
+    r->last = out;
+    return out;
+}
+
+void *region_alloc(Region *r, u64 size) {
+    return allocate(r, size, REGION_ALIGNMENT);
+}
+
+char *region_alloc_bytes(Region *r, u64 size) {
+    return (char *)allocate(r, size, 1);
+}
+
+// Grows the most recent allocation in place when there's room after it, otherwise copies it somewhere new.
+void *region_realloc(Region *r, void *data, u64 old_size, u64 size) {
+    if (data && data == r->last) {
+        RegionChunk *current = r->current;
+        u64 start = (u64)((u8 *)data - current->data);
+        if (start + size <= current->size && size < REGION_LARGE_LENGTH) {
+            current->used = start + size;
+            return data;
+        }
+    }
+    void *out = region_alloc(r, size);
+    if (old_size) memcpy(out, data, old_size);
+    return out;
+}
+
+void region_print_stats(Region *r) {
+    u64 used = 0, size = 0;
+    for (RegionChunk *chunk = r->first; chunk; chunk = chunk->next) {
+        used += chunk->used;
+        size += chunk->size;
+    }
+    printf("%ld chunks holding %ld of %ld bytes (%ld wasted at the ends of full ones), and %ld large blocks of %ld bytes.\n",
+           r->num_chunks, used, size, r->wasted, r->num_large, r->large_bytes);
+
+    u64 i = 0;
+    for (RegionChunk *chunk = r->first; chunk; chunk = chunk->next, i++) {
+        printf("  chunk %ld: %ld of %ld bytes, %ld%% occupied\n", i, chunk->used, chunk->size, (chunk->used * 100) / chunk->size);
+    }
+}
+
+static void free_chunks(RegionChunk *chunk) {
+    while (chunk) {
+        RegionChunk *current = chunk;
+        chunk = current->next;
+        free(current);
+    }
+}
+
+// Frees everything but the first chunk, and empties that.
+void region_reset(Region *r) {
+    free_chunks(r->first->next);
+    free_chunks(r->large);
+
+    RegionChunk *first = r->first;
+    first->next = NULL;
+    first->used = 0;
+    *r = (Region){0};
+    r->first   = first;
+    r->current = first;
+    r->num_chunks = 1;
+}
+
+void region_free(Region *r) {
+    free_chunks(r->first);
+    free_chunks(r->large);
+    *r = (Region){0};
+}
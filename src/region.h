@@ -0,0 +1,47 @@
+#ifndef REGION_h
+#define REGION_h
+
+#include "common.h"
+#include "array.h"
+
+// Region allocators, one for each phase of running a program (lexing, parsing and compiling), so that everything a
+// phase made is released at once. Memory is carved out of chunks which double in size, from REGION_CHUNK_LENGTH up to
+// REGION_MAX_CHUNK_LENGTH. Anything of REGION_LARGE_LENGTH or more gets a block of its own.
+//
+// Resetting a region keeps its first chunk, so running another program with the same regions starts out without
+// calling malloc.
+#define REGION_CHUNK_LENGTH     4096
+#define REGION_MAX_CHUNK_LENGTH (256 * 1024)
+#define REGION_LARGE_LENGTH     (16 * 1024)
+
+typedef struct RegionChunk {
+    struct RegionChunk *next;
+    u64 used;
+    u64 size;
+    u8  data[];
+} RegionChunk;
+
+typedef struct Region {
+    RegionChunk *first;
+    RegionChunk *current;
+    RegionChunk *large;   // blocks of their own, most recent first
+    u64 num_chunks;
+    u64 num_large;
+    u64 large_bytes;
+    u64 wasted;           // bytes left unused at the end of chunks which were full
+    void *last;           // the most recent allocation, which region_realloc can grow in place
+} Region;
+
+void  region_init(Region *r);
+void *region_alloc(Region *r, u64 size);        // aligned for any type
+char *region_alloc_bytes(Region *r, u64 size);  // not aligned, for strings
+void *region_realloc(Region *r, void *data, u64 old_size, u64 size);
+void  region_print_stats(Region *r);
+void  region_reset(Region *r);
+void  region_free(Region *r);
+
+// Like array_add, for arrays whose storage comes from a region. Storage it grows out of stays in the region.
+#define region_array_grow(_region, _arr) ((_arr).capacity = ((_arr).capacity ? (_arr).capacity*2 : ARRAY_MIN_CAPACITY), (_arr).data=region_realloc((_region), (_arr).data, (_arr).length*(_arr).elem_size, (_arr).capacity*(_arr).elem_size))
+#define region_array_add(_region, _arr, _elem) ((_arr).length+1>(_arr).capacity ? region_array_grow((_region), (_arr)) : 0, (_arr).data[(_arr).length++] = _elem)
+
+#endif
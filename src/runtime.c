@@ -0,0 +1,587 @@
+// Operations on values, used both by the interpreter and by programs compiled to C.
+#include "context.h"
+#include "runtime.h"
+#include "simd.h"
+#include "gc.h"
+#include "map.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+void runtime_error(Interp *interp, Instruction instr, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+
+    // What the program printed before the error comes out before it.
+    if (interp->out) output_flush(interp->out);
+
+    // The weird looking escape characters are to: set the text color to red, print "Error", and then reset the colour.
+    fprintf(stderr, "%s:%lu: \033[0;31mRuntime error\033[0m: ", interp->file_name, instr.line_number);
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, ".\n");
+    va_end(args);
+
+    interp->error_count++;
+}
+
+static void print_literal(Output *out, const char *text) {
+    output_write(out, text, strlen(text));
+}
+
+void runtime_print(Output *out, Object value) {
+    switch (value.tag) {
+    case OBJECT_BOOLEAN:   print_literal(out, (value.boolean ? "true" : "false")); break;
+    case OBJECT_INTEGER:   output_integer(out, value.integer); break;
+    case OBJECT_FLOATING:  output_float(out, value.floating); break;
+    case OBJECT_STRING:    output_write(out, object_string_data(&value), value.string.length); break;
+    case OBJECT_NULL:      print_literal(out, "null"); break;
+    case OBJECT_UNDEFINED: print_literal(out, "undefined"); break;
+
+    case OBJECT_ARRAY: {
+        output_byte(out, '[');
+        for (u64 i = 0; i < value.array->length; i++) {
+            runtime_print(out, object_array_get(value.array, i));
+            if (i < value.array->length-1) {
+                output_write(out, ", ", 2);
+            }
+        }
+        output_byte(out, ']');
+    } break;
+
+    // In the order the keys were first set.
+    case OBJECT_MAP: {
+        ObjectMap *map = value.map;
+        output_byte(out, '{');
+        u64 printed = 0;
+        for (u64 i = 0; i < map->num_entries; i++) {
+            MapEntry entry = map->entries[i];
+            if (entry.key.tag == OBJECT_UNDEFINED) continue;
+            if (printed++) output_write(out, ", ", 2);
+            runtime_print(out, entry.key);
+            output_write(out, ": ", 2);
+            runtime_print(out, entry.value);
+        }
+        output_byte(out, '}');
+    } break;
+
+    default: assert(false); break;
+    }
+}
+
+static u8 runtime_equals1(Object a, Object b) {
+    if (a.tag == OBJECT_FLOATING) {
+        if (b.tag == OBJECT_INTEGER) {
+            return ((u64)a.floating == b.integer);
+        }
+    }
+
+    if (a.tag != b.tag) return 0;
+
+    switch (a.tag) {
+    case OBJECT_FLOATING:  return a.floating == b.floating;            break;
+    case OBJECT_STRING:    return object_string_equals(a, b);          break;
+    case OBJECT_INTEGER:   return a.integer == b.integer;              break;
+    case OBJECT_BOOLEAN:   return a.boolean == b.boolean;              break;
+    case OBJECT_NULL:      return (b.tag == OBJECT_NULL);              break;
+    case OBJECT_UNDEFINED: return (b.tag == OBJECT_UNDEFINED);         break;
+    case OBJECT_MAP:       return (a.map == b.map);                    break;
+    
+    default: assert(false); break;
+    }
+}
+
+u8 runtime_equals(Object a, Object b) {
+    return (runtime_equals1(a, b) || runtime_equals1(b, a));
+}
+
+// Short results are made in the object, longer ones in a StringBuilder owned by the collector. Results of
+// STRING_BUILDER_MIN_LENGTH or more get a builder twice the size needed. Adding to the end of the longest string in
+// a builder then just copies the new part in after it, so `s = s + piece` in a loop takes linear time rather than
+// quadratic. Other strings in the same builder are unaffected, they keep their own lengths.
+Object runtime_string_concat(Interp *interp, Object a, Object b) {
+    u64 a_len = a.string.length;
+    u64 b_len = b.string.length;
+    u64 length = a_len + b_len;
+
+    if (a_len > STRING_INLINE_LENGTH && a.string.built) {
+        StringBuilder *builder = (StringBuilder *)(a.string.data - offsetof(StringBuilder, data));
+        if (builder->used == a_len && length < builder->capacity) {
+            memcpy(builder->data + a_len, object_string_data(&b), b_len);
+            builder->data[length] = 0;
+            builder->used = length;
+
+            Object result = object_string(builder->data, length);
+            result.string.built = true;
+            return result;
+        }
+    }
+
+    char buffer[STRING_INLINE_LENGTH];
+    char *data = buffer;
+    bool built = (length > STRING_INLINE_LENGTH);
+    if (built) {
+        StringBuilder *builder = gc_string_builder(interp, (length >= STRING_BUILDER_MIN_LENGTH ? length*2 : length + 1));
+        builder->used = length;
+        data = builder->data;
+    }
+
+    memcpy(data, object_string_data(&a), a_len);
+    memcpy(data + a_len, object_string_data(&b), b_len);
+    if (built) data[length] = 0;
+
+    Object result = object_string(data, length);
+    if (built) result.string.built = true;
+    return result;
+}
+
+s64 runtime_len(Object o) {
+    if (o.tag == OBJECT_ARRAY) {
+        return o.array->length;
+    }
+    if (o.tag == OBJECT_STRING) {
+        return o.string.length;
+    }
+    if (o.tag == OBJECT_MAP) {
+        return o.map->length;
+    }
+    return -1;
+}
+
+static const char *binary_mismatch_error(Op op) {
+    switch (op) {
+    case ADD: return "type mismatch: cannot add two different types";
+    case SUB: return "type mismatch: cannot subtract two different types";
+    case MUL:
+    case DIV: return "type mismatch: cannot multiply two different types";
+    default:  return "type mismatch: cannot compare two different types";
+    }
+}
+
+static const char *binary_operand_error(Op op) {
+    switch (op) {
+    case ADD:                 return "operands of addition must be integer, float or string";
+    case SUB:                 return "operands of subtraction must be numerical";
+    case MUL:                 return "operands of multiplication must be numerical";
+    case DIV:                 return "operands of division must be numerical";
+    case LESS_THAN:           return "operands of '<' must be integer or float";
+    case LESS_THAN_EQUALS:    return "operands of '<=' must be integer or float";
+    case GREATER_THAN:        return "operands of '>' must be integer or float";
+    case GREATER_THAN_EQUALS: return "operands of '>=' must be integer or float";
+    default: assert(false); return NULL;
+    }
+}
+
+bool runtime_binary(Interp *interp, Instruction instr, Stack *stack) {
+    Object right = stack_pop(stack);
+    Object left  = stack_pop(stack);
+
+    Object result = (Object){0};
+    if (instr.op == EQUALS) {
+        result.tag = OBJECT_BOOLEAN;
+        result.boolean = runtime_equals(left, right);
+        stack_push(stack, result);
+        return true;
+    }
+
+    if (left.tag != right.tag) {
+        runtime_error(interp, instr, "%s", binary_mismatch_error(instr.op));
+        return false;
+    }
+
+    bool comparison = (instr.op == LESS_THAN || instr.op == LESS_THAN_EQUALS || instr.op == GREATER_THAN || instr.op == GREATER_THAN_EQUALS);
+    result.tag = (comparison ? OBJECT_BOOLEAN : left.tag);
+
+    switch (left.tag) {
+    case OBJECT_INTEGER: {
+        s64 a = left.integer, b = right.integer;
+        switch (instr.op) {
+        case ADD:                 result.integer = a + b;  break;
+        case SUB:                 result.integer = a - b;  break;
+        case MUL:                 result.integer = a * b;  break;
+        case DIV:                 result.integer = a / b;  break;
+        case LESS_THAN:           result.boolean = a < b;  break;
+        case LESS_THAN_EQUALS:    result.boolean = a <= b; break;
+        case GREATER_THAN:        result.boolean = a > b;  break;
+        case GREATER_THAN_EQUALS: result.boolean = a >= b; break;
+        default: assert(false); break;
+        }
+    } break;
+
+    case OBJECT_FLOATING: {
+        f64 a = left.floating, b = right.floating;
+        switch (instr.op) {
+        case ADD:                 result.floating = a + b; break;
+        case SUB:                 result.floating = a - b; break;
+        case MUL:                 result.floating = a * b; break;
+        case DIV:                 result.floating = a / b; break;
+        case LESS_THAN:           result.boolean = a < b;  break;
+        case LESS_THAN_EQUALS:    result.boolean = a <= b; break;
+        case GREATER_THAN:        result.boolean = a > b;  break;
+        case GREATER_THAN_EQUALS: result.boolean = a >= b; break;
+        default: assert(false); break;
+        }
+    } break;
+
+    case OBJECT_STRING: {
+        if (instr.op != ADD) {
+            runtime_error(interp, instr, "%s", binary_operand_error(instr.op));
+            return false;
+        }
+        result = runtime_string_concat(interp, left, right);
+        stack_push(stack, result);
+        gc_safe_point(interp);
+        return true;
+    } break;
+
+    default: {
+        runtime_error(interp, instr, "%s", binary_operand_error(instr.op));
+        return false;
+    } break;
+    }
+
+    stack_push(stack, result);
+    return true;
+}
+
+bool runtime_negate(Interp *interp, Instruction instr, Stack *stack) {
+    Object negate = stack_pop(stack);
+    Object result = (Object){0};
+    result.tag = negate.tag;
+    if (negate.tag == OBJECT_INTEGER) {
+        result.integer = -negate.integer;
+    } else if (negate.tag == OBJECT_FLOATING) {
+        result.floating = -negate.floating;
+    } else {
+        runtime_error(interp, instr, "operand of unary negation must be numerical");
+        return false;
+    }
+    stack_push(stack, result);
+    return true;
+}
+
+void runtime_print_arguments(Interp *interp, Instruction instr) {
+    Output *out = interp->out;
+    for (int i = 0; i < instr.arg; i++) {
+        runtime_print(out, stack_pop(&interp->call_storage));
+        output_byte(out, ' ');
+    }
+    output_end_line(out);
+}
+
+// Appends to the array in place, so everything referring to it sees the new element.
+bool runtime_append_in_place(Interp *interp, Instruction instr, StackFrame *scope) {
+    Object value  = stack_pop(&interp->call_storage);
+    Object target = scope->constant_pool.data[instr.arg];
+
+    if (target.tag != OBJECT_ARRAY) {
+        runtime_error(interp, instr, "attempt to append to non-array");
+        return false;
+    }
+
+    ObjectArray *array = target.array;
+    u64 bytes = object_array_bytes(array);
+    object_array_add(array, value);
+    interp->heap->bytes += object_array_bytes(array) - bytes; // arrays only grow
+    gc_safe_point(interp);
+    return true;
+}
+
+bool runtime_append(Interp *interp, Instruction instr, StackFrame *scope) {
+    if (!runtime_append_in_place(interp, instr, scope)) return false;
+    stack_push(&interp->call_storage, scope->constant_pool.data[instr.arg]);
+    return true;
+}
+
+bool runtime_builtin_len(Interp *interp, Instruction instr, StackFrame *scope) {
+    Object value = scope->constant_pool.data[instr.arg];
+    Object result = (Object){0};
+    s64 len = runtime_len(value);
+    if (len == -1) {
+        runtime_error(interp, instr, "argument of 'len' must be array, string or map");
+        return false;
+    }
+    result.integer = len;
+    result.tag = OBJECT_INTEGER;
+    stack_push(&interp->call_storage, result);
+    return true;
+}
+
+//
+// The numeric array builtins: sum(a), min(a), max(a), dot(a, b), scale(a, k) and fill(n, v).
+// Integer and float arrays are handed straight to the kernels in simd.c.
+//
+static const char *array_builtin_name(Op op) {
+    switch (op) {
+    case SUM:   return "sum";
+    case MIN:   return "min";
+    case MAX:   return "max";
+    case DOT:   return "dot";
+    case SCALE: return "scale";
+    default:    return "fill";
+    }
+}
+
+// Points `out` at the elements of an array as s64s or f64s, or returns false if they aren't all numbers of one type.
+// An array of objects holding only numbers is unboxed into a copy, which is returned for the caller to free.
+static bool numeric_elements(ObjectArray *array, ArrayKind *kind, void **out, void **copy) {
+    *copy = NULL;
+    if (array->kind != ARRAY_OBJECTS) {
+        *kind = array->kind;
+        *out = array->data;
+        return true;
+    }
+
+    ObjectTag tag = (array->length ? array->data[0].tag : OBJECT_INTEGER);
+    if (tag != OBJECT_INTEGER && tag != OBJECT_FLOATING) return false;
+
+    s64 *elements = malloc(array->length * sizeof(s64) + 1);
+    for (u64 i = 0; i < array->length; i++) {
+        if (array->data[i].tag != tag) {
+            free(elements);
+            return false;
+        }
+        elements[i] = array->data[i].integer; // the bits of a float too
+    }
+    *kind = (tag == OBJECT_INTEGER ? ARRAY_INTEGERS : ARRAY_FLOATS);
+    *out = *copy = elements;
+    return true;
+}
+
+static bool builtin_fill(Interp *interp, Instruction instr, Object count, Object value) {
+    if (count.tag != OBJECT_INTEGER || count.integer < 0) {
+        runtime_error(interp, instr, "first argument of 'fill' must be a non-negative integer");
+        return false;
+    }
+
+    ArrayKind kind = ARRAY_OBJECTS;
+    if (value.tag == OBJECT_INTEGER) kind = ARRAY_INTEGERS;
+    if (value.tag == OBJECT_FLOATING) kind = ARRAY_FLOATS;
+
+    ObjectArray *array = object_array_of(interp->heap, kind, count.integer);
+    if (kind != ARRAY_OBJECTS) {
+        simd_fill_64(array->data, (u64)value.integer, array->length);
+    } else {
+        for (u64 i = 0; i < array->length; i++) {
+            array->data[i] = value;
+            // Each element gets its own array, as if they had been appended one at a time from a literal.
+            if (value.tag == OBJECT_ARRAY) array->data[i].array = object_array_copy(interp->heap, value.array);
+        }
+    }
+    stack_push(&interp->call_storage, (Object){.array = array, .tag = OBJECT_ARRAY});
+    gc_safe_point(interp);
+    return true;
+}
+
+bool runtime_array_builtin(Interp *interp, Instruction instr, StackFrame *scope) {
+    Object first  = scope->constant_pool.data[instr.arg];
+    Object second = (Object){0};
+    if (instr.op == DOT || instr.op == SCALE || instr.op == FILL) second = stack_pop(&interp->call_storage);
+    if (instr.op == FILL) return builtin_fill(interp, instr, first, second);
+
+    const char *name = array_builtin_name(instr.op);
+    if (first.tag != OBJECT_ARRAY) {
+        runtime_error(interp, instr, "first argument of '%s' must be an array", name);
+        return false;
+    }
+
+    ArrayKind kind;
+    void *x, *x_copy;
+    if (!numeric_elements(first.array, &kind, &x, &x_copy)) {
+        runtime_error(interp, instr, "elements of '%s' must all be integers or all be floats", name);
+        return false;
+    }
+
+    u64 n = first.array->length;
+    bool floats = (kind == ARRAY_FLOATS);
+    Object result = (Object){.tag = (floats ? OBJECT_FLOATING : OBJECT_INTEGER)};
+    bool ok = true;
+
+    switch (instr.op) {
+    case SUM: {
+        if (floats) result.floating = simd_sum_f64(x, n);
+        else result.integer = simd_sum_s64(x, n);
+    } break;
+
+    case MIN:
+    case MAX: {
+        if (n == 0) {
+            runtime_error(interp, instr, "'%s' of an empty array", name);
+            ok = false;
+        } else if (floats) {
+            result.floating = (instr.op == MIN ? simd_min_f64(x, n) : simd_max_f64(x, n));
+        } else {
+            result.integer = (instr.op == MIN ? simd_min_s64(x, n) : simd_max_s64(x, n));
+        }
+    } break;
+
+    case DOT: {
+        ArrayKind y_kind;
+        void *y, *y_copy = NULL;
+        if (second.tag != OBJECT_ARRAY || second.array->length != n) {
+            runtime_error(interp, instr, "second argument of 'dot' must be an array of the same length");
+            ok = false;
+        } else if (!numeric_elements(second.array, &y_kind, &y, &y_copy)) {
+            runtime_error(interp, instr, "elements of 'dot' must all be integers or all be floats");
+            ok = false;
+        } else if (y_kind != kind && n > 0) {
+            runtime_error(interp, instr, "%s", binary_mismatch_error(MUL));
+            ok = false;
+        } else if (floats) {
+            result.floating = simd_dot_f64(x, y, n);
+        } else {
+            result.integer = simd_dot_s64(x, y, n);
+        }
+        free(y_copy);
+    } break;
+
+    case SCALE: {
+        ObjectTag tag = (n ? result.tag : second.tag);
+        if (second.tag != OBJECT_INTEGER && second.tag != OBJECT_FLOATING) {
+            runtime_error(interp, instr, "second argument of 'scale' must be an integer or a float");
+            ok = false;
+        } else if (second.tag != tag) {
+            runtime_error(interp, instr, "%s", binary_mismatch_error(MUL));
+            ok = false;
+        } else {
+            ObjectArray *array;
+            if (tag == OBJECT_FLOATING) {
+                array = object_array_of(interp->heap, ARRAY_FLOATS, n);
+                simd_scale_f64(array->floats, x, second.floating, n);
+            } else {
+                array = object_array_of(interp->heap, ARRAY_INTEGERS, n);
+                simd_scale_s64(array->integers, x, second.integer, n);
+            }
+            result = (Object){.array = array, .tag = OBJECT_ARRAY};
+        }
+    } break;
+
+    default: break;
+    }
+
+    free(x_copy);
+    if (ok) stack_push(&interp->call_storage, result);
+    if (ok && instr.op == SCALE) gc_safe_point(interp);
+    return ok;
+}
+
+bool runtime_subscript(Interp *interp, Instruction instr, StackFrame *scope) {
+    Object index = stack_pop(&scope->stack);
+    Object array = scope->constant_pool.data[instr.arg];
+    if (array.tag == OBJECT_MAP) {
+        runtime_error(interp, instr, "use get(m, k) to index a map");
+        return false;
+    }
+    if (array.tag != OBJECT_ARRAY) {
+        runtime_error(interp, instr, "only arrays can be subscripted");
+        return false;
+    }
+    scope->constant_pool.data[ARRAY_SUBSCRIPT_RESULT_INDEX] = object_array_get(array.array, index.integer);
+    return true;
+}
+
+// Array literals are evaluated by copying the array built at compile time, so each evaluation gives a new array.
+void runtime_new_array(Interp *interp, Instruction instr, StackFrame *scope) {
+    Object array = scope->constant_pool.data[instr.arg];
+    array.array = object_array_copy(interp->heap, array.array);
+    array.non_mutable = false;
+    stack_push(&scope->stack, array);
+    gc_safe_point(interp);
+}
+
+//
+// Maps: get(m, k), set(m, k, v), has(m, k) and delete(m, k). See map.c.
+// `get` gives null for keys which aren't in the map, and `set` gives the map, like `append`.
+//
+static const char *map_builtin_name(Op op) {
+    switch (op) {
+    case MAP_GET: return "get";
+    case MAP_SET: return "set";
+    case MAP_HAS: return "has";
+    default:      return "delete";
+    }
+}
+
+bool runtime_map_builtin(Interp *interp, Instruction instr, StackFrame *scope) {
+    Object target = scope->constant_pool.data[instr.arg];
+    Object key    = stack_pop(&interp->call_storage);
+    Object value  = (instr.op == MAP_SET ? stack_pop(&interp->call_storage) : (Object){0});
+
+    if (target.tag != OBJECT_MAP) {
+        runtime_error(interp, instr, "first argument of '%s' must be a map", map_builtin_name(instr.op));
+        return false;
+    }
+    if (!object_map_is_key(key)) {
+        runtime_error(interp, instr, "keys of a map must be integers or strings");
+        return false;
+    }
+
+    ObjectMap *map = target.map;
+    Object result = (Object){.tag = OBJECT_BOOLEAN};
+    switch (instr.op) {
+    case MAP_GET: {
+        if (!object_map_get(map, key, &result)) result = (Object){.tag = OBJECT_NULL};
+    } break;
+
+    case MAP_SET: {
+        u64 bytes = object_map_bytes(map);
+        object_map_set(map, key, value);
+        interp->heap->bytes += object_map_bytes(map) - bytes; // maps only grow
+        result = target;
+    } break;
+
+    case MAP_HAS:    result.boolean = object_map_get(map, key, NULL); break;
+    case MAP_DELETE: result.boolean = object_map_delete(map, key);    break;
+    default: break;
+    }
+
+    stack_push(&interp->call_storage, result);
+    if (instr.op == MAP_SET) gc_safe_point(interp);
+    return true;
+}
+
+// Map literals are built each time they're evaluated, from the `instr.arg` keys and values loaded before it.
+bool runtime_new_map(Interp *interp, Instruction instr, StackFrame *scope) {
+    Stack *stack = &scope->stack;
+    u64 count = instr.arg;
+    Object *pairs = stack->data + stack->top - 2*count + 1;
+    for (u64 i = 0; i < count; i++) {
+        if (!object_map_is_key(pairs[2*i])) {
+            runtime_error(interp, instr, "keys of a map must be integers or strings");
+            return false;
+        }
+    }
+
+    ObjectMap *map = object_map_new(interp->heap, count);
+    for (u64 i = 0; i < count; i++) object_map_set(map, pairs[2*i], pairs[2*i + 1]);
+    for (u64 i = 0; i < 2*count; i++) stack_pop(stack);
+
+    stack_push(stack, (Object){.map = map, .tag = OBJECT_MAP});
+    gc_safe_point(interp);
+    return true;
+}
+
+//
+// Support for programs compiled with -emit-c, which build their frames from static data instead of compiling.
+//
+void runtime_init(Interp *interp, char *file_name) {
+    memset(interp, 0, sizeof(Interp));
+    interp->file_name = file_name;
+    interp->out = output_new(STDOUT_FILENO, output_default_mode(STDOUT_FILENO));
+    gc_init(interp);
+}
+
+StackFrame *runtime_frame(Interp *interp, Object *constants, u64 count) {
+    StackFrame *frame = calloc(1, sizeof(StackFrame));
+    array_init(frame->constant_pool, Object);
+    for (u64 i = 0; i < count; i++) {
+        Object o = constants[i];
+        // Arrays are written out statically, the copy is on the heap so it can grow.
+        if (o.tag == OBJECT_ARRAY) o.array = object_array_copy(interp->heap, o.array);
+        array_add(frame->constant_pool, o);
+    }
+    return frame;
+}
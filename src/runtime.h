@@ -0,0 +1,39 @@
+#ifndef RUNTIME_h
+#define RUNTIME_h
+
+#include "context.h"
+#include "common.h"
+#include "output.h"
+
+// Operations on values shared by the interpreter and by programs compiled to C with -emit-c.
+// The ones taking an instruction report a runtime error against its line and return false if they fail.
+
+void  runtime_error(Interp *interp, Instruction instr, const char *fmt, ...);
+void  runtime_print(Output *out, Object value);
+u8    runtime_equals(Object a, Object b);
+Object runtime_string_concat(Interp *interp, Object a, Object b);
+s64   runtime_len(Object o);
+
+// Pops two operands from `stack` and pushes the result of the generic arithmetic or comparison `instr.op`.
+bool runtime_binary(Interp *interp, Instruction instr, Stack *stack);
+bool runtime_negate(Interp *interp, Instruction instr, Stack *stack);
+
+// The builtins. Arguments are on call_storage, and `instr.arg` is the array or string's slot in `scope`.
+void runtime_print_arguments(Interp *interp, Instruction instr);
+bool runtime_append(Interp *interp, Instruction instr, StackFrame *scope);
+bool runtime_append_in_place(Interp *interp, Instruction instr, StackFrame *scope);
+bool runtime_builtin_len(Interp *interp, Instruction instr, StackFrame *scope);
+bool runtime_array_builtin(Interp *interp, Instruction instr, StackFrame *scope); // SUM, MIN, MAX, DOT, SCALE and FILL
+bool runtime_subscript(Interp *interp, Instruction instr, StackFrame *scope);
+void runtime_new_array(Interp *interp, Instruction instr, StackFrame *scope);
+
+// MAP_GET, MAP_SET, MAP_HAS and MAP_DELETE, with the map's slot in `instr.arg` and the key (then value) on call_storage.
+bool runtime_map_builtin(Interp *interp, Instruction instr, StackFrame *scope);
+// Pops `instr.arg` keys and values from the frame's stack and pushes the map made of them.
+bool runtime_new_map(Interp *interp, Instruction instr, StackFrame *scope);
+
+// Used by programs compiled with -emit-c in place of `compile`.
+void runtime_init(Interp *interp, char *file_name);
+StackFrame *runtime_frame(Interp *interp, Object *constants, u64 count);
+
+#endif
@@ -0,0 +1,267 @@
+#include "simd.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_X86
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2")))
+
+static bool has_avx2(void) {
+    static int supported = -1;
+    if (supported < 0) {
+        __builtin_cpu_init();
+        supported = (__builtin_cpu_supports("avx2") != 0);
+    }
+    return supported;
+}
+#endif
+
+// Each variant of a float reduction leaves lane j holding the elements at i % 4 == j, for the first
+// n & ~3 elements. The lanes are then combined the same way and the rest added one at a time.
+static f64 combine_lanes(const f64 lanes[4]) {
+    return (lanes[0] + lanes[2]) + (lanes[1] + lanes[3]);
+}
+
+#ifdef SIMD_X86
+
+//
+// AVX2, four elements at a time.
+//
+AVX2 static void sum_f64_avx2(const f64 *x, u64 n, f64 lanes[4]) {
+    __m256d acc = _mm256_setzero_pd();
+    for (u64 i = 0; i < n; i += 4) acc = _mm256_add_pd(acc, _mm256_loadu_pd(x + i));
+    _mm256_storeu_pd(lanes, acc);
+}
+
+AVX2 static void dot_f64_avx2(const f64 *x, const f64 *y, u64 n, f64 lanes[4]) {
+    __m256d acc = _mm256_setzero_pd();
+    for (u64 i = 0; i < n; i += 4) {
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    }
+    _mm256_storeu_pd(lanes, acc);
+}
+
+AVX2 static u64 sum_s64_avx2(const s64 *x, u64 n) {
+    __m256i acc = _mm256_setzero_si256();
+    for (u64 i = 0; i < n; i += 4) acc = _mm256_add_epi64(acc, _mm256_loadu_si256((const __m256i *)(x + i)));
+    u64 lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+AVX2 static void minmax_s64_avx2(const s64 *x, u64 n, bool max, s64 lanes[4]) {
+    __m256i acc = _mm256_loadu_si256((const __m256i *)x);
+    for (u64 i = 4; i < n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(x + i));
+        __m256i greater = _mm256_cmpgt_epi64(acc, v);
+        acc = (max ? _mm256_blendv_epi8(v, acc, greater) : _mm256_blendv_epi8(acc, v, greater));
+    }
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+}
+
+AVX2 static void minmax_f64_avx2(const f64 *x, u64 n, bool max, f64 lanes[4]) {
+    __m256d acc = _mm256_loadu_pd(x);
+    for (u64 i = 4; i < n; i += 4) {
+        __m256d v = _mm256_loadu_pd(x + i);
+        acc = (max ? _mm256_max_pd(acc, v) : _mm256_min_pd(acc, v));
+    }
+    _mm256_storeu_pd(lanes, acc);
+}
+
+AVX2 static void scale_f64_avx2(f64 *out, const f64 *x, f64 k, u64 n) {
+    __m256d factor = _mm256_set1_pd(k);
+    for (u64 i = 0; i < n; i += 4) _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(x + i), factor));
+}
+
+AVX2 static void fill_64_avx2(u64 *out, u64 bits, u64 n) {
+    __m256i v = _mm256_set1_epi64x((long long)bits);
+    for (u64 i = 0; i < n; i += 4) _mm256_storeu_si256((__m256i *)(out + i), v);
+}
+
+//
+// SSE2, which every x86-64 processor has. Two registers of two elements stand in for one AVX2 register.
+// It has no 64-bit integer comparison, so integer min and max use the plain loops below.
+//
+static void sum_f64_sse2(const f64 *x, u64 n, f64 lanes[4]) {
+    __m128d lo = _mm_setzero_pd(), hi = _mm_setzero_pd();
+    for (u64 i = 0; i < n; i += 4) {
+        lo = _mm_add_pd(lo, _mm_loadu_pd(x + i));
+        hi = _mm_add_pd(hi, _mm_loadu_pd(x + i + 2));
+    }
+    _mm_storeu_pd(lanes, lo);
+    _mm_storeu_pd(lanes + 2, hi);
+}
+
+static void dot_f64_sse2(const f64 *x, const f64 *y, u64 n, f64 lanes[4]) {
+    __m128d lo = _mm_setzero_pd(), hi = _mm_setzero_pd();
+    for (u64 i = 0; i < n; i += 4) {
+        lo = _mm_add_pd(lo, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+        hi = _mm_add_pd(hi, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(y + i + 2)));
+    }
+    _mm_storeu_pd(lanes, lo);
+    _mm_storeu_pd(lanes + 2, hi);
+}
+
+static u64 sum_s64_sse2(const s64 *x, u64 n) {
+    __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    for (u64 i = 0; i < n; i += 4) {
+        lo = _mm_add_epi64(lo, _mm_loadu_si128((const __m128i *)(x + i)));
+        hi = _mm_add_epi64(hi, _mm_loadu_si128((const __m128i *)(x + i + 2)));
+    }
+    u64 lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(lo, hi));
+    return lanes[0] + lanes[1];
+}
+
+static void minmax_f64_sse2(const f64 *x, u64 n, bool max, f64 lanes[4]) {
+    __m128d lo = _mm_loadu_pd(x), hi = _mm_loadu_pd(x + 2);
+    for (u64 i = 4; i < n; i += 4) {
+        __m128d a = _mm_loadu_pd(x + i), b = _mm_loadu_pd(x + i + 2);
+        lo = (max ? _mm_max_pd(lo, a) : _mm_min_pd(lo, a));
+        hi = (max ? _mm_max_pd(hi, b) : _mm_min_pd(hi, b));
+    }
+    _mm_storeu_pd(lanes, lo);
+    _mm_storeu_pd(lanes + 2, hi);
+}
+
+static void scale_f64_sse2(f64 *out, const f64 *x, f64 k, u64 n) {
+    __m128d factor = _mm_set1_pd(k);
+    for (u64 i = 0; i < n; i += 2) _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(x + i), factor));
+}
+
+static void fill_64_sse2(u64 *out, u64 bits, u64 n) {
+    __m128i v = _mm_set1_epi64x((long long)bits);
+    for (u64 i = 0; i < n; i += 2) _mm_storeu_si128((__m128i *)(out + i), v);
+}
+
+#endif
+
+//
+// The kernels. Integer arithmetic wraps around on overflow.
+//
+s64 simd_sum_s64(const s64 *x, u64 n) {
+    u64 body = n & ~3ul;
+    u64 total = 0;
+#ifdef SIMD_X86
+    total = (has_avx2() ? sum_s64_avx2(x, body) : sum_s64_sse2(x, body));
+#else
+    for (u64 i = 0; i < body; i++) total += (u64)x[i];
+#endif
+    for (u64 i = body; i < n; i++) total += (u64)x[i];
+    return (s64)total;
+}
+
+f64 simd_sum_f64(const f64 *x, u64 n) {
+    u64 body = n & ~3ul;
+    f64 lanes[4] = {0, 0, 0, 0};
+#ifdef SIMD_X86
+    if (has_avx2()) sum_f64_avx2(x, body, lanes);
+    else sum_f64_sse2(x, body, lanes);
+#else
+    for (u64 i = 0; i < body; i++) lanes[i % 4] += x[i];
+#endif
+    f64 total = combine_lanes(lanes);
+    for (u64 i = body; i < n; i++) total += x[i];
+    return total;
+}
+
+// There's no packed 64-bit multiply before AVX-512, so this is unrolled rather than vectorised.
+s64 simd_dot_s64(const s64 *x, const s64 *y, u64 n) {
+    u64 lanes[4] = {0, 0, 0, 0};
+    u64 body = n & ~3ul;
+    for (u64 i = 0; i < body; i += 4) {
+        lanes[0] += (u64)x[i]   * (u64)y[i];
+        lanes[1] += (u64)x[i+1] * (u64)y[i+1];
+        lanes[2] += (u64)x[i+2] * (u64)y[i+2];
+        lanes[3] += (u64)x[i+3] * (u64)y[i+3];
+    }
+    u64 total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (u64 i = body; i < n; i++) total += (u64)x[i] * (u64)y[i];
+    return (s64)total;
+}
+
+f64 simd_dot_f64(const f64 *x, const f64 *y, u64 n) {
+    u64 body = n & ~3ul;
+    f64 lanes[4] = {0, 0, 0, 0};
+#ifdef SIMD_X86
+    if (has_avx2()) dot_f64_avx2(x, y, body, lanes);
+    else dot_f64_sse2(x, y, body, lanes);
+#else
+    for (u64 i = 0; i < body; i++) lanes[i % 4] += x[i] * y[i];
+#endif
+    f64 total = combine_lanes(lanes);
+    for (u64 i = body; i < n; i++) total += x[i] * y[i];
+    return total;
+}
+
+static s64 minmax_s64(const s64 *x, u64 n, bool max) {
+    s64 result = x[0];
+    u64 start = 1;
+#ifdef SIMD_X86
+    if (has_avx2() && n >= 4) {
+        s64 lanes[4];
+        start = n & ~3ul;
+        minmax_s64_avx2(x, start, max, lanes);
+        for (int j = 0; j < 4; j++) {
+            if (max ? lanes[j] > result : lanes[j] < result) result = lanes[j];
+        }
+    }
+#endif
+    for (u64 i = start; i < n; i++) {
+        if (max ? x[i] > result : x[i] < result) result = x[i];
+    }
+    return result;
+}
+
+// Written as minpd and maxpd behave, which give the second operand unless the first is smaller (or larger).
+static f64 minmax_f64(const f64 *x, u64 n, bool max) {
+    f64 result = x[0];
+    u64 start = 1;
+#ifdef SIMD_X86
+    if (n >= 4) {
+        f64 lanes[4];
+        start = n & ~3ul;
+        if (has_avx2()) minmax_f64_avx2(x, start, max, lanes);
+        else minmax_f64_sse2(x, start, max, lanes);
+        for (int j = 0; j < 4; j++) {
+            result = (max ? (result > lanes[j] ? result : lanes[j]) : (result < lanes[j] ? result : lanes[j]));
+        }
+    }
+#endif
+    for (u64 i = start; i < n; i++) {
+        result = (max ? (result > x[i] ? result : x[i]) : (result < x[i] ? result : x[i]));
+    }
+    return result;
+}
+
+s64 simd_min_s64(const s64 *x, u64 n) { return minmax_s64(x, n, false); }
+s64 simd_max_s64(const s64 *x, u64 n) { return minmax_s64(x, n, true); }
+f64 simd_min_f64(const f64 *x, u64 n) { return minmax_f64(x, n, false); }
+f64 simd_max_f64(const f64 *x, u64 n) { return minmax_f64(x, n, true); }
+
+void simd_scale_s64(s64 *out, const s64 *x, s64 k, u64 n) {
+    for (u64 i = 0; i < n; i++) out[i] = (s64)((u64)x[i] * (u64)k);
+}
+
+void simd_scale_f64(f64 *out, const f64 *x, f64 k, u64 n) {
+    u64 body = n & ~3ul;
+#ifdef SIMD_X86
+    if (has_avx2()) scale_f64_avx2(out, x, k, body);
+    else scale_f64_sse2(out, x, k, body);
+#else
+    body = 0;
+#endif
+    for (u64 i = body; i < n; i++) out[i] = x[i] * k;
+}
+
+void simd_fill_64(void *out, u64 bits, u64 n) {
+    u64 *dst = out;
+    u64 body = n & ~3ul;
+#ifdef SIMD_X86
+    if (has_avx2()) fill_64_avx2(dst, bits, body);
+    else fill_64_sse2(dst, bits, body);
+#else
+    body = 0;
+#endif
+    for (u64 i = body; i < n; i++) dst[i] = bits;
+}
@@ -0,0 +1,54 @@
+#ifndef SIMD_h
+#define SIMD_h
+
+#include "common.h"
+
+// Kernels behind the array builtins, over the unboxed storage of integer and float arrays.
+// They use AVX2 when the processor has it, and SSE2 otherwise (or plain loops off x86-64).
+//
+// Float sums and dot products are accumulated in four lanes whichever path is taken, so the result of
+// a program doesn't depend on the machine it runs on.
+
+s64  simd_sum_s64(const s64 *x, u64 n);
+f64  simd_sum_f64(const f64 *x, u64 n);
+s64  simd_dot_s64(const s64 *x, const s64 *y, u64 n);
+f64  simd_dot_f64(const f64 *x, const f64 *y, u64 n);
+
+// `n` must be at least 1.
+s64  simd_min_s64(const s64 *x, u64 n);
+s64  simd_max_s64(const s64 *x, u64 n);
+f64  simd_min_f64(const f64 *x, u64 n);
+f64  simd_max_f64(const f64 *x, u64 n);
+
+void simd_scale_s64(s64 *out, const s64 *x, s64 k, u64 n);
+void simd_scale_f64(f64 *out, const f64 *x, f64 k, u64 n);
+void simd_fill_64(void *out, u64 bits, u64 n);
+
+// Compare sixteen bytes at once, for probing hash maps: bit i of the result is set when bytes[i] equals
+// `byte` (or has its high bit set).
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+static inline u32 simd_match_16(const u8 *bytes, u8 byte) {
+    __m128i group = _mm_loadu_si128((const __m128i *)bytes);
+    return (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+}
+
+static inline u32 simd_high_bits_16(const u8 *bytes) {
+    return (u32)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)bytes));
+}
+#else
+static inline u32 simd_match_16(const u8 *bytes, u8 byte) {
+    u32 bits = 0;
+    for (int i = 0; i < 16; i++) bits |= (u32)(bytes[i] == byte) << i;
+    return bits;
+}
+
+static inline u32 simd_high_bits_16(const u8 *bytes) {
+    u32 bits = 0;
+    for (int i = 0; i < 16; i++) bits |= (u32)(bytes[i] >> 7) << i;
+    return bits;
+}
+#endif
+
+#endif
@@ -0,0 +1,78 @@
+#include "tier.h"
+#include "ir.h"
+#include "jit.h"
+
+#include <stdlib.h>
+
+void tier_init(Interp *interp) {
+    Tier *tier = malloc(sizeof(Tier));
+    tier->length      = interp->instructions.length;
+    tier->num_lambdas = interp->root_scope->constant_pool.length;
+    tier->counters    = calloc(tier->num_lambdas, sizeof(u32));
+    tier->lambdas     = calloc(tier->num_lambdas, sizeof(AstNode *));
+    tier->owners      = calloc(tier->length, sizeof(s32));
+    tier->recompiled  = 0;
+
+    Ast ast = interp->program;
+    for (u64 i = 0; i < ast.length; i++) {
+        AstNode *node = ast.data[i];
+        if (!node) break;
+        if (node->tag != NODE_LAMBDA || !(node->lambda.flags & LAMBDA_REACHABLE)) continue;
+        tier->lambdas[node->lambda.constant_pool_index] = node;
+    }
+
+    // Functions are compiled as blocks at the top level, so they don't nest.
+    for (u64 pc = 0; pc < tier->length; pc++) {
+        Instruction instr = interp->instructions.data[pc];
+        if (instr.op != BEGIN_BLOCK || instr.arg < 0 || (u64)instr.arg >= tier->num_lambdas) continue;
+        if (!tier->lambdas[instr.arg]) continue;
+        for (; pc < tier->length; pc++) {
+            tier->owners[pc] = instr.arg;
+            Instruction end = interp->instructions.data[pc];
+            if (end.op == END_BLOCK && end.arg == instr.arg) break;
+        }
+    }
+    interp->tier = tier;
+}
+
+void tier_free(Interp *interp) {
+    Tier *tier = interp->tier;
+    if (!tier) return;
+    free(tier->counters);
+    free(tier->lambdas);
+    free(tier->owners);
+    free(tier);
+    interp->tier = NULL;
+}
+
+// Compiles the function through the IR, after the program's HALT, and points its root constant at the new code.
+// Calls already running carry on in the old code.
+static void tier_up(Interp *interp, s32 lambda) {
+    Tier *tier = interp->tier;
+    AstNode *node = tier->lambdas[lambda];
+
+    StackFrame *scope = interp->scope;
+    interp->scope = interp->root_scope;
+    u64 begin = interp->instructions.length;
+    bool compiled = compile_func_optimized(interp, node);
+    interp->scope = scope;
+    if (!compiled) return;
+
+    // Skip the BEGIN_BLOCK, which is never run, the same as calling the function after it had been.
+    interp->root_scope->constant_pool.data[lambda].integer = begin + 1;
+    tier->recompiled++;
+    if (interp->jit) jit_grow(interp);
+}
+
+void tier_note_call(Interp *interp, s32 lambda) {
+    Tier *tier = interp->tier;
+    if (lambda < 0 || (u64)lambda >= tier->num_lambdas || !tier->lambdas[lambda]) return;
+    if (++tier->counters[lambda] == TIER_UP_THRESHOLD) tier_up(interp, lambda);
+}
+
+void tier_note_back_edge(Interp *interp, u64 from) {
+    Tier *tier = interp->tier;
+    // Loops in code which has been recompiled, or at the top level, have nothing to tier up to.
+    if (from >= tier->length || tier->owners[from] == 0) return;
+    tier_note_call(interp, tier->owners[from]);
+}
@@ -0,0 +1,28 @@
+#ifndef TIER_h
+#define TIER_h
+
+#include "context.h"
+#include "common.h"
+#include "ast.h"
+
+// Tiered compilation, enabled with -tier. Everything starts out compiled by the plain compiler, which is quick.
+// Functions which get hot, by being called or by looping, are compiled again through the IR with the passes -O
+// runs, and calls from then on go to the new code.
+
+typedef struct Tier {
+    u32      *counters;      // calls and back-edges seen, indexed by the function's root constant
+    AstNode **lambdas;       // indexed by root constant, NULL unless it's a function
+    u64       num_lambdas;
+    s32      *owners;        // the root constant of the function each instruction is in, 0 for top-level code
+    u64       length;        // number of instructions when tiering started
+    u64       recompiled;
+} Tier;
+
+void tier_init(Interp *interp);
+void tier_free(Interp *interp);
+
+// Called by the interpreter on each call, with the callee's root constant, and on each backward jump.
+void tier_note_call(Interp *interp, s32 lambda);
+void tier_note_back_edge(Interp *interp, u64 from);
+
+#endif